@@ -0,0 +1,172 @@
+#include "AreaPortals.h"
+
+#include <algorithm>
+
+// func_door spawnflag for doors that start open.
+const int DOOR_START_OPEN = 1;
+
+AreaPortals::AreaPortals(const BSPLoader& loader) : loader{ loader }
+{
+	const std::vector<leaf>& leafs = loader.get_leafs();
+	const std::vector<model>& models = loader.get_models();
+	const std::vector<entity>& entities = loader.get_entities();
+
+	for (const leaf& _leaf : leafs)
+		area_count = std::max(area_count, _leaf.area + 1);
+
+	std::vector<int> touched;
+	for (int i = 0; i < entities.size(); ++i)
+	{
+		const entity& ent = entities[i];
+		std::string model_name = ent.value("model");
+		if (ent.value("classname") != "func_door" || model_name.size() < 2 || model_name[0] != '*')
+			continue;
+
+		int model_index = atoi(model_name.c_str() + 1);
+		if (model_index <= 0 || model_index >= models.size())
+			continue;
+
+		// the same box the server links the door with, a unit bigger all round.
+		const model& _model = models[model_index];
+		glm::vec3 origin(0.0f);
+		ent.vector_value("origin", origin);
+		glm::vec3 mins = glm::vec3(_model.mins[0], _model.mins[1], _model.mins[2]) + origin - 1.0f;
+		glm::vec3 maxs = glm::vec3(_model.maxs[0], _model.maxs[1], _model.maxs[2]) + origin + 1.0f;
+
+		touched.clear();
+		if (!loader.get_nodes().empty())
+			box_leafs(0, mins, maxs, touched);
+
+		// a door inside one area isn't a portal. more than two is a mapping error, Q3 uses the first two.
+		int areas[2] = { -1, -1 };
+		for (int leaf_index : touched)
+		{
+			int area = leafs[leaf_index].area;
+			if (area < 0 || area == areas[0] || area == areas[1])
+				continue;
+			if (areas[0] < 0)
+				areas[0] = area;
+			else if (areas[1] < 0)
+				areas[1] = area;
+		}
+		if (areas[1] < 0)
+			continue;
+
+		bool open = (atoi(ent.value("spawnflags").c_str()) & DOOR_START_OPEN) != 0;
+		portals.push_back(area_portal{ { areas[0], areas[1] }, i, open });
+	}
+
+	area_flood.resize(area_count);
+	areamask.reserve((area_count + 7) / 8);
+}
+
+void AreaPortals::box_leafs(int node_index, const glm::vec3& mins, const glm::vec3& maxs, std::vector<int>& out) const
+{
+	while (node_index >= 0)
+	{
+		const node& _node = loader.get_nodes()[node_index];
+		const plane& _plane = loader.get_planes()[_node.plane];
+		glm::vec3 normal(_plane.normal[0], _plane.normal[1], _plane.normal[2]);
+
+		// the box corners nearest and furthest along the normal.
+		glm::vec3 near_corner(normal.x >= 0 ? mins.x : maxs.x, normal.y >= 0 ? mins.y : maxs.y, normal.z >= 0 ? mins.z : maxs.z);
+		glm::vec3 far_corner(normal.x >= 0 ? maxs.x : mins.x, normal.y >= 0 ? maxs.y : mins.y, normal.z >= 0 ? maxs.z : mins.z);
+
+		if (glm::dot(normal, near_corner) - _plane.dist >= 0)
+			node_index = _node.children[0];
+		else if (glm::dot(normal, far_corner) - _plane.dist < 0)
+			node_index = _node.children[1];
+		else
+		{
+			box_leafs(_node.children[0], mins, maxs, out);
+			node_index = _node.children[1];
+		}
+	}
+
+	out.push_back(-node_index - 1);
+}
+
+void AreaPortals::set_open(int portal, bool open)
+{
+	if (portals[portal].open != open)
+	{
+		portals[portal].open = open;
+		flood_valid = false;
+	}
+}
+
+void AreaPortals::set_all_open(bool open)
+{
+	for (int i = 0; i < portals.size(); ++i)
+		set_open(i, open);
+}
+
+void AreaPortals::flood()
+{
+	std::fill(area_flood.begin(), area_flood.end(), -1);
+
+	// areas reachable through each area's open portals.
+	std::vector<std::vector<int>> neighbours(area_count);
+	for (const area_portal& portal : portals)
+	{
+		if (!portal.open)
+			continue;
+		neighbours[portal.area[0]].push_back(portal.area[1]);
+		neighbours[portal.area[1]].push_back(portal.area[0]);
+	}
+
+	std::vector<int> stack;
+	for (int start = 0; start < area_count; ++start)
+	{
+		if (area_flood[start] >= 0)
+			continue;
+
+		area_flood[start] = start;
+		stack.push_back(start);
+		while (!stack.empty())
+		{
+			int area = stack.back();
+			stack.pop_back();
+			for (int next : neighbours[area])
+			{
+				if (area_flood[next] < 0)
+				{
+					area_flood[next] = start;
+					stack.push_back(next);
+				}
+			}
+		}
+	}
+
+	flood_valid = true;
+}
+
+const std::vector<ubyte>& AreaPortals::get_areamask(const glm::vec3& position)
+{
+	const std::vector<leaf>& leafs = loader.get_leafs();
+	int area = leafs.empty() ? -1 : leafs[loader.find_leaf(position)].area;
+
+	// same area and no door moved, so the last mask still holds.
+	if (flood_valid && area == camera_area)
+		return areamask;
+
+	if (!flood_valid)
+		flood();
+	camera_area = area;
+
+	areamask.clear();
+	connected = 0;
+	if (area < 0)
+		return areamask;
+
+	areamask.resize((area_count + 7) / 8, 0);
+	for (int i = 0; i < area_count; ++i)
+	{
+		if (area_flood[i] == area_flood[area])
+		{
+			areamask[i / 8] |= 1 << (i % 8);
+			connected++;
+		}
+	}
+	return areamask;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "BSPLoader.h"
+
+// a door between two areas. while it's closed neither area can see into the other through it.
+struct area_portal
+{
+	int area[2];
+	int entity;			// index into the entity lump
+	bool open;
+};
+
+// which areas can see each other, like Q3's cm_areaportals. q3map splits the map into areas
+// along areaportal brushes, and every func_door that touches two areas is the portal between
+// them. flooding through the open portals gives, for the camera's area, the mask of areas that
+// Visibility should keep - so closing a door drops the rooms behind it.
+class AreaPortals
+{
+public:
+	// doors start the way the entity lump has them: closed unless spawnflags has START_OPEN.
+	explicit AreaPortals(const BSPLoader& loader);
+
+	void set_open(int portal, bool open);
+	void set_all_open(bool open);
+
+	// one bit per area connected to the area containing position (BSP space). empty if the
+	// position isn't in an area, which rules nothing out.
+	const std::vector<ubyte>& get_areamask(const glm::vec3& position);
+
+	const std::vector<area_portal>& get_portals() const { return portals; }
+	int get_area_count() const { return area_count; }
+	int get_camera_area() const { return camera_area; }
+	// areas in the last mask, the camera's own included.
+	int get_connected_count() const { return connected; }
+private:
+	void box_leafs(int node, const glm::vec3& mins, const glm::vec3& maxs, std::vector<int>& out) const;
+	void flood();
+
+	const BSPLoader& loader;
+
+	int area_count = 0;
+	std::vector<area_portal> portals;
+	std::vector<int> area_flood;	// areas with the same number are connected
+
+	bool flood_valid = false;
+	int camera_area = -1;
+	int connected = 0;
+	std::vector<ubyte> areamask;
+};
@@ -0,0 +1,387 @@
+#include "BSPCollision.h"
+#include "BrushBVH.h"
+
+#include <algorithm>
+#include <cmath>
+
+BSPCollision::BSPCollision(const BSPLoader& loader) :
+	loader{ loader },
+	planes{ loader.get_planes() },
+	nodes{ loader.get_nodes() },
+	leafs{ loader.get_leafs() },
+	leafbrushes{ loader.get_leafbrushes() },
+	brushes{ loader.get_brushes() },
+	brushsides{ loader.get_brushsides() },
+	textures{ loader.get_textures() },
+	leaffaces{ loader.get_leaffaces() },
+	patches{ loader }
+{
+}
+
+bool segment_hits_box(const glm::vec3& p, const glm::vec3& inv_delta, const glm::vec3& mins, const glm::vec3& maxs, float max_frac)
+{
+	float t0 = 0.0f;
+	float t1 = max_frac;
+
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		if (std::isinf(inv_delta[axis]))
+		{
+			// parallel to this slab, so it is either always inside it or never.
+			if (p[axis] < mins[axis] || p[axis] > maxs[axis])
+				return false;
+			continue;
+		}
+
+		float near_t = (mins[axis] - p[axis]) * inv_delta[axis];
+		float far_t = (maxs[axis] - p[axis]) * inv_delta[axis];
+		if (near_t > far_t)
+			std::swap(near_t, far_t);
+
+		t0 = std::max(t0, near_t);
+		t1 = std::min(t1, far_t);
+		if (t0 > t1)
+			return false;
+	}
+
+	return true;
+}
+
+trace_result BSPCollision::trace(const glm::vec3& start, const glm::vec3& end, int mask) const
+{
+	return trace(start, end, glm::vec3(0.0f), glm::vec3(0.0f), mask);
+}
+
+trace_result BSPCollision::trace(const glm::vec3& start, const glm::vec3& end,
+	const glm::vec3& mins, const glm::vec3& maxs, int mask) const
+{
+	trace_query query = QUERY_BOX;
+	if (mins == maxs)
+		query = glm::length(end - start) < SHORT_TRACE_LENGTH ? QUERY_SHORT_RAY : QUERY_LONG_RAY;
+
+	return trace(start, end, mins, maxs, mask, backends[query]);
+}
+
+trace_result BSPCollision::trace(const glm::vec3& start, const glm::vec3& end,
+	const glm::vec3& mins, const glm::vec3& maxs, int mask, trace_backend backend) const
+{
+	trace_work work;
+	begin_trace(work, start, end, mins, maxs, mask);
+
+	if (backend == BACKEND_BRUSH_BVH && bvh)
+		bvh->trace_through_bvh(work);
+	else if (!nodes.empty())
+		trace_through_tree(work, 0, 0.0f, 1.0f, work.start, work.end);
+
+	end_trace(work, start, end);
+	return work.result;
+}
+
+void BSPCollision::begin_trace(trace_work& work, const glm::vec3& start, const glm::vec3& end,
+	const glm::vec3& mins, const glm::vec3& maxs, int mask) const
+{
+	work.mask = mask;
+	work.result.fraction = 1.0f;
+	work.result.contents = 0;
+	work.result.startsolid = false;
+	work.result.allsolid = false;
+	work.result.hit_plane = plane{ { 0.0f, 0.0f, 0.0f }, 0.0f };
+
+	// shift the box so it is symmetric around the origin, the node tests rely on that.
+	glm::vec3 offset = (mins + maxs) * 0.5f;
+	work.mins = mins - offset;
+	work.maxs = maxs - offset;
+	work.start = start + offset;
+	work.end = end + offset;
+	work.extents = work.maxs;
+	glm::vec3 delta = work.end - work.start;
+	work.inv_delta = glm::vec3(1.0f / delta.x, 1.0f / delta.y, 1.0f / delta.z);
+	work.is_point = work.extents.x == 0.0f && work.extents.y == 0.0f && work.extents.z == 0.0f;
+}
+
+void BSPCollision::end_trace(trace_work& work, const glm::vec3& start, const glm::vec3& end) const
+{
+	if (work.result.fraction == 1.0f)
+		work.result.endpos = end;
+	else
+		work.result.endpos = start + (end - start) * work.result.fraction;
+}
+
+void BSPCollision::trace_through_tree(trace_work& work, int num, float p1f, float p2f, const glm::vec3& p1, const glm::vec3& p2) const
+{
+	// already hit something nearer than this part of the sweep.
+	if (work.result.fraction <= p1f)
+		return;
+
+	if (num < 0)
+	{
+		trace_through_leaf(work, leafs[-num - 1]);
+		return;
+	}
+
+	const node& _node = nodes[num];
+	const plane& _plane = planes[_node.plane];
+	glm::vec3 normal{ _plane.normal[0], _plane.normal[1], _plane.normal[2] };
+
+	float t1 = glm::dot(normal, p1) - _plane.dist;
+	float t2 = glm::dot(normal, p2) - _plane.dist;
+	float offset = 0.0f;
+
+	if (!work.is_point)
+		offset = std::fabs(work.extents.x * normal.x) + std::fabs(work.extents.y * normal.y) + std::fabs(work.extents.z * normal.z);
+
+	// entirely on one side, no need to split.
+	if (t1 >= offset + 1 && t2 >= offset + 1)
+	{
+		trace_through_tree(work, _node.children[0], p1f, p2f, p1, p2);
+		return;
+	}
+	if (t1 < -offset - 1 && t2 < -offset - 1)
+	{
+		trace_through_tree(work, _node.children[1], p1f, p2f, p1, p2);
+		return;
+	}
+
+	// put the crosspoint SURFACE_CLIP_EPSILON pixels on the near side.
+	int side;
+	float frac, frac2;
+
+	if (t1 < t2)
+	{
+		float idist = 1.0f / (t1 - t2);
+		side = 1;
+		frac2 = (t1 + offset + SURFACE_CLIP_EPSILON) * idist;
+		frac = (t1 - offset + SURFACE_CLIP_EPSILON) * idist;
+	}
+	else if (t1 > t2)
+	{
+		float idist = 1.0f / (t1 - t2);
+		side = 0;
+		frac2 = (t1 - offset - SURFACE_CLIP_EPSILON) * idist;
+		frac = (t1 + offset + SURFACE_CLIP_EPSILON) * idist;
+	}
+	else
+	{
+		side = 0;
+		frac = 1.0f;
+		frac2 = 0.0f;
+	}
+
+	frac = glm::clamp(frac, 0.0f, 1.0f);
+	frac2 = glm::clamp(frac2, 0.0f, 1.0f);
+
+	// move up to the node on the near side.
+	float midf = p1f + (p2f - p1f) * frac;
+	glm::vec3 mid = p1 + (p2 - p1) * frac;
+	trace_through_tree(work, _node.children[side], p1f, midf, p1, mid);
+
+	// then from the node on to the far side.
+	midf = p1f + (p2f - p1f) * frac2;
+	mid = p1 + (p2 - p1) * frac2;
+	trace_through_tree(work, _node.children[side ^ 1], midf, p2f, mid, p2);
+}
+
+void BSPCollision::trace_through_leaf(trace_work& work, const leaf& _leaf) const
+{
+	for (int i = 0; i < _leaf.n_leafbrushes; ++i)
+	{
+		const brush& _brush = brushes[leafbrushes[_leaf.leafbrush + i].brush];
+
+		if (!(textures[_brush.texture].contents & work.mask))
+			continue;
+
+		trace_through_brush(work, _brush);
+
+		if (work.result.fraction == 0.0f)
+			return;
+	}
+
+	// curved surfaces are reached through the leaf's faces rather than its brushes.
+	for (int i = 0; i < _leaf.n_leaffaces; ++i)
+	{
+		int patch = patches.get_face_patch(leaffaces[_leaf.leaffaces + i].face);
+		if (patch < 0)
+			continue;
+
+		trace_through_patch(work, patches.get_patches()[patch]);
+
+		if (work.result.fraction == 0.0f)
+			return;
+	}
+}
+
+void BSPCollision::trace_through_brush(trace_work& work, const brush& _brush) const
+{
+	if (_brush.n_brushsides == 0)
+		return;
+
+	float enter_frac = -1.0f;
+	float leave_frac = 1.0f;
+	const plane* clip_plane = nullptr;
+	bool getout = false;
+	bool startout = false;
+
+	for (int i = 0; i < _brush.n_brushsides; ++i)
+	{
+		const plane& _plane = planes[brushsides[_brush.brushside + i].plane];
+		glm::vec3 normal{ _plane.normal[0], _plane.normal[1], _plane.normal[2] };
+
+		// push the plane out by the corner of the box that reaches furthest towards it.
+		float dist = _plane.dist;
+		if (!work.is_point)
+		{
+			glm::vec3 corner{
+				normal.x < 0 ? work.maxs.x : work.mins.x,
+				normal.y < 0 ? work.maxs.y : work.mins.y,
+				normal.z < 0 ? work.maxs.z : work.mins.z
+			};
+			dist -= glm::dot(corner, normal);
+		}
+
+		float d1 = glm::dot(work.start, normal) - dist;
+		float d2 = glm::dot(work.end, normal) - dist;
+
+		if (d2 > 0)
+			getout = true;
+		if (d1 > 0)
+			startout = true;
+
+		// completely in front of this face, so no intersection with the brush.
+		if (d1 > 0 && (d2 >= SURFACE_CLIP_EPSILON || d2 >= d1))
+			return;
+
+		// completely behind this face, keep looking.
+		if (d1 <= 0 && d2 <= 0)
+			continue;
+
+		if (d1 > d2)
+		{
+			// entering the brush
+			float f = (d1 - SURFACE_CLIP_EPSILON) / (d1 - d2);
+			if (f < 0)
+				f = 0;
+			if (f > enter_frac)
+			{
+				enter_frac = f;
+				clip_plane = &_plane;
+			}
+		}
+		else
+		{
+			// leaving the brush
+			float f = (d1 + SURFACE_CLIP_EPSILON) / (d1 - d2);
+			if (f > 1)
+				f = 1;
+			if (f < leave_frac)
+				leave_frac = f;
+		}
+	}
+
+	int contents = textures[_brush.texture].contents;
+
+	if (!startout)
+	{
+		work.result.startsolid = true;
+		if (!getout)
+		{
+			work.result.allsolid = true;
+			work.result.fraction = 0.0f;
+			work.result.contents = contents;
+		}
+		return;
+	}
+
+	if (enter_frac < leave_frac && enter_frac > -1 && enter_frac < work.result.fraction)
+	{
+		if (enter_frac < 0)
+			enter_frac = 0;
+
+		work.result.fraction = enter_frac;
+		work.result.hit_plane = *clip_plane;
+		work.result.contents = contents;
+	}
+}
+
+void BSPCollision::trace_through_patch(trace_work& work, const patch_collide& patch) const
+{
+	if (!(patch.contents & work.mask))
+		return;
+
+	// the bounds test is all most traces ever pay for a patch.
+	glm::vec3 grow = work.extents + 1.0f;
+	if (!segment_hits_box(work.start, work.inv_delta, patch.mins - grow, patch.maxs + grow, work.result.fraction))
+		return;
+
+	const std::vector<patch_facet>& facets = patches.get_facets();
+	const std::vector<plane>& facet_planes = patches.get_planes();
+
+	for (int i = patch.first_facet; i < patch.first_facet + patch.n_facets; ++i)
+	{
+		const patch_facet& facet = facets[i];
+		float enter_frac = -1.0f;
+		float leave_frac = 1.0f;
+		const plane* clip_plane = nullptr;
+		bool missed = false;
+
+		// same clipping as a brush, except facets are open behind the surface, so a trace
+		// that starts inside one never counts as solid.
+		for (int j = facet.first_plane; j < facet.first_plane + facet.n_planes; ++j)
+		{
+			const plane& _plane = facet_planes[j];
+			glm::vec3 normal{ _plane.normal[0], _plane.normal[1], _plane.normal[2] };
+
+			float dist = _plane.dist;
+			if (!work.is_point)
+			{
+				glm::vec3 corner{
+					normal.x < 0 ? work.maxs.x : work.mins.x,
+					normal.y < 0 ? work.maxs.y : work.mins.y,
+					normal.z < 0 ? work.maxs.z : work.mins.z
+				};
+				dist -= glm::dot(corner, normal);
+			}
+
+			float d1 = glm::dot(work.start, normal) - dist;
+			float d2 = glm::dot(work.end, normal) - dist;
+
+			if (d1 > 0 && (d2 >= SURFACE_CLIP_EPSILON || d2 >= d1))
+			{
+				missed = true;
+				break;
+			}
+
+			if (d1 <= 0 && d2 <= 0)
+				continue;
+
+			if (d1 > d2)
+			{
+				float f = (d1 - SURFACE_CLIP_EPSILON) / (d1 - d2);
+				if (f < 0)
+					f = 0;
+				if (f > enter_frac)
+				{
+					enter_frac = f;
+					clip_plane = &_plane;
+				}
+			}
+			else
+			{
+				float f = (d1 + SURFACE_CLIP_EPSILON) / (d1 - d2);
+				if (f > 1)
+					f = 1;
+				if (f < leave_frac)
+					leave_frac = f;
+			}
+		}
+
+		if (missed || !clip_plane)
+			continue;
+
+		if (enter_frac < leave_frac && enter_frac >= 0 && enter_frac < work.result.fraction)
+		{
+			work.result.fraction = enter_frac;
+			work.result.hit_plane = *clip_plane;
+			work.result.contents = patch.contents;
+		}
+	}
+}
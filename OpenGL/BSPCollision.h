@@ -0,0 +1,108 @@
+#pragma once
+
+#include "BSPLoader.h"
+#include "PatchCollide.h"
+
+// content masks, same groupings the Q3 game code uses.
+const int MASK_SOLID = CONTENTS_SOLID;
+const int MASK_PLAYERSOLID = CONTENTS_SOLID | CONTENTS_PLAYERCLIP | CONTENTS_BODY;
+const int MASK_SHOT = CONTENTS_SOLID | CONTENTS_BODY | CONTENTS_CORPSE;
+const int MASK_OPAQUE = CONTENTS_SOLID | CONTENTS_SLIME | CONTENTS_LAVA;
+
+// keep the trace end this far off the surface it hit so the next trace doesn't start inside it.
+const float SURFACE_CLIP_EPSILON = 0.125f;
+
+struct trace_result
+{
+	float fraction;		// 1 if nothing was hit
+	glm::vec3 endpos;
+	plane hit_plane;
+	int contents;		// contents of the brush that was hit
+	bool startsolid;	// started inside a brush
+	bool allsolid;		// never left the brush it started in
+};
+
+// point traces shorter than this count as "short" when picking a backend.
+const float SHORT_TRACE_LENGTH = 256.0f;
+
+enum trace_query
+{
+	QUERY_SHORT_RAY,
+	QUERY_LONG_RAY,
+	QUERY_BOX,
+	QUERY_TYPE_COUNT
+};
+
+enum trace_backend
+{
+	BACKEND_NODE_TREE,
+	BACKEND_BRUSH_BVH
+};
+
+class BrushBVH;
+
+// slab test of the segment p + t * delta, t in [0, max_frac], against a box.
+bool segment_hits_box(const glm::vec3& p, const glm::vec3& inv_delta, const glm::vec3& mins, const glm::vec3& maxs, float max_frac);
+
+// sweeps points and axis aligned boxes against the world brushes (model 0) and the curved
+// surface patches, Q3 cm_trace style.
+// all positions are in BSP space (z up), not the rotated space the renderer uses.
+class BSPCollision
+{
+	friend class BrushBVH;
+public:
+	explicit BSPCollision(const BSPLoader& loader);
+
+	// safe to call from several threads at once.
+	trace_result trace(const glm::vec3& start, const glm::vec3& end, int mask) const;
+	trace_result trace(const glm::vec3& start, const glm::vec3& end,
+		const glm::vec3& mins, const glm::vec3& maxs, int mask) const;
+
+	// the same sweep forced through one backend, for benchmarking.
+	trace_result trace(const glm::vec3& start, const glm::vec3& end,
+		const glm::vec3& mins, const glm::vec3& maxs, int mask, trace_backend backend) const;
+
+	// the brush BVH is optional, traces fall back to the node tree without one.
+	void set_bvh(const BrushBVH* _bvh) { bvh = _bvh; }
+
+	const PatchCollide& get_patches() const { return patches; }
+	void set_backend(trace_query query, trace_backend backend) { backends[query] = backend; }
+	trace_backend get_backend(trace_query query) const { return backends[query]; }
+private:
+	struct trace_work
+	{
+		glm::vec3 start;
+		glm::vec3 end;
+		glm::vec3 mins;
+		glm::vec3 maxs;
+		glm::vec3 extents;	// symmetric half size used to offset node planes
+		glm::vec3 inv_delta;	// 1 / (end - start), for the patch bounds tests
+		bool is_point;
+		int mask;
+		trace_result result;
+	};
+
+	void begin_trace(trace_work& work, const glm::vec3& start, const glm::vec3& end,
+		const glm::vec3& mins, const glm::vec3& maxs, int mask) const;
+	void end_trace(trace_work& work, const glm::vec3& start, const glm::vec3& end) const;
+
+	void trace_through_tree(trace_work& work, int num, float p1f, float p2f, const glm::vec3& p1, const glm::vec3& p2) const;
+	void trace_through_leaf(trace_work& work, const leaf& _leaf) const;
+	void trace_through_brush(trace_work& work, const brush& _brush) const;
+	void trace_through_patch(trace_work& work, const patch_collide& patch) const;
+
+	const BSPLoader& loader;
+	const BrushBVH* bvh = nullptr;
+	trace_backend backends[QUERY_TYPE_COUNT] = { BACKEND_NODE_TREE, BACKEND_NODE_TREE, BACKEND_NODE_TREE };
+
+	const std::vector<plane>& planes;
+	const std::vector<node>& nodes;
+	const std::vector<leaf>& leafs;
+	const std::vector<leafbrush>& leafbrushes;
+	const std::vector<brush>& brushes;
+	const std::vector<brushside>& brushsides;
+	const std::vector<texture>& textures;
+	const std::vector<leafface>& leaffaces;
+
+	PatchCollide patches;
+};
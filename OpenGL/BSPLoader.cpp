@@ -1,7 +1,9 @@
 #include "BSPLoader.h"
 #include "stb_image.h"
 
-std::vector<unsigned int> BSPLoader::get_indices()
+#include <sstream>
+
+std::vector<unsigned int> BSPLoader::get_indices() const
 {
 	std::vector<unsigned int> indices;
 
@@ -28,12 +30,101 @@ std::vector<unsigned int> BSPLoader::get_indices()
 	return indices;
 }
 
+int BSPLoader::find_leaf(const glm::vec3& point) const
+{
+	int index = 0;
+
+	// negative indices are leaves, stored as -(leaf + 1).
+	while (index >= 0)
+	{
+		const node& _node = file_nodes[index];
+		const plane& _plane = file_planes[_node.plane];
+		float distance = _plane.normal[0] * point.x + _plane.normal[1] * point.y + _plane.normal[2] * point.z - _plane.dist;
+
+		index = distance >= 0 ? _node.children[0] : _node.children[1];
+	}
+
+	return -index - 1;
+}
+
+bool BSPLoader::cluster_visible(int from, int to) const
+{
+	// no vis data, or a point outside the map - nothing can be ruled out.
+	if (file_visdata.vecs.empty() || from < 0 || to < 0)
+		return true;
+
+	ubyte bits = file_visdata.vecs[from * file_visdata.sz_vecs + to / 8];
+	return (bits & (1 << (to % 8))) != 0;
+}
+
 void BSPLoader::get_lump_position(int index, int& offset, int& length)
 {
 	offset = file_directory.direntries[index].offset;
 	length = file_directory.direntries[index].length;
 }
 
+std::string entity::value(const std::string& key) const
+{
+	auto it = keys.find(key);
+	return it == keys.end() ? std::string() : it->second;
+}
+
+bool entity::vector_value(const std::string& key, glm::vec3& out) const
+{
+	auto it = keys.find(key);
+	if (it == keys.end())
+		return false;
+
+	std::istringstream stream{ it->second };
+	stream >> out.x >> out.y >> out.z;
+	return !stream.fail();
+}
+
+void BSPLoader::process_entities(int length)
+{
+	// the lump is plain text: { "key" "value" ... } blocks, one per entity.
+	entity current;
+	bool in_entity = false;
+	std::string key;
+	bool have_key = false;
+
+	for (int i = 0; i < length && file_entities.ents[i] != '\0'; ++i)
+	{
+		char c = file_entities.ents[i];
+
+		if (c == '{')
+		{
+			current = entity{};
+			in_entity = true;
+			have_key = false;
+		}
+		else if (c == '}')
+		{
+			if (in_entity)
+				entity_list.push_back(current);
+			in_entity = false;
+		}
+		else if (c == '"' && in_entity)
+		{
+			int start = ++i;
+			while (i < length && file_entities.ents[i] != '"' && file_entities.ents[i] != '\0')
+				++i;
+
+			std::string token{ file_entities.ents + start, file_entities.ents + i };
+			if (!have_key)
+			{
+				key = token;
+				have_key = true;
+			}
+			else
+			{
+				current.keys[key] = token;
+				have_key = false;
+			}
+		}
+	}
+}
+
 void BSPLoader::process_textures()
 {
 	for (int i = 0; i < file_textures.size(); i++)
@@ -149,6 +240,7 @@ void BSPLoader::load_file()
 
 	fs.seekg(offset);
 	fs.read(file_entities.ents, length);
+	int entities_length = length;
 
 	// 1 to 15 are array based lumps
 	read_lump<texture>(1, file_textures, fs);
@@ -176,9 +268,11 @@ void BSPLoader::load_file()
 	int sz_vecs = file_visdata.sz_vecs;
 	int sz = nvecs * sz_vecs;
 	file_visdata.vecs.resize(sz);
-	fs.read((char*)&file_visdata.vecs[0], sz);
+	if (sz > 0)
+		fs.read((char*)&file_visdata.vecs[0], sz);
 	fs.close();
 
+	process_entities(entities_length);
 	process_textures();
 	process_lightmaps();
 }
@@ -4,6 +4,7 @@
 #include <fstream>
 #include <vector>
 #include <iostream>
+#include <map>
 
 
 #include <GL\glew.h>
@@ -67,7 +68,7 @@ struct visdata
 {
 	int n_vecs;
 	int sz_vecs;
-	std::vector<ubyte*> vecs;
+	std::vector<ubyte> vecs;
 };
 
 struct lightvol
@@ -220,6 +221,20 @@ struct Directory
 
 #pragma endregion
 
+// one { } block from the entity lump, as key/value pairs.
+struct entity
+{
+	std::map<std::string, std::string> keys;
+
+	// empty string if the key isn't set.
+	std::string value(const std::string& key) const;
+	bool vector_value(const std::string& key, glm::vec3& out) const;
+};
+
+// the renderer rotates the map -90 degrees about x, so BSP space is z up and GL space is y up.
+inline glm::vec3 bsp_to_gl(const glm::vec3& v) { return glm::vec3(v.x, v.z, -v.y); }
+inline glm::vec3 gl_to_bsp(const glm::vec3& v) { return glm::vec3(v.x, -v.z, v.y); }
+
 class BSPLoader
 {
 public:
@@ -228,17 +243,37 @@ public:
 		load_file();
 	}
 
-	std::vector<vertex> get_vertex_data() const { return file_vertices; }
+	const std::vector<vertex>& get_vertex_data() const { return file_vertices; }
 	face get_face(int index) const { return file_faces[index]; }
-	shader get_shader(int index) const { return shaders[index]; }
+	const shader& get_shader(int index) const { return shaders[index]; }
 	GLuint get_lightmap_tex(int index) const { return lightmaps[index].id; }
 	int get_face_count() const { return file_faces.size(); }
-	std::vector<unsigned int> get_indices();
+	std::vector<unsigned int> get_indices() const;
 	meshvert get_meshvert(int index) const { return file_meshverts[index]; }
 	GLuint get_lm_id() const { return lmap_id; }
+
+	// raw lump access for the collision and visibility code.
+	const std::vector<plane>& get_planes() const { return file_planes; }
+	const std::vector<node>& get_nodes() const { return file_nodes; }
+	const std::vector<leaf>& get_leafs() const { return file_leafs; }
+	const std::vector<leafface>& get_leaffaces() const { return file_leaffaces; }
+	const std::vector<leafbrush>& get_leafbrushes() const { return file_leafbrushes; }
+	const std::vector<model>& get_models() const { return file_models; }
+	const std::vector<brush>& get_brushes() const { return file_brushes; }
+	const std::vector<brushside>& get_brushsides() const { return file_brushsides; }
+	const std::vector<texture>& get_textures() const { return file_textures; }
+	const std::vector<face>& get_faces() const { return file_faces; }
+	const std::vector<entity>& get_entities() const { return entity_list; }
+	const visdata& get_visdata() const { return file_visdata; }
+
+	// walk the node tree down to the leaf containing point (BSP space, z up).
+	int find_leaf(const glm::vec3& point) const;
+	// true if cluster "to" is potentially visible from cluster "from".
+	bool cluster_visible(int from, int to) const;
 private:
 	void get_lump_position(int index, int& offset, int& length);
 
+	void process_entities(int length);
 	void process_textures();
 	void process_lightmaps();
 
@@ -260,6 +295,7 @@ private:
 
 	Directory file_directory;
 	entities file_entities;
+	std::vector<entity> entity_list;
 	int texture_count;
 	std::vector < texture > file_textures;
 	std::vector < plane > file_planes;
@@ -0,0 +1,211 @@
+#include "Benchmarks.h"
+
+#include <chrono>
+#include <cmath>
+#include <random>
+
+namespace
+{
+	struct sweep
+	{
+		glm::vec3 start;
+		glm::vec3 end;
+	};
+
+	double time_traces(const BSPCollision& collision, const std::vector<sweep>& sweeps, const glm::vec3& mins, const glm::vec3& maxs,
+		trace_backend backend, std::vector<trace_result>& results)
+	{
+		auto start_time = std::chrono::high_resolution_clock::now();
+
+		for (int i = 0; i < sweeps.size(); ++i)
+			results[i] = collision.trace(sweeps[i].start, sweeps[i].end, mins, maxs, MASK_PLAYERSOLID, backend);
+
+		auto end_time = std::chrono::high_resolution_clock::now();
+		return std::chrono::duration<double, std::milli>(end_time - start_time).count();
+	}
+}
+
+std::vector<trace_benchmark> benchmark_traces(const BSPLoader& loader, const BSPCollision& collision, int count, unsigned int seed)
+{
+	std::vector<trace_benchmark> benchmarks;
+	const std::vector<model>& models = loader.get_models();
+	if (models.empty() || count <= 0)
+		return benchmarks;
+
+	std::mt19937 rng{ seed };
+	std::uniform_real_distribution<float> unit{ 0.0f, 1.0f };
+
+	glm::vec3 world_mins{ models[0].mins[0], models[0].mins[1], models[0].mins[2] };
+	glm::vec3 world_maxs{ models[0].maxs[0], models[0].maxs[1], models[0].maxs[2] };
+	auto random_point = [&]()
+	{
+		return world_mins + (world_maxs - world_mins) * glm::vec3(unit(rng), unit(rng), unit(rng));
+	};
+	auto random_direction = [&]()
+	{
+		// rejection sample the unit sphere so directions aren't biased towards the corners.
+		glm::vec3 dir;
+		do
+		{
+			dir = glm::vec3(unit(rng), unit(rng), unit(rng)) * 2.0f - 1.0f;
+		} while (glm::dot(dir, dir) > 1.0f || glm::dot(dir, dir) < 0.0001f);
+		return glm::normalize(dir);
+	};
+
+	// player sized box, the same one the Q3 game uses.
+	const glm::vec3 player_mins{ -15.0f, -15.0f, -24.0f };
+	const glm::vec3 player_maxs{ 15.0f, 15.0f, 32.0f };
+
+	struct setup
+	{
+		const char* name;
+		trace_query query;
+		float length;	// 0 means start and end are both random points in the world
+		bool box;
+	};
+	const setup setups[] = {
+		{ "short ray", QUERY_SHORT_RAY, 64.0f, false },
+		{ "long ray", QUERY_LONG_RAY, 0.0f, false },
+		{ "box sweep", QUERY_BOX, 128.0f, true },
+	};
+
+	std::vector<sweep> sweeps(count);
+	std::vector<trace_result> node_results(count), bvh_results(count);
+
+	for (const setup& _setup : setups)
+	{
+		for (auto& _sweep : sweeps)
+		{
+			_sweep.start = random_point();
+			_sweep.end = _setup.length > 0 ? _sweep.start + random_direction() * _setup.length : random_point();
+		}
+
+		glm::vec3 mins = _setup.box ? player_mins : glm::vec3(0.0f);
+		glm::vec3 maxs = _setup.box ? player_maxs : glm::vec3(0.0f);
+
+		trace_benchmark result;
+		result.name = _setup.name;
+		result.query = _setup.query;
+		result.traces = count;
+		result.node_tree_ms = time_traces(collision, sweeps, mins, maxs, BACKEND_NODE_TREE, node_results);
+		result.brush_bvh_ms = time_traces(collision, sweeps, mins, maxs, BACKEND_BRUSH_BVH, bvh_results);
+
+		// only the fraction is compared, which brush a trace starting in solid reports first
+		// depends on the order the brushes are visited in, same as in Q3.
+		result.mismatches = 0;
+		for (int i = 0; i < count; ++i)
+		{
+			if (std::fabs(node_results[i].fraction - bvh_results[i].fraction) > 0.0001f)
+				result.mismatches++;
+		}
+
+		benchmarks.push_back(result);
+	}
+
+	return benchmarks;
+}
+
+void apply_fastest_backends(BSPCollision& collision, const std::vector<trace_benchmark>& results)
+{
+	for (const trace_benchmark& result : results)
+		collision.set_backend(result.query, result.brush_bvh_ms < result.node_tree_ms ? BACKEND_BRUSH_BVH : BACKEND_NODE_TREE);
+}
+
+sector_benchmark benchmark_world_sectors(const BSPLoader& loader, int entity_count, int frames, unsigned int seed)
+{
+	sector_benchmark result{};
+	result.entities = entity_count;
+	result.frames = frames;
+
+	const std::vector<model>& models = loader.get_models();
+	if (models.empty() || entity_count <= 0)
+		return result;
+
+	glm::vec3 world_mins{ models[0].mins[0], models[0].mins[1], models[0].mins[2] };
+	glm::vec3 world_maxs{ models[0].maxs[0], models[0].maxs[1], models[0].maxs[2] };
+
+	std::mt19937 rng{ seed };
+	std::uniform_real_distribution<float> unit{ 0.0f, 1.0f };
+
+	struct mover
+	{
+		int handle;
+		glm::vec3 origin;
+		glm::vec3 velocity;
+		glm::vec3 half_size;
+	};
+
+	WorldSectors sectors{ loader };
+	std::vector<mover> movers(entity_count);
+	for (auto& _mover : movers)
+	{
+		_mover.handle = sectors.add_entity(CONTENTS_BODY);
+		_mover.origin = world_mins + (world_maxs - world_mins) * glm::vec3(unit(rng), unit(rng), unit(rng));
+		_mover.velocity = (glm::vec3(unit(rng), unit(rng), unit(rng)) * 2.0f - 1.0f) * 320.0f;
+		// mostly player sized, with the odd big mover thrown in.
+		_mover.half_size = unit(rng) < 0.95f ? glm::vec3(16.0f, 16.0f, 28.0f) : glm::vec3(128.0f, 128.0f, 64.0f);
+	}
+
+	std::vector<int> touching;
+	const float frame_time = 1.0f / 60.0f;
+
+	for (int frame = 0; frame < frames; ++frame)
+	{
+		// move, bouncing off the world bounds, and relink.
+		auto link_start = std::chrono::high_resolution_clock::now();
+		for (auto& _mover : movers)
+		{
+			_mover.origin += _mover.velocity * frame_time;
+			for (int axis = 0; axis < 3; ++axis)
+			{
+				if (_mover.origin[axis] < world_mins[axis] || _mover.origin[axis] > world_maxs[axis])
+				{
+					_mover.velocity[axis] = -_mover.velocity[axis];
+					_mover.origin[axis] = glm::clamp(_mover.origin[axis], world_mins[axis], world_maxs[axis]);
+				}
+			}
+			sectors.link(_mover.handle, _mover.origin - _mover.half_size, _mover.origin + _mover.half_size);
+		}
+		auto link_end = std::chrono::high_resolution_clock::now();
+		result.link_ms += std::chrono::duration<double, std::milli>(link_end - link_start).count();
+
+		std::vector<int> sector_counts(entity_count), linear_counts(entity_count, 0);
+
+		auto query_start = std::chrono::high_resolution_clock::now();
+		for (int i = 0; i < entity_count; ++i)
+		{
+			touching.clear();
+			sectors.query_box(movers[i].origin - movers[i].half_size, movers[i].origin + movers[i].half_size, CONTENTS_BODY, touching);
+			sector_counts[i] = touching.size();
+		}
+		auto query_end = std::chrono::high_resolution_clock::now();
+		result.sector_query_ms += std::chrono::duration<double, std::milli>(query_end - query_start).count();
+
+		auto linear_start = std::chrono::high_resolution_clock::now();
+		for (int i = 0; i < entity_count; ++i)
+		{
+			glm::vec3 mins = movers[i].origin - movers[i].half_size;
+			glm::vec3 maxs = movers[i].origin + movers[i].half_size;
+			for (const mover& other : movers)
+			{
+				glm::vec3 other_mins = other.origin - other.half_size;
+				glm::vec3 other_maxs = other.origin + other.half_size;
+				if (other_mins.x > maxs.x || other_mins.y > maxs.y || other_mins.z > maxs.z ||
+					other_maxs.x < mins.x || other_maxs.y < mins.y || other_maxs.z < mins.z)
+					continue;
+				linear_counts[i]++;
+			}
+		}
+		auto linear_end = std::chrono::high_resolution_clock::now();
+		result.linear_query_ms += std::chrono::duration<double, std::milli>(linear_end - linear_start).count();
+
+		for (int i = 0; i < entity_count; ++i)
+		{
+			result.touches += sector_counts[i];
+			if (sector_counts[i] != linear_counts[i])
+				result.mismatches++;
+		}
+	}
+
+	return result;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "BSPCollision.h"
+#include "WorldSectors.h"
+
+struct trace_benchmark
+{
+	const char* name;
+	trace_query query;
+	int traces;
+	double node_tree_ms;
+	double brush_bvh_ms;
+	int mismatches;		// traces where the two backends disagreed on the result
+};
+
+// times the node tree against the brush BVH for short rays, long rays and box sweeps,
+// using the same random sweeps inside the world bounds for both.
+std::vector<trace_benchmark> benchmark_traces(const BSPLoader& loader, const BSPCollision& collision, int count, unsigned int seed = 1);
+
+// points every query type at whichever backend came out faster.
+void apply_fastest_backends(BSPCollision& collision, const std::vector<trace_benchmark>& results);
+
+struct sector_benchmark
+{
+	int entities;
+	int frames;
+	double link_ms;			// relinking every entity after it moved
+	double sector_query_ms;	// one touch query per entity through the sector tree
+	double linear_query_ms;	// the same queries as a scan over every entity
+	long long touches;		// total overlaps found, the same for both query methods
+	int mismatches;			// queries where the two methods found a different number of entities
+};
+
+// moves a crowd of entity boxes around the world for a number of frames, relinking them
+// and running a touch query for each one, and times the sector tree against a linear scan.
+sector_benchmark benchmark_world_sectors(const BSPLoader& loader, int entity_count, int frames, unsigned int seed = 1);
@@ -0,0 +1,279 @@
+#include "BrushBVH.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+	const int SAH_BINS = 12;
+	const int MAX_LEAF_BRUSHES = 4;
+	const float TRAVERSAL_COST = 1.0f;
+	const float BRUSH_COST = 1.0f;
+
+	// traversal keeps one pending sibling per level, so this also bounds the trace stack.
+	const int MAX_DEPTH = 64;
+
+	float surface_area(const glm::vec3& mins, const glm::vec3& maxs)
+	{
+		glm::vec3 size = maxs - mins;
+		return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+	}
+}
+
+BrushBVH::BrushBVH(const BSPLoader& loader, const BSPCollision& collision) : collision{ collision }
+{
+	const std::vector<model>& models = loader.get_models();
+	const std::vector<brush>& brushes = loader.get_brushes();
+	const std::vector<brushside>& brushsides = loader.get_brushsides();
+	const std::vector<plane>& planes = loader.get_planes();
+	const std::vector<texture>& textures = loader.get_textures();
+
+	// only the world model's brushes, the same set the node tree leaves reference.
+	int first_brush = 0;
+	int brush_count = brushes.size();
+	glm::vec3 world_mins{ -65536.0f }, world_maxs{ 65536.0f };
+	if (!models.empty())
+	{
+		first_brush = models[0].brush;
+		brush_count = models[0].n_brushes;
+		world_mins = glm::vec3(models[0].mins[0], models[0].mins[1], models[0].mins[2]);
+		world_maxs = glm::vec3(models[0].maxs[0], models[0].maxs[1], models[0].maxs[2]);
+	}
+
+	std::vector<brush_bounds> items;
+	items.reserve(brush_count);
+
+	for (int i = first_brush; i < first_brush + brush_count; ++i)
+	{
+		const brush& _brush = brushes[i];
+		if (_brush.n_brushsides == 0)
+			continue;
+
+		// q3map always emits the six axial sides of a brush, they give its bounds directly.
+		brush_bounds bounds;
+		bool has_min[3] = { false, false, false };
+		bool has_max[3] = { false, false, false };
+		for (int j = 0; j < _brush.n_brushsides; ++j)
+		{
+			const plane& _plane = planes[brushsides[_brush.brushside + j].plane];
+			for (int axis = 0; axis < 3; ++axis)
+			{
+				if (_plane.normal[axis] == 1.0f)
+				{
+					bounds.maxs[axis] = has_max[axis] ? std::min(bounds.maxs[axis], _plane.dist) : _plane.dist;
+					has_max[axis] = true;
+				}
+				else if (_plane.normal[axis] == -1.0f)
+				{
+					bounds.mins[axis] = has_min[axis] ? std::max(bounds.mins[axis], -_plane.dist) : -_plane.dist;
+					has_min[axis] = true;
+				}
+			}
+		}
+
+		// a side without an axial plane can't be bounded cheaply, so let it span the world.
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			if (!has_min[axis])
+				bounds.mins[axis] = world_mins[axis];
+			if (!has_max[axis])
+				bounds.maxs[axis] = world_maxs[axis];
+		}
+
+		bounds.centre = (bounds.mins + bounds.maxs) * 0.5f;
+		bounds.brush = i;
+		bounds.contents = textures[_brush.texture].contents;
+		items.push_back(bounds);
+	}
+
+	// patches go in alongside the brushes, tagged with negative indices.
+	const std::vector<patch_collide>& patches = collision.get_patches().get_patches();
+	for (int i = 0; i < patches.size(); ++i)
+	{
+		brush_bounds bounds;
+		bounds.mins = patches[i].mins;
+		bounds.maxs = patches[i].maxs;
+		bounds.centre = (bounds.mins + bounds.maxs) * 0.5f;
+		bounds.brush = -i - 1;
+		bounds.contents = patches[i].contents;
+		items.push_back(bounds);
+	}
+
+	nodes.reserve(items.size() * 2);
+	brush_order.reserve(items.size());
+
+	if (!items.empty())
+		build(items, 0, items.size(), 1);
+}
+
+int BrushBVH::build(std::vector<brush_bounds>& items, int begin, int end, int level)
+{
+	int index = nodes.size();
+	nodes.push_back(bvh_node{});
+	depth = std::max(depth, level);
+
+	glm::vec3 mins = items[begin].mins, maxs = items[begin].maxs;
+	glm::vec3 centre_mins = items[begin].centre, centre_maxs = items[begin].centre;
+	int contents = 0;
+	for (int i = begin; i < end; ++i)
+	{
+		mins = glm::min(mins, items[i].mins);
+		maxs = glm::max(maxs, items[i].maxs);
+		centre_mins = glm::min(centre_mins, items[i].centre);
+		centre_maxs = glm::max(centre_maxs, items[i].centre);
+		contents |= items[i].contents;
+	}
+
+	nodes[index].mins = mins;
+	nodes[index].maxs = maxs;
+	nodes[index].contents = contents;
+
+	int count = end - begin;
+
+	// split along the axis the centres spread out over the most.
+	glm::vec3 spread = centre_maxs - centre_mins;
+	int axis = 0;
+	if (spread.y > spread[axis]) axis = 1;
+	if (spread.z > spread[axis]) axis = 2;
+
+	int best_split = -1;
+	float best_cost = BRUSH_COST * count;
+
+	if (count > MAX_LEAF_BRUSHES && spread[axis] > 0.0f && level < MAX_DEPTH)
+	{
+		// binned SAH: drop the centres into buckets and sweep the bucket boundaries.
+		struct bin { glm::vec3 mins, maxs; int count; };
+		bin bins[SAH_BINS];
+		for (auto& b : bins)
+		{
+			b.mins = glm::vec3(1e30f);
+			b.maxs = glm::vec3(-1e30f);
+			b.count = 0;
+		}
+
+		float scale = SAH_BINS / spread[axis];
+		for (int i = begin; i < end; ++i)
+		{
+			int b = std::min(SAH_BINS - 1, (int)((items[i].centre[axis] - centre_mins[axis]) * scale));
+			bins[b].mins = glm::min(bins[b].mins, items[i].mins);
+			bins[b].maxs = glm::max(bins[b].maxs, items[i].maxs);
+			bins[b].count++;
+		}
+
+		float right_area[SAH_BINS];
+		int right_count[SAH_BINS];
+		glm::vec3 rmins{ 1e30f }, rmaxs{ -1e30f };
+		int rcount = 0;
+		for (int b = SAH_BINS - 1; b > 0; --b)
+		{
+			rmins = glm::min(rmins, bins[b].mins);
+			rmaxs = glm::max(rmaxs, bins[b].maxs);
+			rcount += bins[b].count;
+			right_area[b] = rcount ? surface_area(rmins, rmaxs) : 0.0f;
+			right_count[b] = rcount;
+		}
+
+		float parent_area = surface_area(mins, maxs);
+		glm::vec3 lmins{ 1e30f }, lmaxs{ -1e30f };
+		int lcount = 0;
+		for (int b = 1; b < SAH_BINS; ++b)
+		{
+			lmins = glm::min(lmins, bins[b - 1].mins);
+			lmaxs = glm::max(lmaxs, bins[b - 1].maxs);
+			lcount += bins[b - 1].count;
+			if (lcount == 0 || right_count[b] == 0)
+				continue;
+
+			float cost = TRAVERSAL_COST + BRUSH_COST *
+				(surface_area(lmins, lmaxs) * lcount + right_area[b] * right_count[b]) / parent_area;
+			if (cost < best_cost)
+			{
+				best_cost = cost;
+				best_split = b;
+			}
+		}
+
+		if (best_split >= 0)
+		{
+			auto middle = std::partition(items.begin() + begin, items.begin() + end, [&](const brush_bounds& item)
+			{
+				return std::min(SAH_BINS - 1, (int)((item.centre[axis] - centre_mins[axis]) * scale)) < best_split;
+			});
+
+			int mid = middle - items.begin();
+			nodes[index].axis = axis;
+			nodes[index].count = 0;
+			build(items, begin, mid, level + 1);
+			int second = build(items, mid, end, level + 1);
+			nodes[index].first = second;
+			return index;
+		}
+	}
+
+	// leaf, either small enough or nothing beat testing every brush.
+	nodes[index].first = brush_order.size();
+	nodes[index].count = count;
+	nodes[index].axis = axis;
+	for (int i = begin; i < end; ++i)
+		brush_order.push_back(items[i].brush);
+
+	return index;
+}
+
+void BrushBVH::trace_through_bvh(BSPCollision::trace_work& work) const
+{
+	if (nodes.empty())
+		return;
+
+	glm::vec3 delta = work.end - work.start;
+
+	// grow the node boxes by the trace box, plus a unit of slack like the node tree uses.
+	glm::vec3 grow = work.extents + 1.0f;
+
+	int stack[MAX_DEPTH + 1];
+	int top = 0;
+	stack[top++] = 0;
+
+	while (top > 0)
+	{
+		const bvh_node& _node = nodes[stack[--top]];
+
+		if (!(_node.contents & work.mask))
+			continue;
+		if (!segment_hits_box(work.start, work.inv_delta, _node.mins - grow, _node.maxs + grow, work.result.fraction))
+			continue;
+
+		if (_node.count > 0)
+		{
+			for (int i = 0; i < _node.count; ++i)
+			{
+				int index = brush_order[_node.first + i];
+				if (index < 0)
+				{
+					collision.trace_through_patch(work, collision.patches.get_patches()[-index - 1]);
+				}
+				else
+				{
+					const brush& _brush = collision.brushes[index];
+					if (!(collision.textures[_brush.texture].contents & work.mask))
+						continue;
+
+					collision.trace_through_brush(work, _brush);
+				}
+
+				if (work.result.fraction == 0.0f)
+					return;
+			}
+			continue;
+		}
+
+		// push the far child first so the near one is tested first and shortens the sweep.
+		int index = &_node - &nodes[0];
+		int near_child = index + 1;
+		int far_child = _node.first;
+		if (delta[_node.axis] < 0)
+			std::swap(near_child, far_child);
+		stack[top++] = far_child;
+		stack[top++] = near_child;
+	}
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "BSPCollision.h"
+
+// bounding volume hierarchy over the world brush and patch AABBs, as an alternative to walking
+// the node tree for traces. every brush is stored exactly once, so long sweeps don't keep
+// re-testing brushes that are shared between many small leaves.
+class BrushBVH
+{
+public:
+	BrushBVH(const BSPLoader& loader, const BSPCollision& collision);
+
+	int get_node_count() const { return nodes.size(); }
+	int get_brush_count() const { return brush_order.size(); }
+	int get_depth() const { return depth; }
+private:
+	friend class BSPCollision;
+
+	struct bvh_node
+	{
+		glm::vec3 mins;
+		glm::vec3 maxs;
+		int contents;	// union of the brush contents below this node, for mask culling
+		int first;		// leaf: first entry in brush_order, interior: index of the second child
+		int count;		// number of brushes, 0 for interior nodes
+		int axis;		// split axis, used to visit the nearer child first
+	};
+
+	struct brush_bounds
+	{
+		glm::vec3 mins;
+		glm::vec3 maxs;
+		glm::vec3 centre;
+		int brush;		// brush index, or -(patch + 1) for a curved surface
+		int contents;
+	};
+
+	int build(std::vector<brush_bounds>& items, int begin, int end, int level);
+	void trace_through_bvh(BSPCollision::trace_work& work) const;
+
+	const BSPCollision& collision;
+
+	std::vector<bvh_node> nodes;
+	std::vector<int> brush_order;	// same encoding as brush_bounds::brush
+	int depth = 0;
+};
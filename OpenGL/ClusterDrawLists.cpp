@@ -0,0 +1,147 @@
+#include "ClusterDrawLists.h"
+
+#include <algorithm>
+
+ClusterDrawLists::ClusterDrawLists(const BSPLoader& loader, const render_mesh& mesh, IndirectRenderer& renderer) :
+	loader{ loader }, renderer{ renderer }
+{
+	const std::vector<leaf>& leafs = loader.get_leafs();
+	const std::vector<leafface>& leaffaces = loader.get_leaffaces();
+	const std::vector<face_record>& records = renderer.get_records();
+	const visdata& vis = loader.get_visdata();
+
+	// without vis data every cluster sees everything, so they all share the last list.
+	int n_clusters = vis.vecs.empty() ? 0 : vis.n_vecs;
+
+	// the faces listed in each cluster's leaves, as the faces that draw them.
+	std::vector<std::vector<int>> cluster_faces(n_clusters);
+	std::vector<int> stamp(records.size(), -1);
+	for (const leaf& _leaf : leafs)
+	{
+		if (_leaf.cluster < 0 || _leaf.cluster >= n_clusters)
+			continue;
+
+		for (int i = 0; i < _leaf.n_leaffaces; ++i)
+		{
+			int face_index = mesh.face_owners[leaffaces[_leaf.leaffaces + i].face];
+			if (records[face_index].bucket < 0 || stamp[face_index] == _leaf.cluster)
+				continue;
+
+			// leaves of a cluster aren't always next to each other, so this can still add a repeat.
+			stamp[face_index] = _leaf.cluster;
+			cluster_faces[_leaf.cluster].push_back(face_index);
+		}
+	}
+	for (std::vector<int>& faces : cluster_faces)
+	{
+		std::sort(faces.begin(), faces.end());
+		faces.erase(std::unique(faces.begin(), faces.end()), faces.end());
+	}
+
+	std::vector<glm::vec3> face_mins(records.size()), face_maxs(records.size());
+	for (int i = 0; i < records.size(); ++i)
+	{
+		const face_range& range = mesh.ranges[i];
+		for (unsigned int j = 0; j < range.n_indices; ++j)
+		{
+			const float* position = mesh.vertices[mesh.indices[range.first_index + j] + range.base_vertex].position;
+			glm::vec3 point(position[0], position[1], position[2]);
+			face_mins[i] = j == 0 ? point : glm::min(face_mins[i], point);
+			face_maxs[i] = j == 0 ? point : glm::max(face_maxs[i], point);
+		}
+	}
+
+	// sorted by bucket then buffer position, so runs that can share a command end up side by side.
+	auto add_list = [&](std::vector<int>& faces)
+	{
+		std::sort(faces.begin(), faces.end(), [&](int a, int b)
+		{
+			if (records[a].bucket != records[b].bucket)
+				return records[a].bucket < records[b].bucket;
+			return records[a].first_index < records[b].first_index;
+		});
+
+		list_range list{ (int)draws.size(), 0 };
+		for (int face_index : faces)
+		{
+			const face_record& record = records[face_index];
+			if (list.n_draws > 0)
+			{
+				cluster_draw& last = draws.back();
+				if (last.bucket == record.bucket && last.base_vertex == record.base_vertex &&
+					last.first_index + last.n_indices == record.first_index)
+				{
+					last.n_indices += record.n_indices;
+					last.mins = glm::min(last.mins, face_mins[face_index]);
+					last.maxs = glm::max(last.maxs, face_maxs[face_index]);
+					continue;
+				}
+			}
+
+			draws.push_back(cluster_draw{ record.bucket, record.first_index, record.n_indices, record.base_vertex,
+				face_mins[face_index], face_maxs[face_index] });
+			list.n_draws++;
+		}
+		lists.push_back(list);
+	};
+
+	std::vector<int> faces;
+	for (int cluster = 0; cluster < n_clusters; ++cluster)
+	{
+		faces.clear();
+		for (int other = 0; other < n_clusters; ++other)
+		{
+			if (!loader.cluster_visible(cluster, other))
+				continue;
+
+			for (int face_index : cluster_faces[other])
+			{
+				if (stamp[face_index] == n_clusters + cluster)
+					continue;
+				stamp[face_index] = n_clusters + cluster;
+				faces.push_back(face_index);
+			}
+		}
+		add_list(faces);
+	}
+
+	faces.clear();
+	for (int i = 0; i < records.size(); ++i)
+	{
+		if (records[i].bucket >= 0)
+			faces.push_back(i);
+	}
+	add_list(faces);
+}
+
+void ClusterDrawLists::update(const glm::vec3& position, const frustum& view_frustum)
+{
+	const std::vector<leaf>& leafs = loader.get_leafs();
+	int cluster = leafs.empty() ? -1 : leafs[loader.find_leaf(position)].cluster;
+	if (cluster != camera_cluster)
+		list_switches++;
+	camera_cluster = cluster;
+
+	// outside the map, or a cluster vis doesn't know about, gets everything.
+	int last = lists.size() - 1;
+	const list_range& list = lists[cluster >= 0 && cluster < last ? cluster : last];
+	list_size = list.n_draws;
+
+	drawn = 0;
+	renderer.clear_commands();
+	for (int i = list.first_draw; i < list.first_draw + list.n_draws; ++i)
+	{
+		const cluster_draw& run = draws[i];
+		if (!box_in_frustum(view_frustum, run.mins, run.maxs))
+			continue;
+
+		renderer.add_command(run.bucket, run.first_index, run.n_indices, run.base_vertex);
+		drawn++;
+	}
+	renderer.upload_commands();
+}
+
+void ClusterDrawLists::draw()
+{
+	renderer.draw();
+}
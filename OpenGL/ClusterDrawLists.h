@@ -0,0 +1,54 @@
+#pragma once
+
+#include "IndirectRenderer.h"
+#include "Visibility.h"
+
+// a run of the index buffer drawn with one command, made from one or more faces of a bucket.
+struct cluster_draw
+{
+	int bucket;
+	GLuint first_index;
+	GLuint n_indices;
+	GLint base_vertex;
+	glm::vec3 mins;
+	glm::vec3 maxs;
+};
+
+// for every cluster, the faces its PVS can see worked out once at load time: deduplicated, sorted
+// by material bucket and joined into contiguous runs where the index buffer allows. moving to
+// another cluster just switches lists, and a frame inside one only frustum tests that list's draws.
+// draws through an IndirectRenderer, so the same GL requirements apply.
+class ClusterDrawLists
+{
+public:
+	ClusterDrawLists(const BSPLoader& loader, const render_mesh& mesh, IndirectRenderer& renderer);
+
+	// position is in BSP space and the frustum planes in BSP space as well.
+	void update(const glm::vec3& position, const frustum& view_frustum);
+	// draws whatever the last update() kept.
+	void draw();
+
+	int get_camera_cluster() const { return camera_cluster; }
+	int get_list_size() const { return list_size; }
+	int get_drawn_count() const { return drawn; }
+	int get_list_switches() const { return list_switches; }
+	// the lists' size in memory, all clusters together.
+	size_t get_memory_size() const { return draws.size() * sizeof(cluster_draw) + lists.size() * sizeof(list_range); }
+private:
+	struct list_range
+	{
+		int first_draw;
+		int n_draws;
+	};
+
+	const BSPLoader& loader;
+	IndirectRenderer& renderer;
+
+	std::vector<cluster_draw> draws;
+	std::vector<list_range> lists;	// one per cluster, then one with everything for outside the map
+
+	int camera_cluster = -2;
+	int list_size = 0;
+	int drawn = 0;
+	int list_switches = 0;
+};
@@ -0,0 +1,183 @@
+#include "ComputeCulling.h"
+#include "DepthPyramid.h"
+
+#include <algorithm>
+#include <cstring>
+
+// must match local_size_x in the cull shader.
+const int CULL_GROUP_SIZE = 64;
+
+// creates a storage buffer, never empty since binding a zero sized buffer is an error.
+static GLuint create_storage_buffer(size_t size, const void* data, GLenum usage)
+{
+	GLuint buffer;
+	glGenBuffers(1, &buffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, std::max(size, (size_t)16), nullptr, usage);
+	if (size > 0 && data)
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, size, data);
+	return buffer;
+}
+
+ComputeCulling::ComputeCulling(const BSPLoader& loader, const render_mesh& mesh, IndirectRenderer& renderer, GLuint program) :
+	loader{ loader }, renderer{ renderer }, program{ program }
+{
+	const std::vector<leaf>& leafs = loader.get_leafs();
+	const std::vector<leafface>& leaffaces = loader.get_leaffaces();
+	face_count = loader.get_faces().size();
+
+	// which clusters each face can be seen from - every leaf it, or a face merged into it, is listed in.
+	std::vector<std::vector<GLuint>> face_clusters(face_count);
+	for (const leaf& _leaf : leafs)
+	{
+		if (_leaf.cluster < 0)
+			continue;
+
+		for (int i = 0; i < _leaf.n_leaffaces; ++i)
+		{
+			std::vector<GLuint>& clusters = face_clusters[mesh.face_owners[leaffaces[_leaf.leaffaces + i].face]];
+			if (std::find(clusters.begin(), clusters.end(), (GLuint)_leaf.cluster) == clusters.end())
+				clusters.push_back(_leaf.cluster);
+		}
+	}
+
+	std::vector<cull_face> faces(face_count);
+	std::vector<GLuint> clusters;
+	for (int i = 0; i < face_count; ++i)
+	{
+		cull_face& cull = faces[i];
+		const face_range& range = mesh.ranges[i];
+
+		glm::vec3 mins(0.0f), maxs(0.0f);
+		for (unsigned int j = 0; j < range.n_indices; ++j)
+		{
+			const float* position = mesh.vertices[mesh.indices[range.first_index + j] + range.base_vertex].position;
+			glm::vec3 point(position[0], position[1], position[2]);
+			mins = j == 0 ? point : glm::min(mins, point);
+			maxs = j == 0 ? point : glm::max(maxs, point);
+		}
+
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			cull.mins[axis] = mins[axis];
+			cull.maxs[axis] = maxs[axis];
+		}
+		cull.first_cluster = clusters.size();
+		cull.n_clusters = face_clusters[i].size();
+		clusters.insert(clusters.end(), face_clusters[i].begin(), face_clusters[i].end());
+	}
+
+	// the shader only needs where each bucket's region starts.
+	std::vector<GLuint> bucket_starts;
+	for (const draw_bucket& bucket : renderer.get_buckets())
+		bucket_starts.push_back(bucket.first_command);
+
+	const visdata& vis = loader.get_visdata();
+	cluster_bits.resize((vis.sz_vecs + 3) / 4);
+
+	face_buffer = create_storage_buffer(faces.size() * sizeof(cull_face), faces.empty() ? nullptr : &faces[0], GL_STATIC_DRAW);
+	cluster_buffer = create_storage_buffer(clusters.size() * sizeof(GLuint), clusters.empty() ? nullptr : &clusters[0], GL_STATIC_DRAW);
+	visible_buffer = create_storage_buffer(cluster_bits.size() * sizeof(GLuint), nullptr, GL_STREAM_DRAW);
+	bucket_buffer = create_storage_buffer(bucket_starts.size() * sizeof(GLuint), bucket_starts.empty() ? nullptr : &bucket_starts[0], GL_STATIC_DRAW);
+	count_buffer = create_storage_buffer(bucket_starts.size() * sizeof(GLuint), nullptr, GL_STREAM_DRAW);
+	rejected_buffer = create_storage_buffer(sizeof(GLuint), nullptr, GL_STREAM_DRAW);
+}
+
+ComputeCulling::~ComputeCulling()
+{
+	glDeleteBuffers(1, &face_buffer);
+	glDeleteBuffers(1, &cluster_buffer);
+	glDeleteBuffers(1, &visible_buffer);
+	glDeleteBuffers(1, &bucket_buffer);
+	glDeleteBuffers(1, &count_buffer);
+	glDeleteBuffers(1, &rejected_buffer);
+}
+
+bool ComputeCulling::is_supported()
+{
+	return GLEW_VERSION_4_3;
+}
+
+void ComputeCulling::cull(const glm::vec3& position, const frustum& view_frustum, const DepthPyramid* pyramid)
+{
+	const std::vector<leaf>& leafs = loader.get_leafs();
+	const visdata& vis = loader.get_visdata();
+
+	camera_cluster = leafs.empty() ? -1 : leafs[loader.find_leaf(position)].cluster;
+	bool all_visible = vis.vecs.empty() || camera_cluster < 0;
+	if (!all_visible)
+	{
+		memcpy(&cluster_bits[0], &vis.vecs[camera_cluster * vis.sz_vecs], vis.sz_vecs);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, visible_buffer);
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, cluster_bits.size() * sizeof(GLuint), &cluster_bits[0]);
+	}
+
+	GLuint zero = 0;
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, count_buffer);
+	glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, rejected_buffer);
+	glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+
+	// without a count buffer the whole of every region gets drawn, so stale commands have to go.
+	if (!GLEW_ARB_indirect_parameters)
+	{
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, renderer.get_command_buffer());
+		glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+	}
+
+	GLint previous_program;
+	glGetIntegerv(GL_CURRENT_PROGRAM, &previous_program);
+	glUseProgram(program);
+
+	glUniform4fv(glGetUniformLocation(program, "frustumPlanes"), 6, &view_frustum.planes[0].x);
+	glUniform1ui(glGetUniformLocation(program, "faceCount"), face_count);
+	glUniform1i(glGetUniformLocation(program, "allClustersVisible"), all_visible);
+	if (pyramid)
+		pyramid->bind(program, 1);
+	else
+		glUniform1i(glGetUniformLocation(program, "hizEnabled"), GL_FALSE);
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, face_buffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, renderer.get_record_buffer());
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, cluster_buffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, visible_buffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, bucket_buffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, count_buffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, renderer.get_command_buffer());
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, rejected_buffer);
+
+	glDispatchCompute((face_count + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE, 1, 1);
+
+	// the draws read what the shader wrote as indirect commands and parameters.
+	glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+
+	glUseProgram(previous_program);
+}
+
+void ComputeCulling::draw()
+{
+	renderer.draw_gpu_commands(count_buffer);
+}
+
+int ComputeCulling::read_visible_count() const
+{
+	std::vector<GLuint> counts(renderer.get_buckets().size());
+	if (counts.empty())
+		return 0;
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, count_buffer);
+	glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, counts.size() * sizeof(GLuint), &counts[0]);
+
+	int total = 0;
+	for (GLuint count : counts)
+		total += count;
+	return total;
+}
+
+int ComputeCulling::read_hiz_rejected() const
+{
+	GLuint rejected = 0;
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, rejected_buffer);
+	glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(GLuint), &rejected);
+	return rejected;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "IndirectRenderer.h"
+#include "Visibility.h"
+
+class DepthPyramid;
+
+// bounds and cluster list of one face, as read by the culling compute shader (std430).
+struct cull_face
+{
+	float mins[3];
+	GLuint first_cluster;
+	float maxs[3];
+	GLuint n_clusters;
+};
+
+// frustum and PVS culling of every face in a compute shader, which writes the surviving draws
+// straight into the indirect renderer's command buffer. the CPU only finds the camera cluster
+// and uploads that cluster's vis row, so the per frame CPU cost doesn't grow with the map.
+// needs GL 4.3 (compute shaders and shader storage buffers).
+class ComputeCulling
+{
+public:
+	// program is the linked cull compute shader from shaders.inc.
+	ComputeCulling(const BSPLoader& loader, const render_mesh& mesh, IndirectRenderer& renderer, GLuint program);
+	~ComputeCulling();
+
+	static bool is_supported();
+
+	// position is in BSP space and the frustum planes in BSP space as well. with a valid depth
+	// pyramid, faces hidden behind last frame's depth are dropped too.
+	void cull(const glm::vec3& position, const frustum& view_frustum, const DepthPyramid* pyramid = nullptr);
+	// draws whatever the last cull() left in the command buffer.
+	void draw();
+
+	// reads the per bucket counts back from the GPU. this waits for the cull to finish, so it's
+	// only meant for stats and checking the results against the CPU path.
+	int read_visible_count() const;
+	// faces the depth pyramid test dropped, with the same wait.
+	int read_hiz_rejected() const;
+	int get_camera_cluster() const { return camera_cluster; }
+private:
+	const BSPLoader& loader;
+	IndirectRenderer& renderer;
+	GLuint program;
+
+	int face_count;
+	int camera_cluster = -1;
+
+	std::vector<GLuint> cluster_bits;	// the camera cluster's vis row, padded out to whole words
+
+	GLuint face_buffer;
+	GLuint cluster_buffer;		// clusters of every face, indexed by cull_face::first_cluster
+	GLuint visible_buffer;		// cluster_bits on the GPU
+	GLuint bucket_buffer;		// first command and capacity of every bucket
+	GLuint count_buffer;		// commands written per bucket this frame
+	GLuint rejected_buffer;		// faces the depth pyramid hid this frame
+};
@@ -0,0 +1,107 @@
+#include "DepthPyramid.h"
+
+#include <algorithm>
+
+// must match local_size_x and local_size_y in the hiz shaders.
+const int HIZ_GROUP_SIZE = 8;
+
+static int floor_power_of_two(int value)
+{
+	int power = 1;
+	while (power * 2 <= value)
+		power *= 2;
+	return power;
+}
+
+DepthPyramid::DepthPyramid(int width, int height, GLuint copy_program, GLuint reduce_program) :
+	width{ width }, height{ height }, copy_program{ copy_program }, reduce_program{ reduce_program }, clip{ 1.0f }
+{
+	// a power of two base halves exactly all the way down, so a uv lands on the same spot in every level.
+	base_width = floor_power_of_two(width);
+	base_height = floor_power_of_two(height);
+	levels = 1;
+	while ((base_width >> levels) > 0 || (base_height >> levels) > 0)
+		levels++;
+
+	GLint previous_texture;
+	glGetIntegerv(GL_TEXTURE_BINDING_2D, &previous_texture);
+
+	glGenTextures(1, &depth_texture);
+	glBindTexture(GL_TEXTURE_2D, depth_texture);
+	glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT24, width, height);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+	glGenTextures(1, &pyramid_texture);
+	glBindTexture(GL_TEXTURE_2D, pyramid_texture);
+	glTexStorage2D(GL_TEXTURE_2D, levels, GL_R32F, base_width, base_height);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+	glBindTexture(GL_TEXTURE_2D, previous_texture);
+}
+
+DepthPyramid::~DepthPyramid()
+{
+	glDeleteTextures(1, &depth_texture);
+	glDeleteTextures(1, &pyramid_texture);
+}
+
+bool DepthPyramid::is_supported()
+{
+	return GLEW_VERSION_4_3;
+}
+
+void DepthPyramid::build(const glm::mat4& clip)
+{
+	GLint previous_program, previous_texture;
+	glGetIntegerv(GL_CURRENT_PROGRAM, &previous_program);
+	glGetIntegerv(GL_TEXTURE_BINDING_2D, &previous_texture);
+
+	glBindTexture(GL_TEXTURE_2D, depth_texture);
+	glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 0, 0, width, height);
+
+	// the copy takes the farthest depth under each base texel's footprint.
+	glUseProgram(copy_program);
+	glUniform1i(glGetUniformLocation(copy_program, "depthTexture"), 0);
+	glUniform2i(glGetUniformLocation(copy_program, "depthSize"), width, height);
+	glBindImageTexture(0, pyramid_texture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+	glDispatchCompute((base_width + HIZ_GROUP_SIZE - 1) / HIZ_GROUP_SIZE, (base_height + HIZ_GROUP_SIZE - 1) / HIZ_GROUP_SIZE, 1);
+
+	glUseProgram(reduce_program);
+	for (int level = 1; level < levels; ++level)
+	{
+		int level_width = std::max(base_width >> level, 1);
+		int level_height = std::max(base_height >> level, 1);
+
+		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+		glBindImageTexture(0, pyramid_texture, level - 1, GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+		glBindImageTexture(1, pyramid_texture, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+		glDispatchCompute((level_width + HIZ_GROUP_SIZE - 1) / HIZ_GROUP_SIZE, (level_height + HIZ_GROUP_SIZE - 1) / HIZ_GROUP_SIZE, 1);
+	}
+
+	// the cull shader samples it as a texture.
+	glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+
+	glBindTexture(GL_TEXTURE_2D, previous_texture);
+	glUseProgram(previous_program);
+
+	this->clip = clip;
+	valid = true;
+}
+
+void DepthPyramid::bind(GLuint program, int unit) const
+{
+	glActiveTexture(GL_TEXTURE0 + unit);
+	glBindTexture(GL_TEXTURE_2D, pyramid_texture);
+	glActiveTexture(GL_TEXTURE0);
+
+	glUniform1i(glGetUniformLocation(program, "hizEnabled"), valid);
+	glUniform1i(glGetUniformLocation(program, "hizPyramid"), unit);
+	glUniformMatrix4fv(glGetUniformLocation(program, "hizClip"), 1, GL_FALSE, &clip[0][0]);
+	glUniform2f(glGetUniformLocation(program, "hizSize"), (float)base_width, (float)base_height);
+	glUniform1i(glGetUniformLocation(program, "hizLevels"), levels);
+	glUniform1f(glGetUniformLocation(program, "hizBoxMargin"), box_margin);
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <GL\glew.h>
+#include <glm\glm.hpp>
+
+// a max depth mip chain (Hi-Z) of the last frame's depth buffer, for occlusion tests on the GPU.
+// the depth is copied out of the framebuffer once the scene is drawn, squeezed onto a power of
+// two base level and halved level by level in compute, each texel keeping the farthest depth under
+// it. a box whose nearest depth is behind the farthest depth of the few texels covering it was
+// hidden last frame. tests use the matrix the pyramid was built with, so there's a frame of latency
+// but no readback. needs GL 4.3 (compute shaders and image load/store).
+class DepthPyramid
+{
+public:
+	// width and height are the framebuffer's. copy_program and reduce_program are the linked
+	// hizCopySource and hizReduceSource compute shaders from shaders.inc.
+	DepthPyramid(int width, int height, GLuint copy_program, GLuint reduce_program);
+	~DepthPyramid();
+
+	static bool is_supported();
+
+	// builds the pyramid from the read framebuffer's depth, drawn with clip (proj * view * model).
+	void build(const glm::mat4& clip);
+	// frames drawn without building one leave the pyramid too far behind to trust.
+	void invalidate() { valid = false; }
+	// how far the drawn positions can be from the map's, boxes are grown by it before testing.
+	void set_box_margin(float margin) { box_margin = margin; }
+
+	// binds the pyramid to the texture unit and sets the hiz uniforms of program, which must be in use.
+	void bind(GLuint program, int unit) const;
+
+	bool is_valid() const { return valid; }
+	int get_base_width() const { return base_width; }
+	int get_base_height() const { return base_height; }
+	int get_level_count() const { return levels; }
+private:
+	int width;
+	int height;
+	int base_width;
+	int base_height;
+	int levels;
+
+	GLuint copy_program;
+	GLuint reduce_program;
+	GLuint depth_texture;
+	GLuint pyramid_texture;
+
+	glm::mat4 clip;
+	bool valid = false;
+	float box_margin = 0.0f;
+};
@@ -0,0 +1,113 @@
+#include "DrawOrder.h"
+
+#include <algorithm>
+
+DrawOrder::DrawOrder(const BSPLoader& loader, const render_mesh& mesh) :
+	loader{ loader }
+{
+	const std::vector<leaf>& leafs = loader.get_leafs();
+	const std::vector<leafface>& leaffaces = loader.get_leaffaces();
+
+	std::vector<int> face_leafstamp(mesh.ranges.size(), -1);
+	leaf_faces.resize(leafs.size());
+	for (int i = 0; i < leafs.size(); ++i)
+	{
+		const leaf& _leaf = leafs[i];
+		for (int j = 0; j < _leaf.n_leaffaces; ++j)
+		{
+			int face_index = mesh.face_owners[leaffaces[_leaf.leaffaces + j].face];
+			if (face_leafstamp[face_index] == i || mesh.ranges[face_index].n_indices == 0)
+				continue;
+
+			face_leafstamp[face_index] = i;
+			leaf_faces[i].push_back(face_index);
+		}
+	}
+
+	for (int i = 0; i < mesh.ranges.size(); ++i)
+	{
+		if (mesh.ranges[i].n_indices > 0)
+			all_faces.push_back(i);
+	}
+
+	face_wanted.resize(mesh.ranges.size(), -1);
+	face_placed.resize(mesh.ranges.size(), -1);
+}
+
+const std::vector<int>& DrawOrder::front_to_back(const glm::vec3& position)
+{
+	return front_to_back(position, all_faces);
+}
+
+const std::vector<int>& DrawOrder::front_to_back(const glm::vec3& position, const std::vector<int>& faces)
+{
+	order(position, faces, false);
+	return ordered;
+}
+
+const std::vector<int>& DrawOrder::back_to_front(const glm::vec3& position, const std::vector<int>& faces)
+{
+	order(position, faces, true);
+	return ordered;
+}
+
+void DrawOrder::order(const glm::vec3& position, const std::vector<int>& faces, bool reverse)
+{
+	frame++;
+	for (int face_index : faces)
+		face_wanted[face_index] = frame;
+
+	// reversing the front to back walk keeps a face in several leaves with its nearest one, so it
+	// still goes after everything behind it.
+	ordered.clear();
+	walk(position);
+	if (reverse)
+		std::reverse(ordered.begin(), ordered.end());
+
+	for (int face_index : faces)
+	{
+		if (face_placed[face_index] != frame)
+		{
+			face_placed[face_index] = frame;
+			ordered.push_back(face_index);
+		}
+	}
+}
+
+void DrawOrder::walk(const glm::vec3& position)
+{
+	const std::vector<node>& nodes = loader.get_nodes();
+	const std::vector<plane>& planes = loader.get_planes();
+	if (nodes.empty())
+		return;
+
+	stack.clear();
+	stack.push_back(0);
+	while (!stack.empty())
+	{
+		int index = stack.back();
+		stack.pop_back();
+
+		if (index < 0)
+		{
+			for (int face_index : leaf_faces[-index - 1])
+			{
+				if (face_wanted[face_index] == frame && face_placed[face_index] != frame)
+				{
+					face_placed[face_index] = frame;
+					ordered.push_back(face_index);
+				}
+			}
+			continue;
+		}
+
+		// children[0] is in front of the plane. the near child goes on the stack last so it's
+		// walked first.
+		const node& _node = nodes[index];
+		const plane& _plane = planes[_node.plane];
+		float distance = _plane.normal[0] * position.x + _plane.normal[1] * position.y + _plane.normal[2] * position.z - _plane.dist;
+		int near_side = distance >= 0.0f ? 0 : 1;
+		stack.push_back(_node.children[near_side ^ 1]);
+		stack.push_back(_node.children[near_side]);
+	}
+}
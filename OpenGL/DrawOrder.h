@@ -0,0 +1,40 @@
+#pragma once
+
+#include "RenderMesh.h"
+
+// orders faces by walking the BSP tree front to back from the camera: at each node the child on
+// the camera's side of the plane goes first, so a leaf is only reached after every leaf that could
+// cover it. drawing opaque faces in that order lets the depth test throw away most of the hidden
+// fragments before they're shaded. a face in several leaves goes with the nearest one, and faces
+// outside the world's leaves (brush models) go last in the order they were given. back to front is
+// the same walk reversed, for blending, with those faces still last.
+class DrawOrder
+{
+public:
+	DrawOrder(const BSPLoader& loader, const render_mesh& mesh);
+
+	// every face with something to draw, position in BSP space. the list lives until the next call.
+	const std::vector<int>& front_to_back(const glm::vec3& position);
+	// just the given faces, each once.
+	const std::vector<int>& front_to_back(const glm::vec3& position, const std::vector<int>& faces);
+	const std::vector<int>& back_to_front(const glm::vec3& position, const std::vector<int>& faces);
+
+	// the faces with something to draw, in buffer order.
+	const std::vector<int>& get_faces() const { return all_faces; }
+private:
+	void order(const glm::vec3& position, const std::vector<int>& faces, bool reverse);
+	void walk(const glm::vec3& position);
+
+	const BSPLoader& loader;
+
+	std::vector<std::vector<int>> leaf_faces;	// face owners, once each
+	std::vector<int> all_faces;
+
+	// faces are marked with a frame number when asked for and again when placed.
+	std::vector<int> face_wanted;
+	std::vector<int> face_placed;
+	int frame = 0;
+
+	std::vector<int> stack;
+	std::vector<int> ordered;
+};
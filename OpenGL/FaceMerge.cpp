@@ -0,0 +1,474 @@
+#include "FaceMerge.h"
+
+#include <algorithm>
+#include <cmath>
+#include <unordered_map>
+
+// how far off the plane, in map units, a vertex can be and still count as on it.
+const float PLANE_EPSILON = 0.01f;
+// smallest twice-area a triangle needs to not count as degenerate, in square map units.
+const float AREA_EPSILON = 0.01f;
+
+// texcoord, lightmap coord and colour, in the units the tolerances below use.
+const int N_ATTRIBUTES = 8;
+const float ATTRIBUTE_TOLERANCE[N_ATTRIBUTES] = { 1.0f / 1024.0f, 1.0f / 1024.0f, 1.0f / 16384.0f, 1.0f / 16384.0f, 1.5f, 1.5f, 1.5f, 1.5f };
+
+// a face's outline, in the winding order of its triangles.
+struct merge_polygon
+{
+	int face;
+	std::vector<unsigned int> loop;
+	bool merged;		// took in another face, so needs new triangles
+	bool alive;			// false once merged into another polygon
+};
+
+static unsigned long long edge_key(unsigned int a, unsigned int b)
+{
+	return ((unsigned long long)a << 32) | b;
+}
+
+static void get_attributes(const vertex& v, float out[N_ATTRIBUTES])
+{
+	out[0] = v.texcoord[0][0];
+	out[1] = v.texcoord[0][1];
+	out[2] = v.texcoord[1][0];
+	out[3] = v.texcoord[1][1];
+	for (int i = 0; i < 4; ++i)
+		out[4 + i] = v.colour[i];
+}
+
+// the boundary of a face's triangles walked as one loop, empty if it isn't a single simple one.
+static std::vector<unsigned int> find_outline(const render_mesh& mesh, const face_range& range)
+{
+	std::vector<unsigned long long> edges;
+	for (unsigned int j = 0; j + 2 < range.n_indices; j += 3)
+	{
+		const unsigned int* triangle = &mesh.indices[range.first_index + j];
+		for (int k = 0; k < 3; ++k)
+			edges.push_back(edge_key(triangle[k] + range.base_vertex, triangle[(k + 1) % 3] + range.base_vertex));
+	}
+	std::sort(edges.begin(), edges.end());
+
+	// edges used by two triangles run both ways, only the outline runs one way.
+	std::unordered_map<unsigned int, unsigned int> next;
+	for (unsigned long long edge : edges)
+	{
+		unsigned int a = edge >> 32, b = edge & 0xffffffff;
+		if (std::binary_search(edges.begin(), edges.end(), edge_key(b, a)))
+			continue;
+		if (!next.emplace(a, b).second)
+			return {};
+	}
+
+	std::vector<unsigned int> loop;
+	if (next.empty())
+		return loop;
+
+	unsigned int start = next.begin()->first;
+	unsigned int v = start;
+	do
+	{
+		loop.push_back(v);
+		auto it = next.find(v);
+		if (it == next.end() || loop.size() > next.size())
+			return {};
+		v = it->second;
+	} while (v != start);
+
+	if (loop.size() != next.size())
+		return {};
+	return loop;
+}
+
+// 2d coordinates in a face's plane.
+struct plane_basis
+{
+	glm::vec3 normal, u, w;
+
+	explicit plane_basis(const glm::vec3& n) : normal{ n }
+	{
+		glm::vec3 helper = std::fabs(n.x) < 0.9f ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+		u = glm::normalize(glm::cross(n, helper));
+		w = glm::cross(n, u);
+	}
+
+	glm::vec2 project(const float position[3]) const
+	{
+		glm::vec3 p(position[0], position[1], position[2]);
+		return glm::vec2(glm::dot(p, u), glm::dot(p, w));
+	}
+};
+
+static float cross_2d(const glm::vec2& a, const glm::vec2& b, const glm::vec2& c)
+{
+	return (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+}
+
+// the loop turns the same way at every corner, allowing straight runs. sign is the turn
+// direction of the face windings.
+static bool is_convex(const std::vector<glm::vec2>& points, float sign)
+{
+	int n = points.size();
+	for (int i = 0; i < n; ++i)
+	{
+		if (cross_2d(points[i], points[(i + 1) % n], points[(i + 2) % n]) * sign < -AREA_EPSILON)
+			return false;
+	}
+	return true;
+}
+
+// every vertex's attributes fit one affine function of the plane coordinates.
+static bool is_affine(const render_mesh& mesh, const std::vector<unsigned int>& loop, const std::vector<glm::vec2>& points)
+{
+	// the widest triangle in the loop gives the best conditioned fit.
+	int n = points.size();
+	int a = 0, b = 1, c = 2;
+	float best = 0.0f;
+	for (int j = 1; j < n; ++j)
+	{
+		for (int k = j + 1; k < n; ++k)
+		{
+			float area = std::fabs(cross_2d(points[0], points[j], points[k]));
+			if (area > best)
+			{
+				best = area;
+				b = j;
+				c = k;
+			}
+		}
+	}
+	if (best < AREA_EPSILON)
+		return false;
+
+	glm::vec2 e1 = points[b] - points[a], e2 = points[c] - points[a];
+	float det = e1.x * e2.y - e1.y * e2.x;
+
+	float fa[N_ATTRIBUTES], fb[N_ATTRIBUTES], fc[N_ATTRIBUTES], f[N_ATTRIBUTES];
+	get_attributes(mesh.vertices[loop[a]], fa);
+	get_attributes(mesh.vertices[loop[b]], fb);
+	get_attributes(mesh.vertices[loop[c]], fc);
+
+	for (int i = 0; i < n; ++i)
+	{
+		// barycentric weights of the point against the fitted triangle.
+		glm::vec2 d = points[i] - points[a];
+		float s = (d.x * e2.y - d.y * e2.x) / det;
+		float t = (e1.x * d.y - e1.y * d.x) / det;
+
+		get_attributes(mesh.vertices[loop[i]], f);
+		for (int k = 0; k < N_ATTRIBUTES; ++k)
+		{
+			float expected = fa[k] + (fb[k] - fa[k]) * s + (fc[k] - fa[k]) * t;
+			if (std::fabs(f[k] - expected) > ATTRIBUTE_TOLERANCE[k])
+				return false;
+		}
+	}
+	return true;
+}
+
+// triangles for a convex loop that may have straight runs. a fan from a corner that makes no
+// flat triangles if there is one, otherwise a fan around a new vertex in the middle.
+static void triangulate(render_mesh& mesh, const std::vector<unsigned int>& loop, const std::vector<glm::vec2>& points,
+	std::vector<unsigned int>& out)
+{
+	int n = loop.size();
+	for (int apex = 0; apex < n; ++apex)
+	{
+		bool flat = false;
+		for (int i = 1; i + 1 < n && !flat; ++i)
+			flat = std::fabs(cross_2d(points[apex], points[(apex + i) % n], points[(apex + i + 1) % n])) < AREA_EPSILON;
+		if (flat)
+			continue;
+
+		for (int i = 1; i + 1 < n; ++i)
+		{
+			out.push_back(loop[apex]);
+			out.push_back(loop[(apex + i) % n]);
+			out.push_back(loop[(apex + i + 1) % n]);
+		}
+		return;
+	}
+
+	// the attributes are affine, so the average of the corners is exactly right for the middle.
+	vertex centre = mesh.vertices[loop[0]];
+	float sums[11] = {};
+	float colour[4] = {};
+	for (unsigned int v : loop)
+	{
+		const vertex& corner = mesh.vertices[v];
+		for (int k = 0; k < 3; ++k)
+		{
+			sums[k] += corner.position[k];
+			sums[3 + k] += corner.normal[k];
+		}
+		for (int k = 0; k < 4; ++k)
+		{
+			sums[6 + k] += (&corner.texcoord[0][0])[k];
+			colour[k] += corner.colour[k];
+		}
+	}
+	for (int k = 0; k < 3; ++k)
+	{
+		centre.position[k] = sums[k] / n;
+		centre.normal[k] = sums[3 + k] / n;
+	}
+	for (int k = 0; k < 4; ++k)
+	{
+		(&centre.texcoord[0][0])[k] = sums[6 + k] / n;
+		centre.colour[k] = (ubyte)std::lround(colour[k] / n);
+	}
+
+	unsigned int middle = mesh.vertices.size();
+	mesh.vertices.push_back(centre);
+	for (int i = 0; i < n; ++i)
+	{
+		out.push_back(middle);
+		out.push_back(loop[i]);
+		out.push_back(loop[(i + 1) % n]);
+	}
+}
+
+face_merge_report merge_coplanar_faces(render_mesh& mesh, const BSPLoader& loader)
+{
+	const std::vector<face>& faces = loader.get_faces();
+
+	face_merge_report report = {};
+	for (const face_range& range : mesh.ranges)
+	{
+		report.triangles_before += range.n_indices / 3;
+		report.ranges_before += range.n_indices > 0;
+	}
+
+	std::vector<merge_polygon> polygons;
+	std::vector<int> face_polygon(faces.size(), -1);
+	for (int i = 0; i < faces.size(); ++i)
+	{
+		if (faces[i].type != 1 || mesh.ranges[i].n_indices == 0)
+			continue;
+
+		std::vector<unsigned int> loop = find_outline(mesh, mesh.ranges[i]);
+		if (loop.size() < 3)
+			continue;
+
+		face_polygon[i] = polygons.size();
+		polygons.push_back(merge_polygon{ i, loop, false, true });
+	}
+
+	// directed outline edges to the polygon they belong to. a neighbour has the same edge reversed.
+	std::unordered_map<unsigned long long, int> edge_owner;
+	auto set_edges = [&](int p, bool add)
+	{
+		const std::vector<unsigned int>& loop = polygons[p].loop;
+		for (int i = 0; i < loop.size(); ++i)
+		{
+			unsigned long long key = edge_key(loop[i], loop[(i + 1) % loop.size()]);
+			if (add)
+				edge_owner[key] = p;
+			else
+				edge_owner.erase(key);
+		}
+	};
+	for (int p = 0; p < polygons.size(); ++p)
+		set_edges(p, true);
+
+	auto can_share = [&](const face& a, const face& b)
+	{
+		if (a.texture != b.texture || a.effect != b.effect || a.lm_index != b.lm_index)
+			return false;
+		return a.normal[0] * b.normal[0] + a.normal[1] * b.normal[1] + a.normal[2] * b.normal[2] > 0.9999f;
+	};
+
+	// grow each polygon by whichever neighbour fits until none does.
+	for (int p = 0; p < polygons.size(); ++p)
+	{
+		if (!polygons[p].alive)
+			continue;
+
+		const face& base = faces[polygons[p].face];
+		plane_basis basis(glm::vec3(base.normal[0], base.normal[1], base.normal[2]));
+		const float* origin = mesh.vertices[polygons[p].loop[0]].position;
+		float distance = glm::dot(basis.normal, glm::vec3(origin[0], origin[1], origin[2]));
+
+		std::vector<glm::vec2> points;
+		for (unsigned int v : polygons[p].loop)
+			points.push_back(basis.project(mesh.vertices[v].position));
+		float area = 0.0f;
+		for (int i = 0; i < points.size(); ++i)
+			area += points[i].x * points[(i + 1) % points.size()].y - points[(i + 1) % points.size()].x * points[i].y;
+		float sign = area >= 0.0f ? 1.0f : -1.0f;
+
+		bool grew = true;
+		while (grew)
+		{
+			grew = false;
+			std::vector<unsigned int>& loop = polygons[p].loop;
+			for (int i = 0; i < loop.size() && !grew; ++i)
+			{
+				unsigned int a = loop[i], b = loop[(i + 1) % loop.size()];
+				auto found = edge_owner.find(edge_key(b, a));
+				if (found == edge_owner.end())
+					continue;
+
+				int q = found->second;
+				merge_polygon& other = polygons[q];
+				if (q == p || !other.alive || !can_share(base, faces[other.face]))
+					continue;
+
+				bool on_plane = true;
+				for (unsigned int v : other.loop)
+				{
+					const float* position = mesh.vertices[v].position;
+					on_plane = on_plane && std::fabs(glm::dot(basis.normal, glm::vec3(position[0], position[1], position[2])) - distance) < PLANE_EPSILON;
+				}
+				if (!on_plane)
+					continue;
+
+				// our loop from b round to a, then theirs from just after a to just before b.
+				std::vector<unsigned int> joined;
+				for (int k = 0; k < loop.size(); ++k)
+					joined.push_back(loop[(i + 1 + k) % loop.size()]);
+				int start = std::find(other.loop.begin(), other.loop.end(), a) - other.loop.begin();
+				for (int k = 1; k + 1 < other.loop.size(); ++k)
+					joined.push_back(other.loop[(start + k) % other.loop.size()]);
+
+				std::vector<unsigned int> sorted = joined;
+				std::sort(sorted.begin(), sorted.end());
+				if (std::adjacent_find(sorted.begin(), sorted.end()) != sorted.end())
+					continue;
+
+				std::vector<glm::vec2> joined_points;
+				for (unsigned int v : joined)
+					joined_points.push_back(basis.project(mesh.vertices[v].position));
+				if (!is_convex(joined_points, sign) || !is_affine(mesh, joined, joined_points))
+					continue;
+
+				set_edges(p, false);
+				set_edges(q, false);
+				loop.swap(joined);
+				set_edges(p, true);
+
+				other.alive = false;
+				polygons[p].merged = true;
+				mesh.face_owners[other.face] = polygons[p].face;
+				report.faces_merged++;
+				grew = true;
+			}
+		}
+	}
+
+	// faces merged earlier into a polygon that was itself merged later point at the final one.
+	for (int i = 0; i < mesh.face_owners.size(); ++i)
+	{
+		int owner = i;
+		while (mesh.face_owners[owner] != owner)
+			owner = mesh.face_owners[owner];
+		mesh.face_owners[i] = owner;
+	}
+
+	// vertices drawn by anything besides one polygon have to stay, or they'd leave a crack.
+	std::vector<int> users(mesh.vertices.size(), 0);
+	std::vector<int> last_user(mesh.vertices.size(), -1);
+	for (int i = 0; i < mesh.ranges.size(); ++i)
+	{
+		int p = face_polygon[i];
+		if (p >= 0 && !polygons[p].alive)
+			continue;
+
+		const face_range& range = mesh.ranges[i];
+		for (unsigned int j = 0; j < range.n_indices; ++j)
+		{
+			unsigned int v = mesh.indices[range.first_index + j] + range.base_vertex;
+			if (last_user[v] != i)
+			{
+				last_user[v] = i;
+				users[v]++;
+			}
+		}
+		if (p >= 0 && polygons[p].merged)
+		{
+			for (unsigned int v : polygons[p].loop)
+			{
+				if (last_user[v] != i)
+				{
+					last_user[v] = i;
+					users[v]++;
+				}
+			}
+		}
+	}
+
+	// lay the index buffer out again in the same order, with the merged polygons' new triangles.
+	std::vector<unsigned int> indices;
+	indices.reserve(mesh.indices.size());
+	for (int i : ranges_in_buffer_order(mesh))
+	{
+		face_range& range = mesh.ranges[i];
+		int p = face_polygon[i];
+		unsigned int first = indices.size();
+
+		if (p >= 0 && !polygons[p].alive)
+		{
+			// drawn by the polygon it went into.
+		}
+		else if (p < 0 || !polygons[p].merged)
+		{
+			for (unsigned int j = 0; j < range.n_indices; ++j)
+				indices.push_back(mesh.indices[range.first_index + j] + range.base_vertex);
+		}
+		else
+		{
+			const face& base = faces[i];
+			plane_basis basis(glm::vec3(base.normal[0], base.normal[1], base.normal[2]));
+
+			std::vector<unsigned int> loop;
+			std::vector<glm::vec2> points;
+			for (unsigned int v : polygons[p].loop)
+			{
+				loop.push_back(v);
+				points.push_back(basis.project(mesh.vertices[v].position));
+			}
+
+			// straight through corners nothing else uses can go.
+			for (int k = 0; k < loop.size() && loop.size() > 3; )
+			{
+				int n = loop.size();
+				int prev = (k + n - 1) % n, next = (k + 1) % n;
+				if (users[loop[k]] == 1 && std::fabs(cross_2d(points[prev], points[k], points[next])) < AREA_EPSILON)
+				{
+					loop.erase(loop.begin() + k);
+					points.erase(points.begin() + k);
+				}
+				else
+					++k;
+			}
+
+			triangulate(mesh, loop, points, indices);
+		}
+
+		range.first_index = first;
+		range.n_indices = indices.size() - first;
+		range.base_vertex = 0;
+	}
+	mesh.indices.swap(indices);
+
+	// drop the vertices that went with the old triangles.
+	std::vector<int> remap(mesh.vertices.size(), -1);
+	std::vector<vertex> vertices;
+	for (unsigned int& index : mesh.indices)
+	{
+		if (remap[index] < 0)
+		{
+			remap[index] = vertices.size();
+			vertices.push_back(mesh.vertices[index]);
+		}
+		index = remap[index];
+	}
+	mesh.vertices.swap(vertices);
+
+	for (const face_range& range : mesh.ranges)
+	{
+		report.triangles_after += range.n_indices / 3;
+		report.ranges_after += range.n_indices > 0;
+	}
+	return report;
+}
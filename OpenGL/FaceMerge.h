@@ -0,0 +1,21 @@
+#pragma once
+
+#include "RenderMesh.h"
+
+struct face_merge_report
+{
+	int faces_merged;		// faces whose triangles now live in another face's range
+	int triangles_before;
+	int triangles_after;
+	int ranges_before;		// non empty ranges, each one a draw in the per face paths
+	int ranges_after;
+};
+
+// joins neighbouring planar faces (type 1) with the same texture, effect, lightmap page and plane
+// into bigger convex polygons and triangulates those again, dropping the vertices along the old
+// shared edges that nothing else uses. faces only count as neighbours through welded vertices, so
+// run it after weld_vertices(), and a pair is only joined when every attribute is an affine
+// function of position over the result - then the new triangles interpolate exactly like the old.
+// the merged polygon goes in the range of one of its faces, the others are left empty and point at
+// it through mesh.face_owners.
+face_merge_report merge_coplanar_faces(render_mesh& mesh, const BSPLoader& loader);
@@ -0,0 +1,82 @@
+#include "FaceOrder.h"
+
+#include <algorithm>
+
+void order_faces_by_leaf(render_mesh& mesh, const BSPLoader& loader)
+{
+	const std::vector<node>& nodes = loader.get_nodes();
+	const std::vector<leaf>& leafs = loader.get_leafs();
+	const std::vector<leafface>& leaffaces = loader.get_leaffaces();
+	const std::vector<face>& faces = loader.get_faces();
+
+	std::vector<int> order;
+	order.reserve(faces.size());
+	std::vector<char> placed(faces.size(), 0);
+
+	auto add_leaf = [&](const leaf& _leaf)
+	{
+		size_t first = order.size();
+		for (int i = 0; i < _leaf.n_leaffaces; ++i)
+		{
+			int face_index = mesh.face_owners[leaffaces[_leaf.leaffaces + i].face];
+			if (placed[face_index] || mesh.ranges[face_index].n_indices == 0)
+				continue;
+
+			placed[face_index] = 1;
+			order.push_back(face_index);
+		}
+
+		std::stable_sort(order.begin() + first, order.end(), [&](int a, int b)
+		{
+			if (faces[a].texture != faces[b].texture)
+				return faces[a].texture < faces[b].texture;
+			return faces[a].lm_index < faces[b].lm_index;
+		});
+	};
+
+	// front child first, the same walk the tree would give a renderer sorting front to back.
+	std::vector<int> stack;
+	if (!nodes.empty())
+		stack.push_back(0);
+	else if (!leafs.empty())
+		add_leaf(leafs[0]);
+
+	while (!stack.empty())
+	{
+		int index = stack.back();
+		stack.pop_back();
+
+		if (index < 0)
+		{
+			add_leaf(leafs[-index - 1]);
+			continue;
+		}
+
+		stack.push_back(nodes[index].children[1]);
+		stack.push_back(nodes[index].children[0]);
+	}
+
+	for (int i = 0; i < faces.size(); ++i)
+	{
+		if (!placed[i] && mesh.ranges[i].n_indices > 0)
+			order.push_back(i);
+	}
+
+	std::vector<unsigned int> indices;
+	indices.reserve(mesh.indices.size());
+	for (int face_index : order)
+	{
+		face_range& range = mesh.ranges[face_index];
+		unsigned int first = indices.size();
+		indices.insert(indices.end(), mesh.indices.begin() + range.first_index, mesh.indices.begin() + range.first_index + range.n_indices);
+		range.first_index = first;
+	}
+
+	// empty ranges just need to point somewhere valid.
+	for (face_range& range : mesh.ranges)
+	{
+		if (range.n_indices == 0)
+			range.first_index = indices.size();
+	}
+	mesh.indices.swap(indices);
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+#include "RenderMesh.h"
+
+// lays the faces out in the index buffer in the order a depth first walk of the BSP tree reaches
+// their leaves, sorted by texture and lightmap within each leaf. faces that can see each other end
+// up close together, so a visible set is a handful of contiguous runs rather than one draw per
+// face. faces outside the world's leaves (brush models) go last, in file order. run it before
+// optimize_vertex_cache() so the vertices follow the same order.
+void order_faces_by_leaf(render_mesh& mesh, const BSPLoader& loader);
@@ -0,0 +1,239 @@
+#include "IndexOptimizer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <unordered_map>
+
+// tuning values from Tom Forsyth's "Linear-Speed Vertex Cache Optimisation".
+const float CACHE_DECAY_POWER = 1.5f;
+const float LAST_TRI_SCORE = 0.75f;
+const float VALENCE_BOOST_SCALE = 2.0f;
+const float VALENCE_BOOST_POWER = 0.5f;
+
+vertex_cache_stats measure_vertex_cache(const render_mesh& mesh)
+{
+	// a vertex is in the FIFO if fewer than VERTEX_CACHE_SIZE misses happened since it went in.
+	std::vector<long long> inserted(mesh.vertices.size(), -VERTEX_CACHE_SIZE - 1);
+	std::vector<char> used(mesh.vertices.size());
+	long long misses = 0;
+	long long triangles = 0;
+	int used_vertices = 0;
+
+	for (int i : ranges_in_buffer_order(mesh))
+	{
+		const face_range& range = mesh.ranges[i];
+		triangles += range.n_indices / 3;
+
+		for (unsigned int j = 0; j < range.n_indices; ++j)
+		{
+			int v = mesh.indices[range.first_index + j] + range.base_vertex;
+			if (!used[v])
+			{
+				used[v] = 1;
+				used_vertices++;
+			}
+
+			if (misses - inserted[v] >= VERTEX_CACHE_SIZE)
+			{
+				misses++;
+				inserted[v] = misses;
+			}
+		}
+	}
+
+	vertex_cache_stats stats;
+	stats.acmr = triangles ? (float)misses / triangles : 0.0f;
+	stats.atvr = used_vertices ? (float)misses / used_vertices : 0.0f;
+	return stats;
+}
+
+static float vertex_score(int cache_position, int remaining_triangles)
+{
+	// nothing left to draw with it, so never worth picking.
+	if (remaining_triangles == 0)
+		return -1.0f;
+
+	float score = 0.0f;
+	if (cache_position >= 0)
+	{
+		// the last triangle's vertices get a fixed score so the next one doesn't just reuse them.
+		if (cache_position < 3)
+			score = LAST_TRI_SCORE;
+		else
+		{
+			float scaler = 1.0f / (VERTEX_CACHE_SIZE - 3);
+			score = std::pow(1.0f - (cache_position - 3) * scaler, CACHE_DECAY_POWER);
+		}
+	}
+
+	// boost vertices with few triangles left, so lone triangles get finished rather than stranded.
+	score += VALENCE_BOOST_SCALE * std::pow((float)remaining_triangles, -VALENCE_BOOST_POWER);
+	return score;
+}
+
+// reorders the triangles of one index list in place. indices are absolute vertex numbers.
+static void optimize_triangles(unsigned int* indices, int n_indices)
+{
+	int n_triangles = n_indices / 3;
+	if (n_triangles < 2)
+		return;
+
+	// number the vertices 0..n locally so everything below can be flat arrays.
+	std::unordered_map<unsigned int, int> local_ids;
+	std::vector<int> corners(n_triangles * 3);
+	for (int i = 0; i < n_triangles * 3; ++i)
+		corners[i] = local_ids.emplace(indices[i], (int)local_ids.size()).first->second;
+	int n_vertices = local_ids.size();
+
+	// triangles using each vertex, packed into one array with per vertex offsets.
+	std::vector<int> remaining(n_vertices, 0);
+	for (int corner : corners)
+		remaining[corner]++;
+
+	std::vector<int> first_triangle(n_vertices + 1, 0);
+	for (int v = 0; v < n_vertices; ++v)
+		first_triangle[v + 1] = first_triangle[v] + remaining[v];
+
+	std::vector<int> vertex_triangles(corners.size());
+	std::vector<int> filled(n_vertices, 0);
+	for (int i = 0; i < corners.size(); ++i)
+		vertex_triangles[first_triangle[corners[i]] + filled[corners[i]]++] = i / 3;
+
+	std::vector<int> cache_position(n_vertices, -1);
+	std::vector<float> scores(n_vertices);
+	for (int v = 0; v < n_vertices; ++v)
+		scores[v] = vertex_score(-1, remaining[v]);
+
+	std::vector<float> triangle_scores(n_triangles);
+	std::vector<char> added(n_triangles, 0);
+	for (int t = 0; t < n_triangles; ++t)
+		triangle_scores[t] = scores[corners[t * 3]] + scores[corners[t * 3 + 1]] + scores[corners[t * 3 + 2]];
+
+	std::vector<int> cache;
+	std::vector<int> new_cache;
+	std::vector<unsigned int> output;
+	output.reserve(n_triangles * 3);
+
+	int best = std::max_element(triangle_scores.begin(), triangle_scores.end()) - triangle_scores.begin();
+	for (int step = 0; step < n_triangles; ++step)
+	{
+		// nothing in the cache has triangles left, start again from the best remaining one.
+		if (best < 0)
+		{
+			float best_score = -1.0f;
+			for (int t = 0; t < n_triangles; ++t)
+			{
+				if (!added[t] && triangle_scores[t] > best_score)
+				{
+					best_score = triangle_scores[t];
+					best = t;
+				}
+			}
+		}
+
+		added[best] = 1;
+		new_cache.clear();
+		for (int k = 0; k < 3; ++k)
+		{
+			int v = corners[best * 3 + k];
+			output.push_back(indices[best * 3 + k]);
+
+			// take the triangle off the vertex's list.
+			int* list = &vertex_triangles[first_triangle[v]];
+			for (int i = 0; i < remaining[v]; ++i)
+			{
+				if (list[i] == best)
+				{
+					std::swap(list[i], list[remaining[v] - 1]);
+					remaining[v]--;
+					break;
+				}
+			}
+
+			if (std::find(new_cache.begin(), new_cache.end(), v) == new_cache.end())
+				new_cache.push_back(v);
+		}
+
+		// the triangle's vertices go to the front of the LRU cache, the rest shuffle back.
+		int n_front = new_cache.size();
+		for (int v : cache)
+		{
+			if (std::find(new_cache.begin(), new_cache.begin() + n_front, v) == new_cache.begin() + n_front)
+				new_cache.push_back(v);
+		}
+
+		for (int i = 0; i < new_cache.size(); ++i)
+		{
+			int v = new_cache[i];
+			cache_position[v] = i < VERTEX_CACHE_SIZE ? i : -1;
+			scores[v] = vertex_score(cache_position[v], remaining[v]);
+		}
+
+		// only triangles touching the cache changed score, the best next one is among them.
+		best = -1;
+		float best_score = -1.0f;
+		for (int v : new_cache)
+		{
+			for (int i = 0; i < remaining[v]; ++i)
+			{
+				int t = vertex_triangles[first_triangle[v] + i];
+				triangle_scores[t] = scores[corners[t * 3]] + scores[corners[t * 3 + 1]] + scores[corners[t * 3 + 2]];
+				if (triangle_scores[t] > best_score)
+				{
+					best_score = triangle_scores[t];
+					best = t;
+				}
+			}
+		}
+
+		if (new_cache.size() > VERTEX_CACHE_SIZE)
+			new_cache.resize(VERTEX_CACHE_SIZE);
+		cache.swap(new_cache);
+	}
+
+	std::copy(output.begin(), output.end(), indices);
+}
+
+vertex_cache_report optimize_vertex_cache(render_mesh& mesh)
+{
+	vertex_cache_report report;
+	report.before = measure_vertex_cache(mesh);
+
+	// the triangle lists are reordered with absolute vertex numbers, base vertices are folded in.
+	for (face_range& range : mesh.ranges)
+	{
+		unsigned int* indices = mesh.indices.data() + range.first_index;
+		for (unsigned int j = 0; j < range.n_indices; ++j)
+			indices[j] += range.base_vertex;
+		range.base_vertex = 0;
+
+		optimize_triangles(indices, range.n_indices);
+	}
+
+	// renumber vertices in the order the index buffer first touches them, unused ones go last.
+	std::vector<int> remap(mesh.vertices.size(), -1);
+	int next = 0;
+	for (int i : ranges_in_buffer_order(mesh))
+	{
+		const face_range& range = mesh.ranges[i];
+		for (unsigned int j = 0; j < range.n_indices; ++j)
+		{
+			unsigned int& index = mesh.indices[range.first_index + j];
+			if (remap[index] < 0)
+				remap[index] = next++;
+			index = remap[index];
+		}
+	}
+
+	std::vector<vertex> vertices(mesh.vertices.size());
+	for (int v = 0; v < mesh.vertices.size(); ++v)
+	{
+		if (remap[v] < 0)
+			remap[v] = next++;
+		vertices[remap[v]] = mesh.vertices[v];
+	}
+	mesh.vertices.swap(vertices);
+
+	report.after = measure_vertex_cache(mesh);
+	return report;
+}
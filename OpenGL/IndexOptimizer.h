@@ -0,0 +1,27 @@
+#pragma once
+
+#include "RenderMesh.h"
+
+// entries in the simulated post-transform cache. 32 is around what current hardware keeps.
+const int VERTEX_CACHE_SIZE = 32;
+
+struct vertex_cache_stats
+{
+	float acmr;		// vertex shader runs per triangle, 0.5 is ideal for big grids and 3 is no reuse at all
+	float atvr;		// vertex shader runs per vertex used, 1 is ideal
+};
+
+struct vertex_cache_report
+{
+	vertex_cache_stats before;
+	vertex_cache_stats after;
+};
+
+// runs every face range through a FIFO cache of VERTEX_CACHE_SIZE entries in draw order.
+vertex_cache_stats measure_vertex_cache(const render_mesh& mesh);
+
+// reorders the triangles of each face range for post-transform cache hits (Forsyth's linear
+// speed algorithm), then renumbers the vertices in the order they are first used so the
+// fetches walk forwards through the vertex buffer. the ranges stay where they are, but every
+// range comes out with base_vertex 0.
+vertex_cache_report optimize_vertex_cache(render_mesh& mesh);
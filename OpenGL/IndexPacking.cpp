@@ -0,0 +1,217 @@
+#include "IndexPacking.h"
+
+#include <algorithm>
+#include <cstring>
+
+// largest vertex span a 16 bit index can reach from its base vertex.
+const int MAX_SHORT_SPAN = 65535;
+
+packed_indices pack_indices(render_mesh& mesh, bool short_indices)
+{
+	packed_indices packed;
+	packed.ranges.resize(mesh.ranges.size());
+	packed.batches = 0;
+	packed.short_ranges = 0;
+	packed.int_ranges = 0;
+
+	std::vector<int> short_order;
+	std::vector<int> int_order;
+	std::vector<int> new_base(mesh.ranges.size(), 0);
+
+	// batch members, waiting to learn the batch's lowest vertex.
+	std::vector<int> batch;
+	int batch_min = 0, batch_max = 0;
+	auto close_batch = [&]()
+	{
+		for (int i : batch)
+			new_base[i] = batch_min;
+		if (!batch.empty())
+			packed.batches++;
+		batch.clear();
+	};
+
+	for (int i : ranges_in_buffer_order(mesh))
+	{
+		const face_range& range = mesh.ranges[i];
+		if (range.n_indices == 0)
+			continue;
+
+		int range_min = mesh.indices[range.first_index] + range.base_vertex;
+		int range_max = range_min;
+		for (unsigned int j = 1; j < range.n_indices; ++j)
+		{
+			int v = mesh.indices[range.first_index + j] + range.base_vertex;
+			range_min = std::min(range_min, v);
+			range_max = std::max(range_max, v);
+		}
+
+		if (!short_indices || range_max - range_min > MAX_SHORT_SPAN)
+		{
+			int_order.push_back(i);
+			continue;
+		}
+
+		if (!batch.empty() && std::max(batch_max, range_max) - std::min(batch_min, range_min) <= MAX_SHORT_SPAN)
+		{
+			batch_min = std::min(batch_min, range_min);
+			batch_max = std::max(batch_max, range_max);
+		}
+		else
+		{
+			close_batch();
+			batch_min = range_min;
+			batch_max = range_max;
+		}
+		batch.push_back(i);
+		short_order.push_back(i);
+	}
+	close_batch();
+
+	if (!int_order.empty())
+		packed.batches++;
+
+	// 16 bit section first, then the 32 bit one starting on a 4 byte boundary.
+	size_t short_count = 0;
+	for (int i : short_order)
+		short_count += mesh.ranges[i].n_indices;
+	size_t int_start = (short_count * sizeof(unsigned short) + 3) / 4;
+	size_t int_count = 0;
+	for (int i : int_order)
+		int_count += mesh.ranges[i].n_indices;
+	packed.data.resize((int_start + int_count) * sizeof(unsigned int));
+
+	GLuint next = 0;
+	for (int i : short_order)
+	{
+		face_range& range = mesh.ranges[i];
+		packed_range& out = packed.ranges[i];
+		out.type = GL_UNSIGNED_SHORT;
+		out.first_index = next;
+		out.n_indices = range.n_indices;
+		out.base_vertex = new_base[i];
+
+		for (unsigned int j = 0; j < range.n_indices; ++j)
+		{
+			unsigned int& index = mesh.indices[range.first_index + j];
+			index = index + range.base_vertex - new_base[i];
+			unsigned short value = index;
+			memcpy(&packed.data[(next + j) * sizeof(unsigned short)], &value, sizeof(value));
+		}
+		range.base_vertex = new_base[i];
+		next += range.n_indices;
+		packed.short_ranges++;
+	}
+
+	next = int_start;
+	for (int i : int_order)
+	{
+		face_range& range = mesh.ranges[i];
+		packed_range& out = packed.ranges[i];
+		out.type = GL_UNSIGNED_INT;
+		out.first_index = next;
+		out.n_indices = range.n_indices;
+		out.base_vertex = 0;
+
+		for (unsigned int j = 0; j < range.n_indices; ++j)
+		{
+			unsigned int& index = mesh.indices[range.first_index + j];
+			index += range.base_vertex;
+			memcpy(&packed.data[(next + j) * sizeof(unsigned int)], &index, sizeof(index));
+		}
+		range.base_vertex = 0;
+		next += range.n_indices;
+		packed.int_ranges++;
+	}
+
+	// empty ranges still need a valid type for anything that looks at them.
+	for (int i = 0; i < mesh.ranges.size(); ++i)
+	{
+		if (mesh.ranges[i].n_indices == 0)
+			packed.ranges[i] = packed_range{ short_indices ? (GLenum)GL_UNSIGNED_SHORT : (GLenum)GL_UNSIGNED_INT, 0, 0, 0 };
+	}
+
+	return packed;
+}
+
+// ranges of one batch sit back to back with the same base vertex, so they join up.
+static std::vector<multi_draw> join_ranges(std::vector<const packed_range*>& ranges)
+{
+	std::sort(ranges.begin(), ranges.end(), [](const packed_range* a, const packed_range* b)
+	{
+		if (a->type != b->type)
+			return a->type < b->type;
+		return a->first_index < b->first_index;
+	});
+
+	std::vector<multi_draw> draws;
+	GLuint end = 0;
+	for (const packed_range* range : ranges)
+	{
+		if (range->n_indices == 0)
+			continue;
+
+		if (draws.empty() || draws.back().type != range->type)
+		{
+			draws.push_back(multi_draw());
+			draws.back().type = range->type;
+		}
+
+		multi_draw& draw = draws.back();
+		if (!draw.counts.empty() && range->first_index == end && range->base_vertex == draw.base_vertices.back())
+			draw.counts.back() += range->n_indices;
+		else
+		{
+			draw.counts.push_back(range->n_indices);
+			draw.offsets.push_back(range->offset());
+			draw.base_vertices.push_back(range->base_vertex);
+		}
+		end = range->first_index + range->n_indices;
+	}
+	return draws;
+}
+
+std::vector<multi_draw> build_multi_draws(const packed_indices& packed)
+{
+	std::vector<const packed_range*> ranges;
+	for (const packed_range& range : packed.ranges)
+		ranges.push_back(&range);
+	return join_ranges(ranges);
+}
+
+std::vector<multi_draw> build_multi_draws(const packed_indices& packed, const std::vector<int>& faces)
+{
+	std::vector<const packed_range*> ranges;
+	for (int face_index : faces)
+		ranges.push_back(&packed.ranges[face_index]);
+	return join_ranges(ranges);
+}
+
+std::vector<multi_draw> build_ordered_draws(const packed_indices& packed, const std::vector<int>& faces)
+{
+	std::vector<multi_draw> draws;
+	GLuint end = 0;
+	for (int face_index : faces)
+	{
+		const packed_range& range = packed.ranges[face_index];
+		if (range.n_indices == 0)
+			continue;
+
+		if (draws.empty() || draws.back().type != range.type)
+		{
+			draws.push_back(multi_draw());
+			draws.back().type = range.type;
+		}
+
+		multi_draw& draw = draws.back();
+		if (!draw.counts.empty() && range.first_index == end && range.base_vertex == draw.base_vertices.back())
+			draw.counts.back() += range.n_indices;
+		else
+		{
+			draw.counts.push_back(range.n_indices);
+			draw.offsets.push_back(range.offset());
+			draw.base_vertices.push_back(range.base_vertex);
+		}
+		end = range.first_index + range.n_indices;
+	}
+	return draws;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "RenderMesh.h"
+
+// where a face's indices ended up in the element buffer.
+struct packed_range
+{
+	GLenum type;			// GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+	GLuint first_index;		// counted in indices of that type from the start of the buffer
+	GLuint n_indices;
+	GLint base_vertex;
+
+	// for the glDrawElements family, which wants a byte offset.
+	void* offset() const { return (void*)(long)(first_index * (type == GL_UNSIGNED_SHORT ? 2 : 4)); }
+};
+
+// one glMultiDrawElementsBaseVertex worth of ranges, all of the same index type.
+struct multi_draw
+{
+	GLenum type;
+	std::vector<GLsizei> counts;
+	std::vector<void*> offsets;
+	std::vector<GLint> base_vertices;
+};
+
+struct packed_indices
+{
+	std::vector<ubyte> data;
+	std::vector<packed_range> ranges;	// one per mesh range
+
+	int batches;		// runs of ranges sharing a base vertex
+	int short_ranges;
+	int int_ranges;		// ranges spanning too many vertices for 16 bits
+};
+
+// with short_indices the ranges are grouped, in index buffer order, into batches whose vertices
+// span less than 65536, every range in a batch gets the batch's lowest vertex as its base vertex
+// and its indices are stored as 16 bit offsets from that. those come first in the buffer, followed
+// by any range too spread out for that, as 32 bit indices. without short_indices everything is 32 bit.
+// the mesh's ranges and indices are rebased to match.
+packed_indices pack_indices(render_mesh& mesh, bool short_indices);
+
+// the draws for every non empty range, one per index type in use. neighbouring ranges that
+// share a base vertex are joined into one.
+std::vector<multi_draw> build_multi_draws(const packed_indices& packed);
+// the same for just the given faces, in any order.
+std::vector<multi_draw> build_multi_draws(const packed_indices& packed, const std::vector<int>& faces);
+// the same, but drawn in the order given. only faces next to each other in the list and in the
+// buffer are joined, and a change of index type starts a new draw.
+std::vector<multi_draw> build_ordered_draws(const packed_indices& packed, const std::vector<int>& faces);
@@ -0,0 +1,171 @@
+#include "IndirectRenderer.h"
+
+#include <tuple>
+
+IndirectRenderer::IndirectRenderer(const BSPLoader& loader, const packed_indices& indices, bool lightmap_atlas,
+	const std::vector<bool>& skipped_textures) :
+	loader{ loader }, lightmap_atlas{ lightmap_atlas }
+{
+	const std::vector<face>& faces = loader.get_faces();
+	std::map<std::tuple<int, int, GLenum>, int> bucket_ids;
+
+	records.resize(faces.size());
+	for (int i = 0; i < faces.size(); ++i)
+	{
+		const face& _face = faces[i];
+		const packed_range& range = indices.ranges[i];
+
+		face_record& record = records[i];
+		record.first_index = range.first_index;
+		record.n_indices = range.n_indices;
+		record.base_vertex = range.base_vertex;
+		record.bucket = -1;
+
+		if (range.n_indices == 0)
+			continue;
+
+		// same rules as the per face path, transparent surfaces aren't drawn yet.
+		shader _shader = loader.get_shader(_face.texture);
+		if (!_shader.render || _shader.transparent)
+			continue;
+		if (!skipped_textures.empty() && skipped_textures[_face.texture])
+			continue;
+		if (!lightmap_atlas && _face.lm_index < 0)
+			continue;
+
+		std::tuple<int, int, GLenum> key(_face.texture, lightmap_atlas ? -1 : _face.lm_index, range.type);
+		auto it = bucket_ids.find(key);
+		if (it == bucket_ids.end())
+		{
+			it = bucket_ids.emplace(key, (int)buckets.size()).first;
+			buckets.push_back(draw_bucket{ std::get<0>(key), std::get<1>(key), range.type, 0, 0, 0 });
+		}
+
+		record.bucket = it->second;
+		buckets[record.bucket].max_commands++;
+	}
+
+	// lay the bucket regions out back to back.
+	GLuint next = 0;
+	for (draw_bucket& bucket : buckets)
+	{
+		bucket.first_command = next;
+		next += bucket.max_commands;
+	}
+	commands.resize(next);
+
+	glGenBuffers(1, &record_buffer);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, record_buffer);
+	glBufferData(GL_COPY_WRITE_BUFFER, records.size() * sizeof(face_record), records.empty() ? nullptr : &records[0], GL_STATIC_DRAW);
+
+	glGenBuffers(1, &command_buffer);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, command_buffer);
+	glBufferData(GL_DRAW_INDIRECT_BUFFER, commands.size() * sizeof(draw_command), nullptr, GL_STREAM_DRAW);
+}
+
+IndirectRenderer::~IndirectRenderer()
+{
+	glDeleteBuffers(1, &record_buffer);
+	glDeleteBuffers(1, &command_buffer);
+}
+
+bool IndirectRenderer::is_supported()
+{
+	return GLEW_VERSION_4_3 || GLEW_ARB_multi_draw_indirect;
+}
+
+void IndirectRenderer::build_commands(const std::vector<int>& faces)
+{
+	clear_commands();
+	for (int face_index : faces)
+	{
+		const face_record& record = records[face_index];
+		if (record.bucket >= 0)
+			add_command(record.bucket, record.first_index, record.n_indices, record.base_vertex);
+	}
+	upload_commands();
+}
+
+void IndirectRenderer::clear_commands()
+{
+	for (draw_bucket& bucket : buckets)
+		bucket.command_count = 0;
+	command_count = 0;
+}
+
+void IndirectRenderer::add_command(int bucket_index, GLuint first_index, GLuint n_indices, GLint base_vertex)
+{
+	draw_bucket& bucket = buckets[bucket_index];
+	draw_command& command = commands[bucket.first_command + bucket.command_count++];
+	command.count = n_indices;
+	command.instance_count = 1;
+	command.first_index = first_index;
+	command.base_vertex = base_vertex;
+	command.base_instance = 0;
+	command_count++;
+}
+
+void IndirectRenderer::upload_commands()
+{
+	if (commands.empty())
+		return;
+
+	// orphan the old contents rather than waiting for last frame's draws to finish with them.
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, command_buffer);
+	glBufferData(GL_DRAW_INDIRECT_BUFFER, commands.size() * sizeof(draw_command), &commands[0], GL_STREAM_DRAW);
+}
+
+void IndirectRenderer::draw()
+{
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, command_buffer);
+	glActiveTexture(GL_TEXTURE0);
+
+	draw_calls = 0;
+	int bound_lightmap = -2;
+	for (const draw_bucket& bucket : buckets)
+	{
+		if (bucket.command_count == 0)
+			continue;
+
+		bind_lightmap(bucket, bound_lightmap);
+		glMultiDrawElementsIndirect(GL_TRIANGLES, bucket.index_type,
+			(void*)(bucket.first_command * sizeof(draw_command)), bucket.command_count, 0);
+		draw_calls++;
+	}
+}
+
+void IndirectRenderer::draw_gpu_commands(GLuint count_buffer)
+{
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, command_buffer);
+	glActiveTexture(GL_TEXTURE0);
+
+	bool counted = GLEW_ARB_indirect_parameters;
+	if (counted)
+		glBindBuffer(GL_PARAMETER_BUFFER_ARB, count_buffer);
+
+	// how many commands each bucket got is only known on the GPU, so every bucket is submitted.
+	draw_calls = 0;
+	int bound_lightmap = -2;
+	for (int i = 0; i < buckets.size(); ++i)
+	{
+		const draw_bucket& bucket = buckets[i];
+		bind_lightmap(bucket, bound_lightmap);
+
+		void* offset = (void*)(bucket.first_command * sizeof(draw_command));
+		if (counted)
+			glMultiDrawElementsIndirectCountARB(GL_TRIANGLES, bucket.index_type, offset, i * sizeof(GLuint), bucket.max_commands, 0);
+		else
+			glMultiDrawElementsIndirect(GL_TRIANGLES, bucket.index_type, offset, bucket.max_commands, 0);
+		draw_calls++;
+	}
+}
+
+void IndirectRenderer::bind_lightmap(const draw_bucket& bucket, int& bound_lightmap) const
+{
+	// the textures themselves aren't drawn yet, so the only per bucket state is the lightmap.
+	if (bucket.lm_index == bound_lightmap)
+		return;
+
+	glBindTexture(GL_TEXTURE_2D, lightmap_atlas ? loader.get_lm_id() : loader.get_lightmap_tex(bucket.lm_index));
+	bound_lightmap = bucket.lm_index;
+}
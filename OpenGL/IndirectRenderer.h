@@ -0,0 +1,92 @@
+#pragma once
+
+#include "IndexPacking.h"
+
+// layout fixed by GL for glMultiDrawElementsIndirect.
+struct draw_command
+{
+	GLuint count;
+	GLuint instance_count;
+	GLuint first_index;
+	GLint base_vertex;
+	GLuint base_instance;
+};
+
+// what the GPU needs to know to draw one face, kept in a buffer object next to the mesh.
+struct face_record
+{
+	GLuint first_index;
+	GLuint n_indices;
+	GLint base_vertex;
+	GLint bucket;		// -1 if the face isn't drawn by this renderer
+};
+
+// faces that share a texture (and lightmap page without the atlas), drawn with one call from
+// their own region of the command buffer.
+struct draw_bucket
+{
+	int texture;
+	int lm_index;		// -1 when drawing with the atlas
+	GLenum index_type;
+	GLuint first_command;
+	GLuint max_commands;
+	GLuint command_count;
+};
+
+// draws the visible faces with one glMultiDrawElementsIndirect per material bucket instead of
+// one glDrawElements per face. every bucket owns a fixed region of the command buffer big enough
+// for all of its faces, so the per-frame work is writing 20 bytes per visible face and the number
+// of GL calls only depends on how many buckets there are.
+// needs GL 4.3 or ARB_multi_draw_indirect, check is_supported() before creating one.
+class IndirectRenderer
+{
+public:
+	// with a lightmap atlas all faces of a texture share a bucket, otherwise the bucket also
+	// splits on lightmap page. buckets never mix index types. the packed indices must be the
+	// ones in the bound element buffer. faces of the skipped textures, one flag per BSP texture or
+	// none at all, are left to another pass.
+	IndirectRenderer(const BSPLoader& loader, const packed_indices& indices, bool lightmap_atlas,
+		const std::vector<bool>& skipped_textures);
+	~IndirectRenderer();
+
+	static bool is_supported();
+
+	// writes the commands for the given faces into their buckets and uploads them.
+	void build_commands(const std::vector<int>& faces);
+	// the same in steps, for callers that work out their own ranges. a bucket takes at most as
+	// many commands as it has faces.
+	void clear_commands();
+	void add_command(int bucket_index, GLuint first_index, GLuint n_indices, GLint base_vertex);
+	void upload_commands();
+	// the vertex array and shader program need to be bound already.
+	void draw();
+	// draws commands that were written into the command buffer on the GPU. count_buffer holds one
+	// GLuint command count per bucket and is used through ARB_indirect_parameters when that's
+	// available, otherwise every bucket's whole region is drawn and unused commands must be zeroed.
+	void draw_gpu_commands(GLuint count_buffer);
+
+	const std::vector<face_record>& get_records() const { return records; }
+	const std::vector<draw_bucket>& get_buckets() const { return buckets; }
+	GLuint get_record_buffer() const { return record_buffer; }
+	GLuint get_command_buffer() const { return command_buffer; }
+	GLuint get_command_capacity() const { return commands.size(); }
+
+	int get_bucket_count() const { return buckets.size(); }
+	int get_command_count() const { return command_count; }
+	int get_draw_call_count() const { return draw_calls; }
+private:
+	void bind_lightmap(const draw_bucket& bucket, int& bound_lightmap) const;
+
+	const BSPLoader& loader;
+	bool lightmap_atlas;
+
+	std::vector<face_record> records;
+	std::vector<draw_bucket> buckets;
+	std::vector<draw_command> commands;
+
+	GLuint record_buffer;
+	GLuint command_buffer;
+
+	int command_count = 0;
+	int draw_calls = 0;
+};
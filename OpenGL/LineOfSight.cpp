@@ -0,0 +1,64 @@
+#include "LineOfSight.h"
+
+#include <chrono>
+
+std::vector<unsigned int> LineOfSight::test(const std::vector<los_query>& queries, int mask)
+{
+	auto start_time = std::chrono::high_resolution_clock::now();
+
+	int count = queries.size();
+	std::vector<unsigned int> bits((count + 31) / 32, 0);
+
+	// pass 1: PVS early out. chunks are whole words, so no two threads write the same one.
+	std::vector<unsigned int> candidates(bits.size(), 0);
+	pool.parallel_for(count, 256, [&](int begin, int end)
+	{
+		for (int i = begin; i < end; ++i)
+		{
+			int from = loader.get_leafs()[loader.find_leaf(queries[i].from)].cluster;
+			int to = loader.get_leafs()[loader.find_leaf(queries[i].to)].cluster;
+
+			if (loader.cluster_visible(from, to))
+				candidates[i / 32] |= 1u << (i % 32);
+		}
+	});
+
+	// gather the survivors so the traces are load balanced rather than the queries.
+	survivors.clear();
+	for (int i = 0; i < count; ++i)
+	{
+		if (candidates[i / 32] & (1u << (i % 32)))
+			survivors.push_back(i);
+	}
+
+	// pass 2: trace whatever the PVS couldn't rule out.
+	trace_results.assign(survivors.size(), 0);
+	pool.parallel_for(survivors.size(), 16, [&](int begin, int end)
+	{
+		for (int i = begin; i < end; ++i)
+		{
+			const los_query& query = queries[survivors[i]];
+			trace_result tr = collision.trace(query.from, query.to, mask);
+			trace_results[i] = tr.fraction == 1.0f && !tr.startsolid;
+		}
+	});
+
+	stats.visible = 0;
+	for (int i = 0; i < survivors.size(); ++i)
+	{
+		if (trace_results[i])
+		{
+			bits[survivors[i] / 32] |= 1u << (survivors[i] % 32);
+			stats.visible++;
+		}
+	}
+
+	stats.queries = count;
+	stats.traced = survivors.size();
+	stats.pvs_rejected = count - stats.traced;
+
+	auto end_time = std::chrono::high_resolution_clock::now();
+	stats.milliseconds = std::chrono::duration<double, std::milli>(end_time - start_time).count();
+
+	return bits;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "BSPCollision.h"
+#include "WorkerPool.h"
+
+struct los_query
+{
+	glm::vec3 from;
+	glm::vec3 to;
+};
+
+struct los_stats
+{
+	int queries;
+	int pvs_rejected;	// pairs thrown out by the cluster vis data without a trace
+	int traced;
+	int visible;
+	double milliseconds;
+};
+
+// batch line of sight checks for the AI. each pair is first checked against the PVS,
+// only the survivors get traced, and those traces are spread over the worker pool.
+class LineOfSight
+{
+public:
+	LineOfSight(const BSPLoader& loader, const BSPCollision& collision, WorkerPool& pool) :
+		loader{ loader }, collision{ collision }, pool{ pool } {}
+
+	// returns one bit per query, bit (i % 32) of word (i / 32) is set if the pair can see each other.
+	std::vector<unsigned int> test(const std::vector<los_query>& queries, int mask = MASK_OPAQUE);
+
+	const los_stats& get_stats() const { return stats; }
+private:
+	const BSPLoader& loader;
+	const BSPCollision& collision;
+	WorkerPool& pool;
+
+	los_stats stats{};
+
+	// scratch space kept between batches to avoid reallocating every tick.
+	std::vector<int> survivors;
+	std::vector<ubyte> trace_results;
+};
@@ -11,14 +11,56 @@
 #include "imgui_impl_glfw.h"
 #include "imgui_impl_opengl3.h"
 
+#include <memory>
 #include <thread>
 
 #include "BSPLoader.h"
+#include "BSPCollision.h"
+#include "Benchmarks.h"
+#include "AreaPortals.h"
+#include "BrushBVH.h"
+#include "ClusterDrawLists.h"
+#include "ComputeCulling.h"
+#include "DepthPyramid.h"
+#include "DrawOrder.h"
+#include "FaceMerge.h"
+#include "FaceOrder.h"
+#include "IndexOptimizer.h"
+#include "IndexPacking.h"
+#include "IndirectRenderer.h"
+#include "LineOfSight.h"
+#include "MaterialEffects.h"
+#include "Materials.h"
+#include "NormalCones.h"
+#include "OcclusionQueries.h"
+#include "PlayerMove.h"
+#include "RenderMesh.h"
+#include "SampleCounter.h"
+#include "ShaderCache.h"
+#include "SoftwareOcclusion.h"
+#include "TranslucentPass.h"
+#include "VertexFormat.h"
+#include "VertexWeld.h"
+#include "Visibility.h"
+#include "WorkerPool.h"
 
 #include "shaders.inc"
 
 const bool AllowMouse = true;
 const bool SingleDraw = true;
+// 16 bit indices relative to a per batch base vertex, 32 bit for everything otherwise.
+const bool ShortIndices = true;
+
+enum RenderMode
+{
+	RENDER_SINGLE_DRAW,	// the whole map in one glDrawElements
+	RENDER_PER_FACE,	// one glDrawElements per face
+	RENDER_VISIBLE_RUNS,	// PVS + frustum culled, contiguous runs of visible faces in one glMultiDrawElementsBaseVertex
+	RENDER_OCCLUSION_QUERIES,	// BSP walked front to back with hardware occlusion queries on nodes and leaves
+	RENDER_INDIRECT,	// PVS + frustum culled, one glMultiDrawElementsIndirect per material bucket
+	RENDER_CLUSTER_LISTS,	// same draws, from lists precomputed per cluster and only frustum culled
+	RENDER_GPU_CULLED	// same draws, but culled and written by a compute shader
+};
 
 glm::vec3 cameraPos = glm::vec3(0.0f, 0.0f, 3.0f);
 glm::vec3 cameraFront = glm::vec3(0.0f, 0.0f, -1.0f);
@@ -28,8 +70,19 @@ float yaw;
 float pitch;
 
 bool firstMouse = true;
+// the last try at turning noclip off was refused, the player is inside a brush.
+bool noclipRefused = false;
 float lastX = 400, lastY = 300;
 
+void update_camera_front()
+{
+	glm::vec3 direction;
+	direction.x = cos(glm::radians(yaw)) * cos(glm::radians(pitch));
+	direction.y = sin(glm::radians(pitch));
+	direction.z = sin(glm::radians(yaw)) * cos(glm::radians(pitch));
+	cameraFront = glm::normalize(direction);
+}
+
 void mouse_callback(GLFWwindow* window, double xpos, double ypos)
 {
 	if (firstMouse) // initially set to true
@@ -56,63 +109,97 @@ void mouse_callback(GLFWwindow* window, double xpos, double ypos)
 	if (pitch < -89.0f)
 		pitch = -89.0f;
 
-	glm::vec3 direction;
-	direction.x = cos(glm::radians(yaw)) * cos(glm::radians(pitch));
-	direction.y = sin(glm::radians(pitch));
-	direction.z = sin(glm::radians(yaw)) * cos(glm::radians(pitch));
-	cameraFront = glm::normalize(direction);
+	update_camera_front();
 }
 
-void processInput(GLFWwindow* window)
+void processInput(GLFWwindow* window, PlayerMove& player, double frameTime)
 {
-	const float cameraSpeed = 5.f; // adjust accordingly
+	player_input input;
+	input.view_forward = gl_to_bsp(cameraFront);
+	input.forward = 0.0f;
+	input.right = 0.0f;
 	if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
-		cameraPos += cameraSpeed * cameraFront;
+		input.forward += 1.0f;
 	if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS)
-		cameraPos -= cameraSpeed * cameraFront;
+		input.forward -= 1.0f;
 	if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS)
-		cameraPos -= glm::normalize(glm::cross(cameraFront, cameraUp)) * cameraSpeed;
+		input.right -= 1.0f;
 	if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)
-		cameraPos += glm::normalize(glm::cross(cameraFront, cameraUp)) * cameraSpeed;
+		input.right += 1.0f;
+	input.jump = glfwGetKey(window, GLFW_KEY_SPACE) == GLFW_PRESS;
+
+	// N toggles noclip on the key press, not every frame it's held.
+	static bool noclipHeld = false;
+	bool noclipKey = glfwGetKey(window, GLFW_KEY_N) == GLFW_PRESS;
+	if (noclipKey && !noclipHeld)
+		noclipRefused = !player.set_noclip(!player.get_noclip());
+	noclipHeld = noclipKey;
+
+	player.update(frameTime, input);
+	cameraPos = bsp_to_gl(player.get_view_origin());
 }
 
-int main()
+// loads the map and draws it until the window is closed. everything holding GL objects is local to
+// this, so it's all deleted while the context is still there.
+static void run(GLFWwindow* window)
 {
-	glfwInit();
-
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 2);
-	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
-
-	glfwWindowHint(GLFW_RESIZABLE, GL_FALSE);
-
-	// create windowed monitor
-	GLFWwindow* window = glfwCreateWindow(800, 600, "My OpenGL Window", nullptr, nullptr);
-
-	glfwMakeContextCurrent(window);
-
-	glewExperimental = GL_TRUE;
-	glewInit();
-
-	ImGui::CreateContext();
-	ImGuiIO& io = ImGui::GetIO();
-	io.ConfigFlags |= ImGuiConfigFlags_NavEnableKeyboard;
-
-	ImGui_ImplGlfw_InitForOpenGL(window, true);
-	ImGui_ImplOpenGL3_Init("#version 150");
-
-	glEnable(GL_CULL_FACE);
-	glCullFace(GL_BACK);
-	glFrontFace(GL_CW);
-	glEnable(GL_DEPTH_TEST);
-
 	ImVec4 clear_color = ImVec4(0.45f, 0.55f, 0.60f, 1.00f);
 
 	// needs a valid Q3A BSP file.
 	BSPLoader loader{ "Data\\q3dm0.bsp", SingleDraw };
 
 	std::vector<vertex> vertices = loader.get_vertex_data();
+	render_mesh mesh = build_render_mesh(loader);
+	weld_report weldReport = weld_vertices(mesh);
+	face_merge_report mergeReport = merge_coplanar_faces(mesh, loader);
+	order_faces_by_leaf(mesh, loader);
+	rebase_texcoords(mesh);
+	vertex_cache_report cacheReport = optimize_vertex_cache(mesh);
+	packed_indices indices = pack_indices(mesh, ShortIndices);
+	std::vector<multi_draw> multiDraws = build_multi_draws(indices);
+	std::vector<multi_draw> visibleDraws;
+	// the visibility version the visible runs or indirect commands were last built from, -1 to
+	// build them again. front to back and cone culled draws are built for a position as well.
+	int builtVersion = -1;
+	// the single draw path's own draws once other passes take faces out or they're sorted, built
+	// again when marked dirty or, sorted, when the camera moves.
+	std::vector<multi_draw> singleDraws;
+	bool singleDrawsDirty = true;
+	glm::vec3 singleDrawsPosition;
+	DrawOrder drawOrder{ loader, mesh };
+	bool frontToBack = false;
+	bool depthPrepass = false;
+	glm::vec3 builtPosition;
+	MaterialTable materials{ "Data\\scripts\\" };
+	std::vector<int> textureMaterials = materials.resolve_textures(loader);
+	int materialStates = materials.count_states(textureMaterials);
+	TranslucentPass translucent{ loader, indices, drawOrder, materials, textureMaterials };
+	bool translucentPass = true;
+
+	WorkerPool workers;
+	BSPCollision collision{ loader };
+	BrushBVH brushBVH{ loader, collision };
+	collision.set_bvh(&brushBVH);
+	LineOfSight lineOfSight{ loader, collision, workers };
+
+	// start on the first deathmatch spawn if there is one, otherwise fly around from the origin.
+	PlayerMove player{ collision };
+	player.teleport(gl_to_bsp(cameraPos));
+	for (const entity& ent : loader.get_entities())
+	{
+		std::string classname = ent.value("classname");
+		glm::vec3 origin;
+		if ((classname == "info_player_deathmatch" || classname == "info_player_start") && ent.vector_value("origin", origin))
+		{
+			// same lift off the floor the Q3 game gives spawned players.
+			origin.z += 9.0f;
+			player.teleport(origin);
+			noclipRefused = !player.set_noclip(false);
+			yaw = -(float)atof(ent.value("angle").c_str());
+			update_camera_front();
+			break;
+		}
+	}
 	
 	// generate and bind array and buffer objects.
 	GLuint vao;
@@ -125,69 +212,138 @@ int main()
 	GLuint ebo;
 	glGenBuffers(1, &ebo);
 
-	glBindBuffer(GL_ARRAY_BUFFER, vbo);
-	glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(vertex), &vertices[0], GL_STATIC_DRAW);
+	// the vertex buffer is filled once the shader is built, it needs the attribute locations.
+	int vertexFormat = VERTEX_COMPACT;
+	bool vertexNormals = false;
+	packed_vertices packedVertices;
 
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
-	auto elements = loader.get_indices();
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, elements.size() * sizeof(unsigned int), &elements[0], GL_STATIC_DRAW);
-
-	// load and compile vertex and frag shaders
-
-	GLuint vertexShader = glCreateShader(GL_VERTEX_SHADER);
-	glShaderSource(vertexShader, 1, &vertexSource, NULL);
-
-	glCompileShader(vertexShader);
-
-	GLuint fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-	glShaderSource(fragmentShader, 1, &fragmentSource, NULL);
-
-	glCompileShader(fragmentShader);
-
-	GLuint shaderProgram = glCreateProgram();
-	glAttachShader(shaderProgram, vertexShader);
-	glAttachShader(shaderProgram, fragmentShader);
-
-	glBindFragDataLocation(shaderProgram, 0, "outColor");
-
-	glLinkProgram(shaderProgram);
-
-	GLint isLinked = 0;
-	glGetProgramiv(shaderProgram, GL_LINK_STATUS, &isLinked);
-
-	if (isLinked == GL_FALSE)
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.data.size(), &indices.data[0], GL_STATIC_DRAW);
+
+	// the draw programs are generated and built through this, and kept on disk once linked.
+	ShaderCache shaderCache{ "Data\\shaders.cache" };
+	bool programBinaries = ShaderCache::is_binary_supported();
+
+	// animated materials - water, lava and the like - drawn with their script stages.
+	MaterialEffects effects{ loader, indices, materials, textureMaterials, "Data\\", shaderCache };
+	bool materialEffects = true;
+	// the batched paths can't switch faces between passes, they always leave these to the effects.
+	std::vector<bool> animatedTextures;
+	for (int i = 0; i < loader.get_textures().size(); ++i)
+		animatedTextures.push_back(effects.animates(i));
+
+	Visibility visibility{ loader, mesh };
+	AreaPortals areaPortals{ loader };
+	bool areaCulling = true;
+	// no area is ruled out when area culling is off.
+	const std::vector<ubyte> noAreamask;
+	SoftwareOcclusion occlusion{ loader, mesh, workers };
+	bool softwareOcclusion = false;
+	NormalCones normalCones{ loader, mesh, materials, textureMaterials };
+	bool coneCulling = false;
+	std::unique_ptr<IndirectRenderer> indirectRenderer;
+	if (IndirectRenderer::is_supported())
+		indirectRenderer.reset(new IndirectRenderer(loader, indices, SingleDraw, animatedTextures));
+	std::unique_ptr<ClusterDrawLists> clusterLists;
+	if (indirectRenderer)
+		clusterLists.reset(new ClusterDrawLists(loader, mesh, *indirectRenderer));
+	std::unique_ptr<ComputeCulling> computeCulling;
+	if (indirectRenderer && ComputeCulling::is_supported())
+	{
+		GLuint cullProgram = shaderCache.get(shaderCache.request_compute(cullComputeSource));
+		if (cullProgram)
+			computeCulling.reset(new ComputeCulling(loader, mesh, *indirectRenderer, cullProgram));
+	}
+	std::unique_ptr<DepthPyramid> depthPyramid;
+	if (computeCulling && DepthPyramid::is_supported())
+	{
+		GLuint hizCopyProgram = shaderCache.get(shaderCache.request_compute(hizCopySource));
+		GLuint hizReduceProgram = shaderCache.get(shaderCache.request_compute(hizReduceSource));
+		if (hizCopyProgram && hizReduceProgram)
+			depthPyramid.reset(new DepthPyramid(800, 600, hizCopyProgram, hizReduceProgram));
+	}
+	bool hizCulling = false;
+	int renderMode = computeCulling ? RENDER_GPU_CULLED : indirectRenderer ? RENDER_INDIRECT : RENDER_SINGLE_DRAW;
+
+	// the world program's variants, generated from the shaders.inc templates. the ones not drawn
+	// with yet are asked for now as well, so they can compile in the background.
+	const char* shadingNames[] = { "lightmap x vertex colour", "lightmap", "vertex colour" };
+	const unsigned int shadingFeatures[] = { SHADER_LIGHTMAP | SHADER_VERTEX_COLOUR, SHADER_LIGHTMAP, SHADER_VERTEX_COLOUR };
+	int shadingPrograms[3];
+	for (int i = 0; i < 3; ++i)
 	{
-		GLint maxLength = 0;
-		glGetProgramiv(shaderProgram, GL_INFO_LOG_LENGTH, &maxLength);
+		shadingPrograms[i] = shaderCache.request(generate_variant(vertexSource, shadingFeatures[i]),
+			generate_variant(fragmentSource, shadingFeatures[i]));
+	}
+	int worldShading = 0;
 
-		std::vector<GLchar> infoLog(maxLength);
-		glGetProgramInfoLog(shaderProgram, maxLength, &maxLength, &infoLog[0]);
+	GLuint shaderProgram = shaderCache.get(shadingPrograms[worldShading]);
+	if (!shaderProgram)
+		return;
 
-		// The program is useless now. So delete it.
-		glDeleteProgram(shaderProgram);
+	glUseProgram(shaderProgram);
 
-		// Provide the infolog in whatever manner you deem best.
-		// Exit with failure.
-		return 0;
+	// vert shader attributes - see VertexFormat.h for the layouts.
+	auto uploadVertices = [&]()
+	{
+		packedVertices = pack_vertices(mesh.vertices, (vertex_format)vertexFormat, vertexNormals);
+		glBindBuffer(GL_ARRAY_BUFFER, vbo);
+		glBufferData(GL_ARRAY_BUFFER, packedVertices.data.size(), &packedVertices.data[0], GL_STATIC_DRAW);
+		apply_vertex_format(packedVertices, shaderProgram);
+		effects.set_vertices(packedVertices, vbo, ebo);
+		if (depthPyramid)
+			depthPyramid->set_box_margin(position_error(packedVertices));
+	};
+	uploadVertices();
+
+	std::unique_ptr<OcclusionQueries> occlusionQueries;
+	if (OcclusionQueries::is_supported())
+	{
+		GLuint boxProgram = shaderCache.get(shaderCache.request(boxVertexSource, boxFragmentSource));
+		if (boxProgram)
+			occlusionQueries.reset(new OcclusionQueries(loader, mesh, indices, boxProgram, animatedTextures));
 	}
 
-	glUseProgram(shaderProgram);
-
-	// vert shader attributes - see vertex struct in BSPLoader.h for specifics
-	GLint posAttrib = glGetAttribLocation(shaderProgram, "position");
-	glVertexAttribPointer(posAttrib, 3, GL_FLOAT, GL_FALSE, sizeof(vertex), 0);
+	// fragments that pass the depth test in the opaque pass and the depth prepass, to see the overdraw.
+	SampleCounter colourSamples;
+	SampleCounter prepassSamples;
+	bool prepassCounted = false;
 
-	GLint colAttrib = glGetAttribLocation(shaderProgram, "colour");
-	glVertexAttribPointer(colAttrib, 4, GL_UNSIGNED_BYTE, GL_TRUE,
-		sizeof(vertex), (void*)(10 * sizeof(float)));
+	// the opaque draw paths with the optional depth-only prepass. the prepass uses the same program
+	// so both passes come up with exactly the same depth, then the colour pass only shades the
+	// fragments that are equal to it.
+	auto drawOpaque = [&](const std::vector<multi_draw>& draws)
+	{
+		if (depthPrepass)
+		{
+			glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+			prepassSamples.begin();
+			for (const multi_draw& draw : draws)
+			{
+				glMultiDrawElementsBaseVertex(GL_TRIANGLES, &draw.counts[0], draw.type, &draw.offsets[0],
+					draw.counts.size(), &draw.base_vertices[0]);
+			}
+			prepassSamples.end();
+			glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+			glDepthFunc(GL_LEQUAL);
+			glDepthMask(GL_FALSE);
+		}
 
-	GLint lmAttrib = glGetAttribLocation(shaderProgram, "lmcoord");
-	glVertexAttribPointer(lmAttrib, 2, GL_FLOAT, GL_FALSE,
-		sizeof(vertex), (void*)(5 * sizeof(float)));
+		colourSamples.begin();
+		for (const multi_draw& draw : draws)
+		{
+			glMultiDrawElementsBaseVertex(GL_TRIANGLES, &draw.counts[0], draw.type, &draw.offsets[0],
+				draw.counts.size(), &draw.base_vertices[0]);
+		}
+		colourSamples.end();
+		prepassCounted = depthPrepass;
 
-	glEnableVertexAttribArray(posAttrib);
-	glEnableVertexAttribArray(colAttrib);
-	glEnableVertexAttribArray(lmAttrib);
+		if (depthPrepass)
+		{
+			glDepthFunc(GL_LESS);
+			glDepthMask(GL_TRUE);
+		}
+	};
 
 	int faceCount = loader.get_face_count();
 
@@ -197,15 +353,21 @@ int main()
 		glfwSetCursorPosCallback(window, mouse_callback);
 	}
 
+	double lastFrameTime = glfwGetTime();
+
 	while (!glfwWindowShouldClose(window))
 	{
 		glfwPollEvents();
 
+		double frameStart = glfwGetTime();
+		double frameTime = frameStart - lastFrameTime;
+		lastFrameTime = frameStart;
+
 		ImGui_ImplOpenGL3_NewFrame();
 		ImGui_ImplGlfw_NewFrame();
 		ImGui::NewFrame();
 
-		processInput(window);
+		processInput(window, player, frameTime);
 
 		// IMGui window for printing face info for debugging.
 		{
@@ -262,17 +424,345 @@ int main()
 			
 			if (ImGui::Button("Focus on face"))
 			{
-				cameraPos.x = vertices[_face.vertex].position[0];
-				cameraPos.y = vertices[_face.vertex].position[1];
-				cameraPos.z = vertices[_face.vertex].position[2];
+				// the face is almost certainly inside a wall from the player's point of view.
+				noclipRefused = !player.set_noclip(true);
+				player.teleport(glm::vec3(vertices[_face.vertex].position[0],
+					vertices[_face.vertex].position[1],
+					vertices[_face.vertex].position[2]));
 			}
 
 			//ImGui::ColorEdit3("clear color", (float*)&clear_color); // Edit 3 floats representing a color
 
+			// fire a batch of random vertex to vertex sight checks through the LOS service.
+			static int losCount = 4096;
+			ImGui::SliderInt("LOS pairs", &losCount, 1, 65536);
+			if (ImGui::Button("Run LOS batch") && !vertices.empty())
+			{
+				std::vector<los_query> queries(losCount);
+				for (auto& query : queries)
+				{
+					const vertex& a = vertices[rand() % vertices.size()];
+					const vertex& b = vertices[rand() % vertices.size()];
+					// lift the points off the surface they lie on.
+					query.from = glm::vec3(a.position[0], a.position[1], a.position[2] + 16.0f);
+					query.to = glm::vec3(b.position[0], b.position[1], b.position[2] + 16.0f);
+				}
+				lineOfSight.test(queries);
+			}
+			bool noclip = player.get_noclip();
+			if (ImGui::Checkbox("noclip (N)", &noclip))
+				noclipRefused = !player.set_noclip(noclip);
+			if (noclipRefused)
+				ImGui::Text("stuck inside a brush, noclip stays on");
+			glm::vec3 playerOrigin = player.get_origin();
+			glm::vec3 playerVelocity = player.get_velocity();
+			ImGui::Text("origin %.1f %.1f %.1f  speed %.1f  %s", playerOrigin.x, playerOrigin.y, playerOrigin.z,
+				glm::length(glm::vec3(playerVelocity.x, playerVelocity.y, 0.0f)), player.is_on_ground() ? "on ground" : "in air");
+
+			const los_stats& losStats = lineOfSight.get_stats();
+			ImGui::Text("LOS: %i pairs, %i PVS rejected, %i traced, %i visible, %.3f ms (%i threads)",
+				losStats.queries, losStats.pvs_rejected, losStats.traced, losStats.visible,
+				losStats.milliseconds, workers.get_thread_count());
+
 			ImGui::Text("Application average %.3f ms/frame (%.1f FPS)", 1000.0f / ImGui::GetIO().Framerate, ImGui::GetIO().Framerate);
 			ImGui::End();
 		}
 
+		// collision backend comparison - node tree vs brush BVH per kind of trace.
+		{
+			static std::vector<trace_benchmark> benchmarks;
+			static int benchmarkTraces = 20000;
+			ImGui::Begin("Collision");
+			ImGui::Text("brush BVH: %i nodes, %i brushes, depth %i", brushBVH.get_node_count(), brushBVH.get_brush_count(), brushBVH.get_depth());
+			ImGui::SliderInt("traces", &benchmarkTraces, 1000, 200000);
+			if (ImGui::Button("Run trace benchmark"))
+				benchmarks = benchmark_traces(loader, collision, benchmarkTraces);
+			for (const trace_benchmark& result : benchmarks)
+			{
+				ImGui::Text("%-10s node tree %8.3f ms  BVH %8.3f ms  mismatches %i",
+					result.name, result.node_tree_ms, result.brush_bvh_ms, result.mismatches);
+			}
+			if (!benchmarks.empty() && ImGui::Button("Use fastest backends"))
+				apply_fastest_backends(collision, benchmarks);
+
+			// dynamic entity linking - thousands of moving boxes relinked and touch queried every frame.
+			static sector_benchmark sectorBenchmark{};
+			static int sectorEntities = 4000;
+			ImGui::SliderInt("entities", &sectorEntities, 100, 20000);
+			if (ImGui::Button("Run world sector benchmark"))
+				sectorBenchmark = benchmark_world_sectors(loader, sectorEntities, 60);
+			if (sectorBenchmark.frames > 0)
+			{
+				ImGui::Text("%i entities x %i frames: link %.3f ms, sector queries %.3f ms, linear scan %.3f ms",
+					sectorBenchmark.entities, sectorBenchmark.frames, sectorBenchmark.link_ms,
+					sectorBenchmark.sector_query_ms, sectorBenchmark.linear_query_ms);
+				ImGui::Text("%lld touches, %i mismatches", sectorBenchmark.touches, sectorBenchmark.mismatches);
+			}
+
+			const char* backendNames[] = { "node tree", "brush BVH" };
+			const char* queryNames[] = { "short rays", "long rays", "box sweeps" };
+			for (int i = 0; i < QUERY_TYPE_COUNT; ++i)
+			{
+				int backend = collision.get_backend((trace_query)i);
+				if (ImGui::Combo(queryNames[i], &backend, backendNames, 2))
+					collision.set_backend((trace_query)i, (trace_backend)backend);
+			}
+			ImGui::End();
+		}
+
+		// draw path selection and what the culling left to draw last frame.
+		{
+			ImGui::Begin("Rendering");
+			const char* modeNames[] = { "single draw", "per face", "visible runs (PVS + frustum)", "occlusion queries (CHC++)",
+				"indirect (PVS + frustum)", "indirect (cluster lists)", "indirect (compute culled)" };
+			// modes without the objects they need are greyed out rather than left off, so every
+			// other entry keeps its render_mode value.
+			bool modeAvailable[] = { true, true, true, occlusionQueries != nullptr, indirectRenderer != nullptr,
+				clusterLists != nullptr, computeCulling != nullptr };
+			bool modeChanged = false;
+			if (ImGui::BeginCombo("mode", modeNames[renderMode]))
+			{
+				for (int i = 0; i < 7; ++i)
+				{
+					if (ImGui::Selectable(modeNames[i], renderMode == i, modeAvailable[i] ? 0 : ImGuiSelectableFlags_Disabled))
+					{
+						renderMode = i;
+						modeChanged = true;
+					}
+				}
+				ImGui::EndCombo();
+			}
+			if (modeChanged)
+			{
+				builtVersion = -1;
+				singleDrawsDirty = true;
+				translucent.invalidate();
+				normalCones.invalidate();
+				effects.invalidate();
+				if (depthPyramid)
+					depthPyramid->invalidate();
+			}
+			if (!occlusionQueries)
+				ImGui::Text("occlusion queries need GL 3.0 and the query box program");
+			if (!indirectRenderer)
+				ImGui::Text("indirect drawing needs GL 4.3 or ARB_multi_draw_indirect");
+			else if (!computeCulling)
+				ImGui::Text("compute culling needs GL 4.3");
+
+			if (ImGui::Combo("world shading", &worldShading, shadingNames, 3))
+			{
+				GLuint program = shaderCache.get(shadingPrograms[worldShading]);
+				if (program)
+				{
+					shaderProgram = program;
+					glUseProgram(shaderProgram);
+					apply_vertex_format(packedVertices, shaderProgram);
+				}
+			}
+			const shader_cache_stats& shaderStats = shaderCache.get_stats();
+			ImGui::Text("shaders: %i programs, %i compiled, %i from binaries, %i compiling, %i failed, %.1f ms",
+				shaderStats.programs, shaderStats.compiled, shaderStats.loaded, shaderStats.pending, shaderStats.failed,
+				shaderStats.milliseconds);
+			if (!programBinaries)
+				ImGui::Text("no program binaries, every start compiles from source");
+			if (shaderStats.last_failed >= 0)
+				ImGui::TextWrapped("last failed program:\n%s", shaderCache.get_log(shaderStats.last_failed).c_str());
+
+			const char* formatNames[] = { "full (44 bytes)", "compact", "compact, float positions" };
+			bool formatChanged = ImGui::Combo("vertex format", &vertexFormat, formatNames, 3);
+			formatChanged |= ImGui::Checkbox("pack normals", &vertexNormals);
+			if (formatChanged)
+				uploadVertices();
+			ImGui::Text("%i bytes per vertex, %.1f KB vertex buffer (%.1f KB as loaded)", packedVertices.stride,
+				packedVertices.data.size() / 1024.0f, mesh.vertices.size() * sizeof(vertex) / 1024.0f);
+
+			ImGui::Text("index buffer %.1f KB (%.1f KB as 32 bit), %i batches, %i 16 bit / %i 32 bit ranges",
+				indices.data.size() / 1024.0f, mesh.indices.size() * sizeof(unsigned int) / 1024.0f,
+				indices.batches, indices.short_ranges, indices.int_ranges);
+			ImGui::Text("welded vertices: %i -> %i (%.1f%% fewer), %i faces share", weldReport.vertices_before,
+				weldReport.vertices_after, weldReport.reduction() * 100.0f, weldReport.faces_sharing);
+			ImGui::Text("merged faces: %i, triangles %i -> %i, ranges %i -> %i", mergeReport.faces_merged,
+				mergeReport.triangles_before, mergeReport.triangles_after, mergeReport.ranges_before, mergeReport.ranges_after);
+			ImGui::Text("vertex cache: ACMR %.3f -> %.3f, ATVR %.3f -> %.3f", cacheReport.before.acmr, cacheReport.after.acmr,
+				cacheReport.before.atvr, cacheReport.after.atvr);
+			const material_stats& materialStats = materials.get_stats();
+			ImGui::Text("materials: %i from %i scripts (%i missing) in %.1f ms, %i of %i textures scripted, %i states",
+				materialStats.materials, materialStats.scripts, materialStats.missing_scripts, materialStats.milliseconds,
+				materialStats.textures_scripted, (int)textureMaterials.size(), materialStates);
+
+			if (renderMode == RENDER_VISIBLE_RUNS)
+			{
+				int runs = 0;
+				for (const multi_draw& draw : visibleDraws)
+					runs += draw.counts.size();
+				ImGui::Text("camera cluster %i, %i leafs, %i faces visible in %i runs", visibility.get_camera_cluster(),
+					visibility.get_visible_leaf_count(), (int)visibility.get_visible_faces().size(), runs);
+				ImGui::Text("visibility rebuilt %i times, PVS %i times", visibility.get_face_rebuilds(), visibility.get_pvs_rebuilds());
+			}
+			else if (renderMode == RENDER_OCCLUSION_QUERIES)
+			{
+				const query_stats& queryStats = occlusionQueries->get_stats();
+				ImGui::Text("%i leafs drawn, %i conditionally, of %i in PVS + frustum", queryStats.leafs_drawn,
+					queryStats.leafs_conditional, queryStats.pvs_leafs);
+				ImGui::Text("%i hidden box queries, %i visible checks, %i hidden subtrees", queryStats.box_queries,
+					queryStats.check_queries, queryStats.hidden_nodes);
+				ImGui::Text("%i results read, %i pending, latency %.2f frames (max %i), %.2f ms", queryStats.results,
+					queryStats.pending, queryStats.latency, queryStats.max_latency, queryStats.milliseconds);
+			}
+			else if (renderMode == RENDER_INDIRECT)
+			{
+				ImGui::Text("camera cluster %i, %i leafs, %i faces visible", visibility.get_camera_cluster(),
+					visibility.get_visible_leaf_count(), (int)visibility.get_visible_faces().size());
+				ImGui::Text("visibility rebuilt %i times, PVS %i times", visibility.get_face_rebuilds(), visibility.get_pvs_rebuilds());
+				ImGui::Text("%i commands in %i draw calls (%i buckets)", indirectRenderer->get_command_count(),
+					indirectRenderer->get_draw_call_count(), indirectRenderer->get_bucket_count());
+			}
+			else if (renderMode == RENDER_CLUSTER_LISTS)
+			{
+				ImGui::Text("camera cluster %i, %i of %i listed draws in view, %i list switches", clusterLists->get_camera_cluster(),
+					clusterLists->get_drawn_count(), clusterLists->get_list_size(), clusterLists->get_list_switches());
+				ImGui::Text("%i draw calls (%i buckets), lists take %.1f KB", indirectRenderer->get_draw_call_count(),
+					indirectRenderer->get_bucket_count(), clusterLists->get_memory_size() / 1024.0f);
+			}
+			else if (renderMode == RENDER_GPU_CULLED)
+			{
+				// reading the counts back stalls on the cull, so only do it when asked.
+				static bool readBack = false;
+				ImGui::Checkbox("read back visible count", &readBack);
+				if (depthPyramid)
+				{
+					ImGui::Checkbox("Hi-Z occlusion (last frame's depth)", &hizCulling);
+					ImGui::Text("depth pyramid %ix%i, %i levels", depthPyramid->get_base_width(),
+						depthPyramid->get_base_height(), depthPyramid->get_level_count());
+				}
+				ImGui::Text("camera cluster %i, %i draw calls (%i buckets)", computeCulling->get_camera_cluster(),
+					indirectRenderer->get_draw_call_count(), indirectRenderer->get_bucket_count());
+				if (readBack)
+					ImGui::Text("%i faces visible, %i hidden by Hi-Z", computeCulling->read_visible_count(),
+						computeCulling->read_hiz_rejected());
+			}
+
+			if (renderMode == RENDER_SINGLE_DRAW || renderMode == RENDER_PER_FACE || renderMode == RENDER_VISIBLE_RUNS ||
+				renderMode == RENDER_INDIRECT)
+			{
+				if (ImGui::Checkbox("translucent pass (back to front)", &translucentPass))
+				{
+					builtVersion = -1;
+					singleDrawsDirty = true;
+					translucent.invalidate();
+				}
+				if (translucentPass)
+				{
+					const translucent_stats& translucentStats = translucent.get_stats();
+					ImGui::Text("%i translucent faces, %i blend batches in %i draw calls, sorted %i times",
+						translucentStats.faces, translucentStats.batches, translucentStats.draw_calls, translucentStats.rebuilds);
+				}
+			}
+			else
+				ImGui::Text("no translucent pass in this mode, translucent faces aren't drawn");
+
+			// the other paths leave the animated faces out of their own draws.
+			bool effectsOptional = renderMode == RENDER_SINGLE_DRAW || renderMode == RENDER_PER_FACE || renderMode == RENDER_VISIBLE_RUNS;
+			if (effectsOptional)
+			{
+				if (ImGui::Checkbox("material effects (animated shaders)", &materialEffects))
+				{
+					builtVersion = -1;
+					singleDrawsDirty = true;
+					translucent.invalidate();
+					effects.invalidate();
+				}
+			}
+			else
+				ImGui::Text("material effects always on, this mode leaves animated faces to them");
+			if (materialEffects || !effectsOptional)
+			{
+				const effects_stats& effectsStats = effects.get_stats();
+				ImGui::Text("%i animated materials, %i shaders, %i textures (%i missing)", effectsStats.materials,
+					effectsStats.programs, effectsStats.textures_loaded, effectsStats.textures_missing);
+				ImGui::Text("%i animated faces in %i stage draws", effectsStats.faces, effectsStats.stage_draws);
+				if (!vertexNormals)
+					ImGui::Text("wave and bulge deforms need packed normals");
+			}
+
+			if (renderMode == RENDER_SINGLE_DRAW || renderMode == RENDER_VISIBLE_RUNS)
+			{
+				if (ImGui::Checkbox("front to back (BSP order)", &frontToBack))
+				{
+					builtVersion = -1;
+					singleDrawsDirty = true;
+				}
+				ImGui::Checkbox("depth prepass", &depthPrepass);
+				if (renderMode == RENDER_SINGLE_DRAW)
+				{
+					int runs = 0;
+					for (const multi_draw& draw : frontToBack || translucentPass || materialEffects ? singleDraws : multiDraws)
+						runs += draw.counts.size();
+					ImGui::Text("%i runs", runs);
+				}
+
+				// samples per pixel of the window, 1.0 would mean every pixel shaded exactly once.
+				const float pixels = 800.0f * 600.0f;
+				ImGui::Text("shaded fragments: %.2f per pixel", colourSamples.get_samples() / pixels);
+				if (prepassCounted)
+					ImGui::Text("depth prepass fragments: %.2f per pixel", prepassSamples.get_samples() / pixels);
+			}
+
+			if (renderMode == RENDER_VISIBLE_RUNS || renderMode == RENDER_INDIRECT)
+			{
+				if (ImGui::Checkbox("software occlusion", &softwareOcclusion))
+				{
+					builtVersion = -1;
+					translucent.invalidate();
+					normalCones.invalidate();
+				}
+				if (softwareOcclusion)
+				{
+					const occlusion_stats& occlusionStats = occlusion.get_stats();
+					ImGui::Text("%i occluders (%i triangles), raster %.2f ms, tests %.2f ms", occlusionStats.occluder_faces,
+						occlusionStats.occluder_triangles, occlusionStats.raster_milliseconds, occlusionStats.test_milliseconds);
+					ImGui::Text("occluded %i of %i leafs, %i faces (%i tested), %i triangles", occlusionStats.leafs_occluded,
+						occlusionStats.leafs_tested, occlusionStats.faces_occluded, occlusionStats.faces_tested,
+						occlusionStats.triangles_occluded);
+				}
+
+				if (ImGui::Checkbox("normal cone culling", &coneCulling))
+				{
+					builtVersion = -1;
+					translucent.invalidate();
+					normalCones.invalidate();
+				}
+				if (coneCulling)
+				{
+					const cone_stats& coneStats = normalCones.get_stats();
+					ImGui::Text("%i of %i cone groups facing away (%i in the map), %i faces, %.2f ms", coneStats.groups_culled,
+						coneStats.groups, normalCones.get_group_count(), coneStats.faces_culled, coneStats.milliseconds);
+					ImGui::Text("triangles saved: %i of %i (%.1f%%)", coneStats.triangles_culled, coneStats.triangles,
+						coneStats.triangles > 0 ? coneStats.triangles_culled * 100.0f / coneStats.triangles : 0.0f);
+				}
+
+				ImGui::Checkbox("cull by area", &areaCulling);
+				ImGui::Text("camera area %i of %i, %i connected, %i doors", areaPortals.get_camera_area(),
+					areaPortals.get_area_count(), areaPortals.get_connected_count(), (int)areaPortals.get_portals().size());
+				if (ImGui::Button("open all"))
+					areaPortals.set_all_open(true);
+				ImGui::SameLine();
+				if (ImGui::Button("close all"))
+					areaPortals.set_all_open(false);
+
+				for (int i = 0; i < areaPortals.get_portals().size(); ++i)
+				{
+					const area_portal& portal = areaPortals.get_portals()[i];
+					bool open = portal.open;
+					std::string label = "door " + loader.get_entities()[portal.entity].value("model") +
+						" (areas " + std::to_string(portal.area[0]) + " - " + std::to_string(portal.area[1]) + ")";
+					if (ImGui::Checkbox(label.c_str(), &open))
+						areaPortals.set_open(i, open);
+				}
+			}
+			ImGui::End();
+		}
+
 		// build matrices for view, projection and model
 		glm::mat4 view = glm::lookAt(
 			cameraPos,
@@ -298,28 +788,159 @@ int main()
 		glClearColor(clear_color.x, clear_color.y, clear_color.z, 1.0f);
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-		if (!SingleDraw)
+		if (renderMode == RENDER_PER_FACE)
 		{
-			// render each face individually - this currently leads to holes in the mesh
-			// but is probably the necessary approach to correctly render lightmaps + textures.
+			const std::vector<int>* faces = &drawOrder.get_faces();
+			if (materialEffects)
+			{
+				effects.build(gl_to_bsp(cameraPos), *faces, 0);
+				faces = &effects.get_static_faces();
+			}
+
+			// render each face individually - probably the necessary approach to correctly render lightmaps + textures.
 			for (int i = 0; i < faceCount; ++i)
 			{
 				face _face = loader.get_face(i);
-				if (_face.type == 1 || _face.type == 3)
+				const packed_range& range = indices.ranges[i];
+				if (range.n_indices > 0)
 				{
+					if (materialEffects && effects.animates(_face.texture)) continue; // drawn with their stages below, water and lava too.
 					shader _shader = loader.get_shader(_face.texture);
 					if (!_shader.render || _shader.transparent) continue; // don't render transparent surfaces yet!
-					if (_face.lm_index < 0) continue; // right now, don't try to draw a face if it doesn't have a lightmap associated with it.
+					if (!SingleDraw && _face.lm_index < 0) continue; // right now, don't try to draw a face if it doesn't have a lightmap associated with it.
 
-					GLuint texId = loader.get_lightmap_tex(_face.lm_index);
+					// with SingleDraw the lightmap coords point into the atlas.
+					GLuint texId = SingleDraw ? loader.get_lm_id() : loader.get_lightmap_tex(_face.lm_index);
 
 					glActiveTexture(GL_TEXTURE0);
 					glBindTexture(GL_TEXTURE_2D, texId);
-					//glDrawElements(GL_TRIANGLES, face.meshIndexCount, GL_UNSIGNED_INT, (void*)(long)(face.meshIndexOffset * sizeof(GLuint)));
-					glDrawElements(GL_TRIANGLES, _face.n_meshverts, GL_UNSIGNED_INT, (void*)(long)(_face.meshvert * sizeof(GLuint)));
+					glDrawElementsBaseVertex(GL_TRIANGLES, range.n_indices, range.type, range.offset(), range.base_vertex);
 				}
 
 			}
+
+			if (materialEffects)
+				effects.draw(proj * view * model, gl_to_bsp(cameraPos), (float)glfwGetTime());
+			if (translucentPass)
+			{
+				translucent.build(gl_to_bsp(cameraPos), *faces, 0);
+				glBindTexture(GL_TEXTURE_2D, loader.get_lm_id());
+				translucent.draw();
+			}
+		}
+		else if (renderMode == RENDER_VISIBLE_RUNS)
+		{
+			visibility.update(gl_to_bsp(cameraPos), extract_frustum(proj * view * model),
+				areaCulling ? areaPortals.get_areamask(gl_to_bsp(cameraPos)) : noAreamask);
+			const std::vector<int>* visibleFaces = &visibility.get_visible_faces();
+			if (softwareOcclusion)
+			{
+				occlusion.cull(visibility, gl_to_bsp(cameraPos), proj * view * model);
+				visibleFaces = &occlusion.get_visible_faces();
+			}
+			if (coneCulling)
+			{
+				normalCones.cull(gl_to_bsp(cameraPos), *visibleFaces, visibility.get_version());
+				visibleFaces = &normalCones.get_visible_faces();
+			}
+			if (materialEffects)
+			{
+				effects.build(gl_to_bsp(cameraPos), *visibleFaces, visibility.get_version());
+				visibleFaces = &effects.get_static_faces();
+			}
+			if (translucentPass)
+			{
+				translucent.build(gl_to_bsp(cameraPos), *visibleFaces, visibility.get_version());
+				visibleFaces = &translucent.get_opaque_faces();
+			}
+			if (visibility.get_version() != builtVersion || ((frontToBack || coneCulling) && gl_to_bsp(cameraPos) != builtPosition))
+			{
+				builtPosition = gl_to_bsp(cameraPos);
+				if (frontToBack)
+					visibleDraws = build_ordered_draws(indices, drawOrder.front_to_back(builtPosition, *visibleFaces));
+				else
+					visibleDraws = build_multi_draws(indices, *visibleFaces);
+				builtVersion = visibility.get_version();
+			}
+
+			glActiveTexture(GL_TEXTURE0);
+			glBindTexture(GL_TEXTURE_2D, loader.get_lm_id());
+			drawOpaque(visibleDraws);
+			if (materialEffects)
+				effects.draw(proj * view * model, gl_to_bsp(cameraPos), (float)glfwGetTime());
+			if (translucentPass)
+				translucent.draw();
+		}
+		else if (renderMode == RENDER_OCCLUSION_QUERIES)
+		{
+			glActiveTexture(GL_TEXTURE0);
+			glBindTexture(GL_TEXTURE_2D, loader.get_lm_id());
+			occlusionQueries->render(gl_to_bsp(cameraPos), proj * view * model);
+
+			// the queries only cover the static faces, the animated ones are drawn unculled. that set
+			// doesn't depend on the camera, so it's built once.
+			effects.build(glm::vec3(0.0f), drawOrder.get_faces(), 0);
+			effects.draw(proj * view * model, gl_to_bsp(cameraPos), (float)glfwGetTime());
+		}
+		else if (renderMode == RENDER_INDIRECT)
+		{
+			visibility.update(gl_to_bsp(cameraPos), extract_frustum(proj * view * model),
+				areaCulling ? areaPortals.get_areamask(gl_to_bsp(cameraPos)) : noAreamask);
+			const std::vector<int>* visibleFaces = &visibility.get_visible_faces();
+			if (softwareOcclusion)
+			{
+				occlusion.cull(visibility, gl_to_bsp(cameraPos), proj * view * model);
+				visibleFaces = &occlusion.get_visible_faces();
+			}
+			if (coneCulling)
+			{
+				normalCones.cull(gl_to_bsp(cameraPos), *visibleFaces, visibility.get_version());
+				visibleFaces = &normalCones.get_visible_faces();
+			}
+			effects.build(gl_to_bsp(cameraPos), *visibleFaces, visibility.get_version());
+			visibleFaces = &effects.get_static_faces();
+			if (visibility.get_version() != builtVersion || (coneCulling && gl_to_bsp(cameraPos) != builtPosition))
+			{
+				builtPosition = gl_to_bsp(cameraPos);
+				indirectRenderer->build_commands(*visibleFaces);
+				builtVersion = visibility.get_version();
+			}
+			indirectRenderer->draw();
+			effects.draw(proj * view * model, gl_to_bsp(cameraPos), (float)glfwGetTime());
+
+			// the indirect buckets leave translucent faces out already.
+			if (translucentPass)
+			{
+				translucent.build(gl_to_bsp(cameraPos), *visibleFaces, visibility.get_version());
+				glActiveTexture(GL_TEXTURE0);
+				glBindTexture(GL_TEXTURE_2D, loader.get_lm_id());
+				translucent.draw();
+			}
+		}
+		else if (renderMode == RENDER_CLUSTER_LISTS)
+		{
+			clusterLists->update(gl_to_bsp(cameraPos), extract_frustum(proj * view * model));
+			clusterLists->draw();
+
+			// the lists only cover the static faces, the animated ones are drawn unculled.
+			effects.build(glm::vec3(0.0f), drawOrder.get_faces(), 0);
+			effects.draw(proj * view * model, gl_to_bsp(cameraPos), (float)glfwGetTime());
+		}
+		else if (renderMode == RENDER_GPU_CULLED)
+		{
+			computeCulling->cull(gl_to_bsp(cameraPos), extract_frustum(proj * view * model), hizCulling ? depthPyramid.get() : nullptr);
+			computeCulling->draw();
+
+			// this frame's depth is what next frame's cull tests against.
+			if (hizCulling)
+				depthPyramid->build(proj * view * model);
+			else if (depthPyramid)
+				depthPyramid->invalidate();
+
+			// the compute shader only culls the static faces, the animated ones are drawn unculled
+			// and after the pyramid, so moving surfaces don't hide anything.
+			effects.build(glm::vec3(0.0f), drawOrder.get_faces(), 0);
+			effects.draw(proj * view * model, gl_to_bsp(cameraPos), (float)glfwGetTime());
 		}
 		else
 		{
@@ -327,7 +948,38 @@ int main()
 			glBindTexture(GL_TEXTURE_2D, loader.get_lm_id());
 
 			// just draw everything in one fell swoop - all renders correctly, but can't easily do lightmaps this way!
-			glDrawElements(GL_TRIANGLES, elements.size(), GL_UNSIGNED_INT, 0);
+			// one call per index type, each covering every batch, or a run at a time front to back.
+			const std::vector<int>* faces = &drawOrder.get_faces();
+			if (materialEffects)
+			{
+				effects.build(gl_to_bsp(cameraPos), *faces, 0);
+				faces = &effects.get_static_faces();
+			}
+			if (translucentPass)
+			{
+				translucent.build(gl_to_bsp(cameraPos), *faces, 0);
+				faces = &translucent.get_opaque_faces();
+			}
+			if (frontToBack || translucentPass || materialEffects)
+			{
+				if (singleDrawsDirty || (frontToBack && gl_to_bsp(cameraPos) != singleDrawsPosition))
+				{
+					singleDrawsPosition = gl_to_bsp(cameraPos);
+					if (frontToBack)
+						singleDraws = build_ordered_draws(indices, drawOrder.front_to_back(singleDrawsPosition, *faces));
+					else
+						singleDraws = build_multi_draws(indices, *faces);
+					singleDrawsDirty = false;
+				}
+				drawOpaque(singleDraws);
+			}
+			else
+				drawOpaque(multiDraws);
+
+			if (materialEffects)
+				effects.draw(proj * view * model, gl_to_bsp(cameraPos), (float)glfwGetTime());
+			if (translucentPass)
+				translucent.draw();
 		}
 		if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
 			glfwSetWindowShouldClose(window, GL_TRUE);
@@ -337,6 +989,49 @@ int main()
 		glfwSwapBuffers(window);
 	}
 
+	shaderCache.save();
+}
+
+int main()
+{
+	glfwInit();
+
+	// ask for 4.3 for indirect drawing, the rest only needs 3.2.
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+
+	glfwWindowHint(GLFW_RESIZABLE, GL_FALSE);
+
+	// create windowed monitor
+	GLFWwindow* window = glfwCreateWindow(800, 600, "My OpenGL Window", nullptr, nullptr);
+	if (!window)
+	{
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 2);
+		window = glfwCreateWindow(800, 600, "My OpenGL Window", nullptr, nullptr);
+	}
+
+	glfwMakeContextCurrent(window);
+
+	glewExperimental = GL_TRUE;
+	glewInit();
+
+	ImGui::CreateContext();
+	ImGuiIO& io = ImGui::GetIO();
+	io.ConfigFlags |= ImGuiConfigFlags_NavEnableKeyboard;
+
+	ImGui_ImplGlfw_InitForOpenGL(window, true);
+	ImGui_ImplOpenGL3_Init("#version 150");
+
+	glEnable(GL_CULL_FACE);
+	glCullFace(GL_BACK);
+	glFrontFace(GL_CW);
+	glEnable(GL_DEPTH_TEST);
+
+	run(window);
+
 	ImGui_ImplOpenGL3_Shutdown();
 	ImGui_ImplGlfw_Shutdown();
 	ImGui::DestroyContext();
@@ -0,0 +1,689 @@
+#include "MaterialEffects.h"
+#include "stb_image.h"
+
+#include <algorithm>
+#include <cstring>
+#include <set>
+
+// the uniform buffer binding point the stage blocks are read through.
+const GLuint EFFECTS_BLOCK_BINDING = 0;
+
+// the parts of every generated vertex shader around its effect lines.
+static const char* effect_vertex_head = R"glsl(#version 150 core
+
+in vec3 position;
+in vec4 colour;
+in vec4 texcoord;
+in vec4 lmcoord;
+in vec3 normal;
+
+out vec2 StageCoord;
+out vec4 StageColour;
+
+uniform mat4 clip;
+uniform float time;
+uniform vec3 viewOrigin;
+
+uniform vec3 positionOffset;
+uniform vec3 positionScale;
+uniform bool octahedralNormals;
+
+// stage_effects_block in MaterialEffects.h.
+layout(std140) uniform StageEffects
+{
+	vec4 deformParams[4];
+	vec4 deformWaves[4];
+	ivec4 deformFuncs;
+	vec4 tcmodParams[4];
+	vec4 tcmodOffsets[4];
+	vec4 tcmodWaves[4];
+	ivec4 tcmodFuncs;
+	vec4 tcgenVectors[2];
+	vec4 rgbWave;
+	vec4 alphaWave;
+	vec4 constant;
+	ivec4 colourFuncs;
+};
+
+const float TAU = 6.2831853;
+
+vec3 octDecode(vec2 e)
+{
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	if (n.z < 0.0)
+		n.xy = (1.0 - abs(n.yx)) * mix(vec2(-1.0), vec2(1.0), greaterThanEqual(n.xy, vec2(0.0)));
+	return normalize(n);
+}
+
+// smooth value noise in [-1, 1].
+float noise(float x)
+{
+	float i = floor(x);
+	float a = fract(sin(i * 12.9898) * 43758.5453);
+	float b = fract(sin((i + 1.0) * 12.9898) * 43758.5453);
+	return mix(a, b, smoothstep(0.0, 1.0, fract(x))) * 2.0 - 1.0;
+}
+
+// Q3's wave tables, a period over [0, 1). func is a wave_func.
+float waveTable(int func, float x)
+{
+	if (func == 0)
+		return sin(x * TAU);
+	if (func == 1)
+		return 1.0 - 4.0 * abs(fract(x + 0.25) - 0.5);
+	if (func == 2)
+		return fract(x) < 0.5 ? 1.0 : -1.0;
+	if (func == 3)
+		return fract(x);
+	if (func == 4)
+		return 1.0 - fract(x);
+	return noise(x);
+}
+
+// w is base, amplitude, phase, frequency.
+float evalWave(int func, vec4 w, float phase)
+{
+	return w.x + w.y * waveTable(func, w.z + phase + time * w.w);
+}
+
+vec3 perturbNormal(vec3 p, vec3 n, vec4 params)
+{
+	float t = time * params.y;
+	vec3 offset = vec3(noise(p.x * 0.98 + t), noise(p.y * 0.98 + t + 100.0), noise(p.z * 0.98 + t + 200.0));
+	return normalize(n + offset * params.x);
+}
+
+vec2 rotateCoords(vec2 st, float degrees)
+{
+	float angle = radians(-degrees * time);
+	float s = sin(angle);
+	float c = cos(angle);
+	return vec2(st.s * c - st.t * s + 0.5 - 0.5 * c + 0.5 * s, st.s * s + st.t * c + 0.5 - 0.5 * s - 0.5 * c);
+}
+
+vec2 stretchCoords(vec2 st, float scale)
+{
+	return (st - 0.5) / scale + 0.5;
+}
+
+vec2 turbCoords(vec2 st, vec3 p, vec4 w)
+{
+	float now = w.z + time * w.w;
+	return st + vec2(sin(((p.x + p.z) * (0.125 / 128.0) + now) * TAU), sin((p.y * (0.125 / 128.0) + now) * TAU)) * w.y;
+}
+
+float specularAlpha(vec3 p, vec3 n)
+{
+	// the fixed light Q3 uses for lightingSpecular.
+	vec3 light = normalize(vec3(-960.0, 1980.0, 96.0) - p);
+	vec3 reflected = n * 2.0 * dot(n, light) - light;
+	return pow(max(dot(reflected, normalize(viewOrigin - p)), 0.0), 4.0);
+}
+
+void main()
+{
+	vec3 p = positionOffset + position * positionScale;
+	vec3 n = octahedralNormals ? octDecode(normal.xy) : normal;
+)glsl";
+
+static const char* effect_vertex_tail = R"glsl(
+	StageCoord = st;
+	StageColour = vec4(rgb, alpha);
+	gl_Position = clip * vec4(p, 1.0);
+}
+)glsl";
+
+static const char* effect_fragment_source = R"glsl(#version 150 core
+
+in vec2 StageCoord;
+in vec4 StageColour;
+
+uniform sampler2D stageTexture;
+
+out vec4 outColor;
+
+void main()
+{
+	vec4 colour = texture(stageTexture, StageCoord) * StageColour;
+#if defined(ALPHA_GT0)
+	if (colour.a <= 0.0)
+		discard;
+#elif defined(ALPHA_LT128)
+	if (colour.a >= 0.5)
+		discard;
+#elif defined(ALPHA_GE128)
+	if (colour.a < 0.5)
+		discard;
+#endif
+#ifdef OVERBRIGHT
+	colour.rgb *= 3.0;
+#endif
+	outColor = colour;
+}
+)glsl";
+
+// the fragment variant for each alpha_func.
+static const unsigned int alpha_features[] = { 0, SHADER_ALPHA_GT0, SHADER_ALPHA_LT128, SHADER_ALPHA_GE128 };
+
+static void copy_wave(const wave& _wave, float out[4])
+{
+	out[0] = _wave.base;
+	out[1] = _wave.amplitude;
+	out[2] = _wave.phase;
+	out[3] = _wave.frequency;
+}
+
+static bool is_animated(const material& _material)
+{
+	// skies and fog volumes are drawn quite differently, they're left to whoever does those.
+	if (!_material.scripted || _material.sky || _material.fog || _material.stages.empty())
+		return false;
+	if (!_material.deforms.empty())
+		return true;
+
+	for (const material_stage& stage : _material.stages)
+	{
+		if (!stage.tcmods.empty() || stage.maps.size() > 1 || stage.rgb_gen == COLOUR_WAVE || stage.alpha_gen == COLOUR_WAVE ||
+			stage.tcgen == TCGEN_ENVIRONMENT || stage.tcgen == TCGEN_VECTOR)
+			return true;
+	}
+	return false;
+}
+
+// the lines of a stage's vertex shader between the decoded vertex and the outputs, along with the
+// block holding their parameters. the source only depends on the kinds of effects and their order.
+static std::string generate_effects(const material& _material, const material_stage& stage, stage_effects_block& block)
+{
+	std::string source;
+
+	int deforms = 0;
+	for (const deform& _deform : _material.deforms)
+	{
+		if (deforms == MAX_EFFECT_DEFORMS)
+			break;
+
+		std::string i = std::to_string(deforms);
+		float* params = block.deform_params[deforms];
+		copy_wave(_deform._wave, block.deform_waves[deforms]);
+		block.deform_funcs[deforms] = _deform._wave.func;
+		switch (_deform.type)
+		{
+		case DEFORM_WAVE:
+			// Q3 makes a spread of 0 into a very tight one.
+			params[0] = _deform.params[0] != 0.0f ? 1.0f / _deform.params[0] : 100.0f;
+			source += "\tp += n * evalWave(deformFuncs[" + i + "], deformWaves[" + i + "], dot(p, vec3(1.0)) * deformParams[" + i + "].x);\n";
+			break;
+		case DEFORM_NORMAL:
+			params[0] = _deform.params[0];
+			params[1] = _deform.params[1];
+			source += "\tn = perturbNormal(p, n, deformParams[" + i + "]);\n";
+			break;
+		case DEFORM_BULGE:
+			std::copy(_deform.params, _deform.params + 3, params);
+			source += "\tp += n * sin(texcoord.s * deformParams[" + i + "].x + time * deformParams[" + i + "].z) * deformParams[" + i + "].y;\n";
+			break;
+		case DEFORM_MOVE:
+			std::copy(_deform.params, _deform.params + 3, params);
+			source += "\tp += deformParams[" + i + "].xyz * evalWave(deformFuncs[" + i + "], deformWaves[" + i + "], 0.0);\n";
+			break;
+		default:
+			// autosprites would need the rest of their quad.
+			continue;
+		}
+		deforms++;
+	}
+
+	if (stage.tcgen == TCGEN_ENVIRONMENT)
+	{
+		source += "\tvec3 viewer = normalize(viewOrigin - p);\n";
+		source += "\tvec3 reflected = n * 2.0 * dot(n, viewer) - viewer;\n";
+		source += "\tvec2 st = vec2(0.5 + reflected.y * 0.5, 0.5 - reflected.z * 0.5);\n";
+	}
+	else if (stage.tcgen == TCGEN_VECTOR)
+	{
+		for (int i = 0; i < 2; ++i)
+			std::copy(&stage.tcgen_vectors[i].x, &stage.tcgen_vectors[i].x + 3, block.tcgen_vectors[i]);
+		source += "\tvec2 st = vec2(dot(p, tcgenVectors[0].xyz), dot(p, tcgenVectors[1].xyz));\n";
+	}
+	else if (stage.tcgen == TCGEN_LIGHTMAP || stage.lightmap)
+		source += "\tvec2 st = lmcoord.st;\n";
+	else
+		source += "\tvec2 st = texcoord.st;\n";
+
+	int tcmods = 0;
+	for (const tcmod& mod : stage.tcmods)
+	{
+		if (tcmods == MAX_EFFECT_TCMODS)
+			break;
+
+		std::string i = std::to_string(tcmods);
+		std::copy(mod.params, mod.params + 4, block.tcmod_params[tcmods]);
+		std::copy(mod.params + 4, mod.params + 6, block.tcmod_offsets[tcmods]);
+		copy_wave(mod._wave, block.tcmod_waves[tcmods]);
+		block.tcmod_funcs[tcmods] = mod._wave.func;
+		switch (mod.type)
+		{
+		case TCMOD_SCROLL:
+			source += "\tst += fract(tcmodParams[" + i + "].xy * time);\n";
+			break;
+		case TCMOD_ROTATE:
+			source += "\tst = rotateCoords(st, tcmodParams[" + i + "].x);\n";
+			break;
+		case TCMOD_SCALE:
+			source += "\tst *= tcmodParams[" + i + "].xy;\n";
+			break;
+		case TCMOD_STRETCH:
+			source += "\tst = stretchCoords(st, evalWave(tcmodFuncs[" + i + "], tcmodWaves[" + i + "], 0.0));\n";
+			break;
+		case TCMOD_TURB:
+			source += "\tst = turbCoords(st, p, tcmodWaves[" + i + "]);\n";
+			break;
+		case TCMOD_TRANSFORM:
+			source += "\tst = vec2(dot(st, tcmodParams[" + i + "].xz), dot(st, tcmodParams[" + i + "].yw)) + tcmodOffsets[" + i + "].xy;\n";
+			break;
+		}
+		tcmods++;
+	}
+
+	copy_wave(stage.rgb_wave, block.rgb_wave);
+	copy_wave(stage.alpha_wave, block.alpha_wave);
+	block.colour_funcs[0] = stage.rgb_wave.func;
+	block.colour_funcs[1] = stage.alpha_wave.func;
+	std::copy(&stage.rgb_const.x, &stage.rgb_const.x + 3, block.constant);
+	block.constant[3] = stage.alpha_const;
+
+	// there are no entities or dynamic lights here, so those come out white and vertex lit.
+	switch (stage.rgb_gen)
+	{
+	case COLOUR_VERTEX:
+	case COLOUR_LIGHTING_DIFFUSE:
+		source += "\tvec3 rgb = colour.rgb;\n";
+		break;
+	case COLOUR_ONE_MINUS_VERTEX:
+		source += "\tvec3 rgb = 1.0 - colour.rgb;\n";
+		break;
+	case COLOUR_ONE_MINUS_ENTITY:
+		source += "\tvec3 rgb = vec3(0.0);\n";
+		break;
+	case COLOUR_WAVE:
+		source += "\tvec3 rgb = vec3(clamp(evalWave(colourFuncs.x, rgbWave, 0.0), 0.0, 1.0));\n";
+		break;
+	case COLOUR_CONST:
+		source += "\tvec3 rgb = constant.rgb;\n";
+		break;
+	default:
+		source += "\tvec3 rgb = vec3(1.0);\n";
+		break;
+	}
+
+	switch (stage.alpha_gen)
+	{
+	case COLOUR_VERTEX:
+	case COLOUR_LIGHTING_DIFFUSE:
+		source += "\tfloat alpha = colour.a;\n";
+		break;
+	case COLOUR_ONE_MINUS_VERTEX:
+		source += "\tfloat alpha = 1.0 - colour.a;\n";
+		break;
+	case COLOUR_ONE_MINUS_ENTITY:
+		source += "\tfloat alpha = 0.0;\n";
+		break;
+	case COLOUR_WAVE:
+		source += "\tfloat alpha = clamp(evalWave(colourFuncs.y, alphaWave, 0.0), 0.0, 1.0);\n";
+		break;
+	case COLOUR_CONST:
+		source += "\tfloat alpha = constant.a;\n";
+		break;
+	case COLOUR_LIGHTING_SPECULAR:
+		source += "\tfloat alpha = specularAlpha(p, n);\n";
+		break;
+	case COLOUR_PORTAL:
+		source += "\tfloat alpha = clamp(distance(viewOrigin, p) / constant.a, 0.0, 1.0);\n";
+		break;
+	default:
+		source += "\tfloat alpha = 1.0;\n";
+		break;
+	}
+
+	return source;
+}
+
+MaterialEffects::MaterialEffects(const BSPLoader& loader, const packed_indices& packed, const MaterialTable& materials,
+	const std::vector<int>& texture_materials, const std::string& texture_path, ShaderCache& shaders) :
+	loader{ loader }, packed{ packed }, materials{ materials }, texture_path{ texture_path }, shaders{ shaders }
+{
+	GLint previous_texture;
+	glGetIntegerv(GL_TEXTURE_BINDING_2D, &previous_texture);
+
+	const unsigned char white[4] = { 255, 255, 255, 255 };
+	glGenTextures(1, &white_texture);
+	glBindTexture(GL_TEXTURE_2D, white_texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, white);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+	glBindTexture(GL_TEXTURE_2D, previous_texture);
+
+	// a vertex shader that reads every attribute, so none of them is optimised out of the layout.
+	std::string layout_source = std::string(effect_vertex_head) +
+		"\tvec2 st = texcoord.st + lmcoord.st;\n\tvec3 rgb = colour.rgb + n;\n\tfloat alpha = colour.a;\n" + effect_vertex_tail;
+	layout_program = shaders.request(layout_source, generate_variant(effect_fragment_source, 0));
+	std::set<int> stage_programs;
+
+	// the blocks are bound by offset, which has to be a multiple of the driver's alignment.
+	GLint alignment;
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+	GLintptr block_stride = (sizeof(stage_effects_block) + alignment - 1) / alignment * alignment;
+	std::vector<ubyte> block_data;
+
+	std::vector<int> material_effects(materials.get_count(), -1);
+	for (int i = 0; i < loader.get_textures().size(); ++i)
+	{
+		int material_index = texture_materials[i];
+		const material& _material = materials.get(material_index);
+		if (!is_animated(_material))
+		{
+			texture_effects.push_back(-1);
+			continue;
+		}
+
+		if (material_effects[material_index] < 0)
+		{
+			material_effects[material_index] = effects.size();
+			effects.push_back(effect_material());
+			effect_material& effect = effects.back();
+			effect.material = material_index;
+
+			for (const material_stage& stage : _material.stages)
+			{
+				stage_effects_block block{};
+				std::string vertex_source = effect_vertex_head + generate_effects(_material, stage, block) + effect_vertex_tail;
+
+				// the lightmap gets the same overbright the world shader gives it.
+				unsigned int features = alpha_features[stage._alpha_func] | (stage.lightmap ? SHADER_OVERBRIGHT : 0);
+
+				effect_stage _stage;
+				_stage.program = shaders.request(vertex_source, generate_variant(effect_fragment_source, features));
+				stage_programs.insert(_stage.program);
+				for (const std::string& map : stage.maps)
+					_stage.textures.push_back(load_texture(map, stage.clamp));
+				if (_stage.textures.empty())
+					_stage.textures.push_back(white_texture);
+				_stage.anim_frequency = stage.anim_frequency;
+				_stage.state = stage.state;
+				_stage.block_offset = block_data.size();
+				effect.stages.push_back(_stage);
+
+				block_data.resize(block_data.size() + block_stride);
+				memcpy(&block_data[_stage.block_offset], &block, sizeof(block));
+			}
+		}
+		texture_effects.push_back(material_effects[material_index]);
+	}
+
+	// Q3's draw order, so blended effects go over the opaque ones.
+	std::vector<int> order(effects.size());
+	for (int i = 0; i < order.size(); ++i)
+		order[i] = i;
+	std::sort(order.begin(), order.end(), [&](int a, int b)
+		{ return materials.get(effects[a].material).sort_key < materials.get(effects[b].material).sort_key; });
+
+	std::vector<effect_material> sorted;
+	std::vector<int> position(effects.size());
+	for (int i = 0; i < order.size(); ++i)
+	{
+		position[order[i]] = i;
+		sorted.push_back(effects[order[i]]);
+	}
+	effects.swap(sorted);
+	for (int& effect : texture_effects)
+	{
+		if (effect >= 0)
+			effect = position[effect];
+	}
+
+	glGenVertexArrays(1, &vao);
+	glGenBuffers(1, &block_buffer);
+	if (!block_data.empty())
+	{
+		GLint previous_buffer;
+		glGetIntegerv(GL_UNIFORM_BUFFER_BINDING, &previous_buffer);
+		glBindBuffer(GL_UNIFORM_BUFFER, block_buffer);
+		glBufferData(GL_UNIFORM_BUFFER, block_data.size(), &block_data[0], GL_STATIC_DRAW);
+		glBindBuffer(GL_UNIFORM_BUFFER, previous_buffer);
+	}
+
+	stats.materials = effects.size();
+	stats.programs = stage_programs.size();
+}
+
+MaterialEffects::~MaterialEffects()
+{
+	for (const auto& texture : textures)
+	{
+		if (texture.second != white_texture && texture.second != loader.get_lm_id())
+			glDeleteTextures(1, &texture.second);
+	}
+	glDeleteTextures(1, &white_texture);
+	glDeleteVertexArrays(1, &vao);
+	glDeleteBuffers(1, &block_buffer);
+}
+
+GLuint MaterialEffects::load_texture(const std::string& name, bool clamp)
+{
+	std::string lower = name;
+	std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+	if (lower == "$lightmap")
+		return loader.get_lm_id();
+	if (lower == "$whiteimage" || lower == "*white")
+		return white_texture;
+
+	// the same image can be used clamped in one stage and repeating in another.
+	std::string key = clamp ? name + " (clamped)" : name;
+	auto found = textures.find(key);
+	if (found != textures.end())
+		return found->second;
+
+	// scripts often name a .tga that only ships as a .jpg, Q3 tries both.
+	std::string stem = name.substr(0, name.find_last_of('.'));
+	std::string paths[] = { texture_path + name, texture_path + stem + ".tga", texture_path + stem + ".jpg" };
+	int width, height, channels;
+	unsigned char* data = nullptr;
+	for (const std::string& path : paths)
+	{
+		data = stbi_load(path.c_str(), &width, &height, &channels, 4);
+		if (data)
+			break;
+	}
+
+	if (!data)
+	{
+		stats.textures_missing++;
+		textures[key] = white_texture;
+		return white_texture;
+	}
+
+	GLint previous_texture;
+	glGetIntegerv(GL_TEXTURE_BINDING_2D, &previous_texture);
+
+	GLuint texture;
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
+	glGenerateMipmap(GL_TEXTURE_2D);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, clamp ? GL_CLAMP_TO_EDGE : GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, clamp ? GL_CLAMP_TO_EDGE : GL_REPEAT);
+	stbi_image_free(data);
+
+	glBindTexture(GL_TEXTURE_2D, previous_texture);
+
+	stats.textures_loaded++;
+	textures[key] = texture;
+	return texture;
+}
+
+void MaterialEffects::set_vertices(const packed_vertices& vertices, GLuint vbo, GLuint ebo)
+{
+	GLuint program = shaders.get(layout_program);
+	if (!program)
+		return;
+
+	GLint previous_program, previous_vao, previous_buffer;
+	glGetIntegerv(GL_CURRENT_PROGRAM, &previous_program);
+	glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &previous_vao);
+	glGetIntegerv(GL_ARRAY_BUFFER_BINDING, &previous_buffer);
+
+	glBindVertexArray(vao);
+	glBindBuffer(GL_ARRAY_BUFFER, vbo);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+	glUseProgram(program);
+	apply_vertex_format(vertices, program);
+
+	glBindVertexArray(previous_vao);
+	glBindBuffer(GL_ARRAY_BUFFER, previous_buffer);
+	glUseProgram(previous_program);
+
+	position_offset = vertices.position_offset;
+	position_scale = vertices.position_scale;
+	octahedral_normals = vertices.format != VERTEX_FULL;
+}
+
+void MaterialEffects::build(const glm::vec3& position, const std::vector<int>& faces, int version)
+{
+	if (version == built_version && position == built_position)
+		return;
+
+	built_version = version;
+	built_position = position;
+
+	static_faces.clear();
+	for (effect_material& effect : effects)
+		effect.faces.clear();
+	for (int face_index : faces)
+	{
+		int effect = texture_effects[loader.get_face(face_index).texture];
+		if (effect < 0)
+			static_faces.push_back(face_index);
+		else
+			effects[effect].faces.push_back(face_index);
+	}
+
+	stats.faces = 0;
+	stats.stage_draws = 0;
+	for (effect_material& effect : effects)
+	{
+		effect.draws = build_multi_draws(packed, effect.faces);
+		stats.faces += effect.faces.size();
+		stats.stage_draws += effect.stages.size() * effect.draws.size();
+	}
+}
+
+void MaterialEffects::draw(const glm::mat4& clip, const glm::vec3& position, float time)
+{
+	if (stats.faces == 0)
+		return;
+
+	GLint previous_program, previous_vao, previous_texture, depth_func, cull_face, blend_src, blend_dst;
+	glGetIntegerv(GL_CURRENT_PROGRAM, &previous_program);
+	glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &previous_vao);
+	glGetIntegerv(GL_TEXTURE_BINDING_2D, &previous_texture);
+	glGetIntegerv(GL_DEPTH_FUNC, &depth_func);
+	glGetIntegerv(GL_CULL_FACE_MODE, &cull_face);
+	glGetIntegerv(GL_BLEND_SRC_RGB, &blend_src);
+	glGetIntegerv(GL_BLEND_DST_RGB, &blend_dst);
+	GLboolean depth_mask;
+	glGetBooleanv(GL_DEPTH_WRITEMASK, &depth_mask);
+	GLboolean blend_enabled = glIsEnabled(GL_BLEND);
+	GLboolean cull_enabled = glIsEnabled(GL_CULL_FACE);
+	GLfloat offset_factor, offset_units;
+	glGetFloatv(GL_POLYGON_OFFSET_FACTOR, &offset_factor);
+	glGetFloatv(GL_POLYGON_OFFSET_UNITS, &offset_units);
+	GLboolean offset_enabled = glIsEnabled(GL_POLYGON_OFFSET_FILL);
+
+	glBindVertexArray(vao);
+	for (const effect_material& effect : effects)
+	{
+		if (effect.draws.empty())
+			continue;
+
+		// Q3's cull front keeps the side facing the camera, which GL calls culling the back.
+		const material& _material = materials.get(effect.material);
+		if (_material.cull == CULL_NONE)
+			glDisable(GL_CULL_FACE);
+		else
+		{
+			glEnable(GL_CULL_FACE);
+			glCullFace(_material.cull == CULL_FRONT ? GL_BACK : GL_FRONT);
+		}
+		if (_material.polygon_offset)
+		{
+			glEnable(GL_POLYGON_OFFSET_FILL);
+			glPolygonOffset(-1.0f, -2.0f);
+		}
+		else
+			glDisable(GL_POLYGON_OFFSET_FILL);
+
+		for (const effect_stage& stage : effect.stages)
+		{
+			// still compiling, or broken.
+			GLuint program = shaders.get(stage.program, false);
+			if (!program)
+				continue;
+
+			// a program linked from a cached binary starts with its blocks unbound.
+			glUseProgram(program);
+			glUniformBlockBinding(program, glGetUniformBlockIndex(program, "StageEffects"), EFFECTS_BLOCK_BINDING);
+			glUniformMatrix4fv(glGetUniformLocation(program, "clip"), 1, GL_FALSE, &clip[0][0]);
+			glUniform1f(glGetUniformLocation(program, "time"), time);
+			glUniform3fv(glGetUniformLocation(program, "viewOrigin"), 1, &position.x);
+			glUniform3fv(glGetUniformLocation(program, "positionOffset"), 1, &position_offset.x);
+			glUniform3fv(glGetUniformLocation(program, "positionScale"), 1, &position_scale.x);
+			glUniform1i(glGetUniformLocation(program, "octahedralNormals"), octahedral_normals);
+			glUniform1i(glGetUniformLocation(program, "stageTexture"), 0);
+			glBindBufferRange(GL_UNIFORM_BUFFER, EFFECTS_BLOCK_BINDING, block_buffer, stage.block_offset, sizeof(stage_effects_block));
+
+			int frame = (int)(time * stage.anim_frequency) % stage.textures.size();
+			glBindTexture(GL_TEXTURE_2D, stage.textures[frame]);
+
+			GLenum src, dst;
+			if (stage_blend(stage.state, src, dst))
+			{
+				glEnable(GL_BLEND);
+				glBlendFunc(src, dst);
+			}
+			else
+				glDisable(GL_BLEND);
+			glDepthMask(stage.state & STATE_DEPTH_WRITE ? GL_TRUE : GL_FALSE);
+			glDepthFunc(stage.state & STATE_DEPTH_EQUAL ? GL_EQUAL : GL_LEQUAL);
+
+			for (const multi_draw& draw : effect.draws)
+			{
+				glMultiDrawElementsBaseVertex(GL_TRIANGLES, &draw.counts[0], draw.type, &draw.offsets[0],
+					draw.counts.size(), &draw.base_vertices[0]);
+			}
+		}
+	}
+
+	glBindVertexArray(previous_vao);
+	glUseProgram(previous_program);
+	glBindTexture(GL_TEXTURE_2D, previous_texture);
+	glDepthFunc(depth_func);
+	glDepthMask(depth_mask);
+	glCullFace(cull_face);
+	glBlendFunc(blend_src, blend_dst);
+	if (blend_enabled)
+		glEnable(GL_BLEND);
+	else
+		glDisable(GL_BLEND);
+	if (cull_enabled)
+		glEnable(GL_CULL_FACE);
+	else
+		glDisable(GL_CULL_FACE);
+	glPolygonOffset(offset_factor, offset_units);
+	if (offset_enabled)
+		glEnable(GL_POLYGON_OFFSET_FILL);
+	else
+		glDisable(GL_POLYGON_OFFSET_FILL);
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+#include "IndexPacking.h"
+#include "Materials.h"
+#include "ShaderCache.h"
+#include "VertexFormat.h"
+
+#include <map>
+
+// Q3 allows 3 deforms and 4 tcMods. both get 4 vec4 slots in the stage block below so their
+// function lists each fill one ivec4, a script with a 4th deform has it drawn rather than dropped.
+const int MAX_EFFECT_DEFORMS = 4;
+const int MAX_EFFECT_TCMODS = 4;
+
+// one stage's parameters as the generated vertex shaders read them, the std140 layout of their
+// StageEffects uniform block. every member is a multiple of 16 bytes so it lines up without padding.
+struct stage_effects_block
+{
+	float deform_params[MAX_EFFECT_DEFORMS][4];	// wave: spread. bulge: width, height, speed. move: x, y, z. normal: amplitude, frequency
+	float deform_waves[MAX_EFFECT_DEFORMS][4];	// base, amplitude, phase, frequency
+	GLint deform_funcs[4];
+	float tcmod_params[MAX_EFFECT_TCMODS][4];	// scroll: s, t. rotate: degrees. scale: s, t. transform: m00, m01, m10, m11
+	float tcmod_offsets[MAX_EFFECT_TCMODS][4];	// transform: t0, t1
+	float tcmod_waves[MAX_EFFECT_TCMODS][4];
+	GLint tcmod_funcs[4];
+	float tcgen_vectors[2][4];
+	float rgb_wave[4];
+	float alpha_wave[4];
+	float constant[4];		// rgbGen const, then alphaGen const or the portal range
+	GLint colour_funcs[4];	// rgb wave, alpha wave
+};
+
+struct effects_stats
+{
+	int materials;			// animated materials used by the map
+	int programs;			// generated variants, shared by stages with the same effects and alpha test
+	int textures_loaded;
+	int textures_missing;	// drawn white
+	int faces;				// animated faces in the set this frame
+	int stage_draws;
+};
+
+// draws the faces whose material moves - deformVertexes, tcMod, animMap, rgbGen/alphaGen wave or
+// a generated tcGen - with their shader script stages. each stage gets a vertex shader generated
+// for its exact list of effects and a fragment variant for its alpha test, so there's no branching
+// on effect types on the GPU, and the parameters live in one uniform buffer uploaded at load. a frame only sets the time, so animated
+// surfaces cost the CPU nothing per vertex and the vertex buffer is never touched again.
+// the stage textures are loaded with stb_image from the texture directory, .tga or .jpg like Q3.
+// autosprite deforms need the quad each vertex belongs to and are drawn unmoved. wave and bulge
+// move vertices along their normals, so those only show with normals in the vertex format.
+class MaterialEffects
+{
+public:
+	// texture_path is where the textures/ and models/ directories are, with its trailing separator.
+	// every stage's program is requested from shaders here, a stage is drawn once it's ready.
+	MaterialEffects(const BSPLoader& loader, const packed_indices& packed, const MaterialTable& materials,
+		const std::vector<int>& texture_materials, const std::string& texture_path, ShaderCache& shaders);
+	~MaterialEffects();
+
+	// the effects draw from their own vertex array over the same buffers, call this whenever the
+	// vertex buffer is filled.
+	void set_vertices(const packed_vertices& vertices, GLuint vbo, GLuint ebo);
+
+	// takes the animated faces out of faces, grouped by material. does nothing if neither position
+	// nor version changed since the last call.
+	void build(const glm::vec3& position, const std::vector<int>& faces, int version);
+	void invalidate() { built_version = -1; }
+
+	// the given faces less the animated ones, same order.
+	const std::vector<int>& get_static_faces() const { return static_faces; }
+	// whether the faces of this BSP texture are animated and drawn here, water and lava included
+	// though the loader marks them as not rendered.
+	bool animates(int texture) const { return texture_effects[texture] >= 0; }
+
+	// materials in sort key order, a pass per stage. clip is proj * view * model, position the
+	// camera in BSP space and time in seconds. leaves the GL state as it found it.
+	void draw(const glm::mat4& clip, const glm::vec3& position, float time);
+
+	const effects_stats& get_stats() const { return stats; }
+private:
+	struct effect_stage
+	{
+		int program;					// handle in the shader cache
+		std::vector<GLuint> textures;	// animMap frames
+		float anim_frequency;
+		unsigned int state;
+		GLintptr block_offset;
+	};
+
+	struct effect_material
+	{
+		int material;
+		std::vector<effect_stage> stages;
+		std::vector<int> faces;
+		std::vector<multi_draw> draws;
+	};
+
+	GLuint load_texture(const std::string& name, bool clamp);
+
+	const BSPLoader& loader;
+	const packed_indices& packed;
+	const MaterialTable& materials;
+	std::string texture_path;
+	ShaderCache& shaders;
+
+	std::vector<int> texture_effects;		// per BSP texture, -1 if it isn't animated
+	std::vector<effect_material> effects;	// in sort key order
+
+	std::map<std::string, GLuint> textures;	// by name as written in the script, clamped ones apart
+	int layout_program;						// reads every attribute, to lay the vertex array out with
+	GLuint white_texture;
+
+	GLuint vao;
+	GLuint block_buffer;
+	// the vertex format's decode uniforms, set on each program as it's used.
+	glm::vec3 position_offset{ 0.0f };
+	glm::vec3 position_scale{ 1.0f };
+	bool octahedral_normals = false;
+
+	std::vector<int> static_faces;
+	glm::vec3 built_position;
+	int built_version = -1;
+
+	effects_stats stats{};
+};
@@ -0,0 +1,651 @@
+#include "Materials.h"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+
+const GLenum blend_factors[11] = {
+	GL_ZERO, GL_ONE, GL_SRC_COLOR, GL_ONE_MINUS_SRC_COLOR, GL_DST_COLOR, GL_ONE_MINUS_DST_COLOR,
+	GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_DST_ALPHA, GL_ONE_MINUS_DST_ALPHA, GL_SRC_ALPHA_SATURATE
+};
+static const char* blend_names[11] = {
+	"gl_zero", "gl_one", "gl_src_color", "gl_one_minus_src_color", "gl_dst_color", "gl_one_minus_dst_color",
+	"gl_src_alpha", "gl_one_minus_src_alpha", "gl_dst_alpha", "gl_one_minus_dst_alpha", "gl_src_alpha_saturate"
+};
+
+struct surface_parm
+{
+	const char* name;
+	int surface_flags;
+	int contents;
+};
+
+static const surface_parm surface_parms[] = {
+	{ "nodraw", SURF_NODRAW, 0 }, { "nolightmap", SURF_NOLIGHTMAP, 0 }, { "nonsolid", SURF_NONSOLID, 0 },
+	{ "sky", SURF_SKY, 0 }, { "slick", SURF_SLICK, 0 }, { "noimpact", SURF_NOIMPACT, 0 },
+	{ "nomarks", SURF_NOMARKS, 0 }, { "ladder", SURF_LADDER, 0 }, { "nodamage", SURF_NODAMAGE, 0 },
+	{ "metalsteps", SURF_METALSTEPS, 0 }, { "flesh", SURF_FLESH, 0 }, { "nosteps", SURF_NOSTEPS, 0 },
+	{ "pointlight", SURF_POINTLIGHT, 0 }, { "hint", SURF_HINT, 0 }, { "skip", SURF_SKIP, 0 },
+	{ "trans", 0, CONTENTS_TRANSLUCENT }, { "water", 0, CONTENTS_WATER }, { "slime", 0, CONTENTS_SLIME },
+	{ "lava", 0, CONTENTS_LAVA }, { "fog", 0, CONTENTS_FOG }, { "playerclip", 0, CONTENTS_PLAYERCLIP },
+	{ "monsterclip", 0, CONTENTS_MONSTERCLIP }, { "botclip", 0, CONTENTS_BOTCLIP },
+	{ "areaportal", 0, CONTENTS_AREAPORTAL }, { "clusterportal", 0, CONTENTS_CLUSTERPORTAL },
+	{ "donotenter", 0, CONTENTS_DONOTENTER }, { "origin", 0, CONTENTS_ORIGIN }, { "detail", 0, CONTENTS_DETAIL },
+	{ "structural", 0, CONTENTS_STRUCTURAL }, { "nodrop", 0, CONTENTS_NODROP }
+};
+
+static std::string to_lower(std::string text)
+{
+	for (char& c : text)
+		c = (char)tolower((unsigned char)c);
+	return text;
+}
+
+// lower case, forward slashes and no extension, the way Q3 hashes shader names.
+static std::string material_key(const std::string& name)
+{
+	std::string key = to_lower(name);
+	std::replace(key.begin(), key.end(), '\\', '/');
+	size_t dot = key.rfind('.');
+	if (dot != std::string::npos && key.find('/', dot) == std::string::npos)
+		key.resize(dot);
+	return key;
+}
+
+// splits script text into whitespace separated tokens and quoted strings, with // and /* */
+// comments skipped. parameters belong to the line their keyword is on, so tokens can be asked for without
+// crossing a line break.
+struct script_parser
+{
+	const char* p;
+	const char* end;
+
+	// empty at the end of the text, or of the line when cross_lines is false.
+	std::string next(bool cross_lines = true)
+	{
+		while (p < end)
+		{
+			if (*p == '\n')
+			{
+				if (!cross_lines)
+					return std::string();
+				++p;
+			}
+			else if (*p == ' ' || *p == '\t' || *p == '\r')
+				++p;
+			else if (p + 1 < end && p[0] == '/' && p[1] == '/')
+			{
+				while (p < end && *p != '\n')
+					++p;
+			}
+			else if (p + 1 < end && p[0] == '/' && p[1] == '*')
+			{
+				p += 2;
+				while (p + 1 < end && !(p[0] == '*' && p[1] == '/'))
+					++p;
+				p = std::min(p + 2, end);
+			}
+			else
+				break;
+		}
+		if (p >= end)
+			return std::string();
+
+		const char* start = p;
+		if (*p == '"')
+		{
+			++start;
+			++p;
+			while (p < end && *p != '"' && *p != '\n')
+				++p;
+			std::string token{ start, p };
+			if (p < end && *p == '"')
+				++p;
+			return token;
+		}
+		// like Q3, only whitespace ends a word, braces have to stand on their own.
+		while (p < end && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n')
+			++p;
+		return std::string{ start, p };
+	}
+
+	float next_float() { return (float)atof(next(false).c_str()); }
+
+	void skip_line()
+	{
+		while (!next(false).empty())
+			;
+	}
+
+	// the opening brace has been read already.
+	void skip_block()
+	{
+		int depth = 1;
+		while (depth > 0 && p < end)
+		{
+			std::string token = next();
+			if (token == "{")
+				depth++;
+			else if (token == "}")
+				depth--;
+		}
+	}
+};
+
+static wave_func parse_wave_func(const std::string& name)
+{
+	std::string func = to_lower(name);
+	if (func == "triangle")
+		return WAVE_TRIANGLE;
+	if (func == "square")
+		return WAVE_SQUARE;
+	if (func == "sawtooth")
+		return WAVE_SAWTOOTH;
+	if (func == "inversesawtooth")
+		return WAVE_INVERSE_SAWTOOTH;
+	if (func == "noise")
+		return WAVE_NOISE;
+	return WAVE_SIN;
+}
+
+static wave parse_wave(script_parser& parser)
+{
+	wave _wave;
+	_wave.func = parse_wave_func(parser.next(false));
+	_wave.base = parser.next_float();
+	_wave.amplitude = parser.next_float();
+	_wave.phase = parser.next_float();
+	_wave.frequency = parser.next_float();
+	return _wave;
+}
+
+// ( a b c ), as used by rgbGen const and tcGen vector.
+static glm::vec3 parse_vector(script_parser& parser)
+{
+	glm::vec3 v(0.0f);
+	if (parser.next(false) != "(")
+		return v;
+	for (int i = 0; i < 3; ++i)
+		v[i] = parser.next_float();
+	parser.next(false);
+	return v;
+}
+
+static GLenum parse_blend_factor(const std::string& name, GLenum fallback)
+{
+	std::string factor = to_lower(name);
+	for (int i = 0; i < 11; ++i)
+	{
+		if (factor == blend_names[i])
+			return blend_factors[i];
+	}
+	return fallback;
+}
+
+// alphaGen const takes one number rather than a vector, it goes in constant.x.
+static colour_gen parse_colour_gen(script_parser& parser, wave& _wave, glm::vec3& constant, bool alpha)
+{
+	std::string gen = to_lower(parser.next(false));
+	if (gen == "identitylighting")
+		return COLOUR_IDENTITY_LIGHTING;
+	if (gen == "vertex" || gen == "exactvertex")
+		return COLOUR_VERTEX;
+	if (gen == "oneminusvertex")
+		return COLOUR_ONE_MINUS_VERTEX;
+	if (gen == "lightingdiffuse")
+		return COLOUR_LIGHTING_DIFFUSE;
+	if (gen == "lightingspecular")
+		return COLOUR_LIGHTING_SPECULAR;
+	if (gen == "entity")
+		return COLOUR_ENTITY;
+	if (gen == "oneminusentity")
+		return COLOUR_ONE_MINUS_ENTITY;
+	if (gen == "portal")
+	{
+		constant.x = parser.next_float();
+		return COLOUR_PORTAL;
+	}
+	if (gen == "wave")
+	{
+		_wave = parse_wave(parser);
+		return COLOUR_WAVE;
+	}
+	if (gen == "const" || gen == "constant")
+	{
+		if (alpha)
+			constant.x = parser.next_float();
+		else
+			constant = parse_vector(parser);
+		return COLOUR_CONST;
+	}
+	return COLOUR_IDENTITY;
+}
+
+static void parse_stage(script_parser& parser, material_stage& stage)
+{
+	for (std::string token = parser.next(); !token.empty() && token != "}"; token = parser.next())
+	{
+		std::string keyword = to_lower(token);
+		if (keyword == "map" || keyword == "clampmap")
+		{
+			std::string map = parser.next(false);
+			stage.maps.assign(1, map);
+			stage.clamp = keyword == "clampmap";
+			stage.lightmap = to_lower(map) == "$lightmap";
+			if (stage.lightmap)
+				stage.tcgen = TCGEN_LIGHTMAP;
+		}
+		else if (keyword == "animmap")
+		{
+			stage.anim_frequency = parser.next_float();
+			stage.maps.clear();
+			for (std::string map = parser.next(false); !map.empty(); map = parser.next(false))
+				stage.maps.push_back(map);
+		}
+		else if (keyword == "blendfunc")
+		{
+			std::string src = to_lower(parser.next(false));
+			if (src == "add")
+			{
+				stage.blend_src = GL_ONE;
+				stage.blend_dst = GL_ONE;
+			}
+			else if (src == "filter")
+			{
+				stage.blend_src = GL_DST_COLOR;
+				stage.blend_dst = GL_ZERO;
+			}
+			else if (src == "blend")
+			{
+				stage.blend_src = GL_SRC_ALPHA;
+				stage.blend_dst = GL_ONE_MINUS_SRC_ALPHA;
+			}
+			else
+			{
+				stage.blend_src = parse_blend_factor(src, GL_ONE);
+				stage.blend_dst = parse_blend_factor(parser.next(false), GL_ZERO);
+			}
+		}
+		else if (keyword == "rgbgen")
+			stage.rgb_gen = parse_colour_gen(parser, stage.rgb_wave, stage.rgb_const, false);
+		else if (keyword == "alphagen")
+		{
+			glm::vec3 constant(stage.alpha_const);
+			stage.alpha_gen = parse_colour_gen(parser, stage.alpha_wave, constant, true);
+			stage.alpha_const = constant.x;
+		}
+		else if (keyword == "tcgen" || keyword == "texgen")
+		{
+			std::string gen = to_lower(parser.next(false));
+			if (gen == "environment")
+				stage.tcgen = TCGEN_ENVIRONMENT;
+			else if (gen == "lightmap")
+				stage.tcgen = TCGEN_LIGHTMAP;
+			else if (gen == "vector")
+			{
+				stage.tcgen = TCGEN_VECTOR;
+				stage.tcgen_vectors[0] = parse_vector(parser);
+				stage.tcgen_vectors[1] = parse_vector(parser);
+			}
+			else
+				stage.tcgen = TCGEN_BASE;
+		}
+		else if (keyword == "tcmod")
+		{
+			tcmod mod{};
+			std::string type = to_lower(parser.next(false));
+			int params = 0;
+			if (type == "scroll")
+			{
+				mod.type = TCMOD_SCROLL;
+				params = 2;
+			}
+			else if (type == "rotate")
+			{
+				mod.type = TCMOD_ROTATE;
+				params = 1;
+			}
+			else if (type == "scale")
+			{
+				mod.type = TCMOD_SCALE;
+				params = 2;
+			}
+			else if (type == "transform")
+			{
+				mod.type = TCMOD_TRANSFORM;
+				params = 6;
+			}
+			else if (type == "stretch")
+			{
+				mod.type = TCMOD_STRETCH;
+				mod._wave = parse_wave(parser);
+			}
+			else if (type == "turb")
+			{
+				// no function name, it's always a sine.
+				mod.type = TCMOD_TURB;
+				mod._wave.func = WAVE_SIN;
+				mod._wave.base = parser.next_float();
+				mod._wave.amplitude = parser.next_float();
+				mod._wave.phase = parser.next_float();
+				mod._wave.frequency = parser.next_float();
+			}
+			else
+			{
+				// entityTranslate and anything unknown.
+				parser.skip_line();
+				continue;
+			}
+
+			for (int i = 0; i < params; ++i)
+				mod.params[i] = parser.next_float();
+			stage.tcmods.push_back(mod);
+		}
+		else if (keyword == "depthwrite")
+		{
+			stage.depth_write = true;
+			stage.depth_write_set = true;
+		}
+		else if (keyword == "depthfunc")
+			stage.depth_equal = to_lower(parser.next(false)) == "equal";
+		else if (keyword == "alphafunc")
+		{
+			std::string func = to_lower(parser.next(false));
+			stage._alpha_func = func == "gt0" ? ALPHA_GT0 : func == "lt128" ? ALPHA_LT128 : func == "ge128" ? ALPHA_GE128 : ALPHA_NONE;
+		}
+		else if (token == "{")
+			parser.skip_block();
+		else
+			parser.skip_line();
+	}
+}
+
+// false for keywords that don't matter here (qer_, q3map_ and the like), their lines are skipped.
+static bool parse_material_keyword(script_parser& parser, const std::string& keyword, material& _material)
+{
+	if (keyword == "surfaceparm")
+	{
+		std::string parm = to_lower(parser.next(false));
+		for (const surface_parm& surface : surface_parms)
+		{
+			if (parm == surface.name)
+			{
+				_material.surface_flags |= surface.surface_flags;
+				_material.contents |= surface.contents;
+			}
+		}
+		_material.fog |= parm == "fog";
+	}
+	else if (keyword == "cull")
+	{
+		std::string mode = to_lower(parser.next(false));
+		if (mode == "none" || mode == "twosided" || mode == "disable")
+			_material.cull = CULL_NONE;
+		else if (mode == "back" || mode == "backside" || mode == "backsided")
+			_material.cull = CULL_BACK;
+		else
+			_material.cull = CULL_FRONT;
+	}
+	else if (keyword == "sort")
+	{
+		std::string sort = to_lower(parser.next(false));
+		const std::pair<const char*, float> sorts[] = {
+			{ "portal", SORT_PORTAL }, { "sky", SORT_SKY }, { "opaque", SORT_OPAQUE }, { "decal", SORT_DECAL },
+			{ "seethrough", SORT_SEE_THROUGH }, { "banner", SORT_BANNER }, { "underwater", SORT_UNDERWATER },
+			{ "additive", SORT_ADDITIVE }, { "nearest", SORT_NEAREST }
+		};
+		_material.sort = (float)atof(sort.c_str());
+		for (const std::pair<const char*, float>& named : sorts)
+		{
+			if (sort == named.first)
+				_material.sort = named.second;
+		}
+	}
+	else if (keyword == "deformvertexes")
+	{
+		deform _deform{};
+		std::string type = to_lower(parser.next(false));
+		if (type == "wave")
+		{
+			_deform.type = DEFORM_WAVE;
+			_deform.params[0] = parser.next_float();
+			_deform._wave = parse_wave(parser);
+		}
+		else if (type == "normal")
+		{
+			_deform.type = DEFORM_NORMAL;
+			_deform.params[0] = parser.next_float();
+			_deform.params[1] = parser.next_float();
+		}
+		else if (type == "bulge")
+		{
+			_deform.type = DEFORM_BULGE;
+			for (int i = 0; i < 3; ++i)
+				_deform.params[i] = parser.next_float();
+		}
+		else if (type == "move")
+		{
+			_deform.type = DEFORM_MOVE;
+			for (int i = 0; i < 3; ++i)
+				_deform.params[i] = parser.next_float();
+			_deform._wave = parse_wave(parser);
+		}
+		else if (type == "autosprite")
+			_deform.type = DEFORM_AUTOSPRITE;
+		else if (type == "autosprite2")
+			_deform.type = DEFORM_AUTOSPRITE2;
+		else
+			return false;
+		_material.deforms.push_back(_deform);
+	}
+	else if (keyword == "polygonoffset")
+		_material.polygon_offset = true;
+	else if (keyword == "skyparms")
+	{
+		_material.sky = true;
+		parser.skip_line();
+	}
+	else if (keyword == "portal")
+		_material.portal = true;
+	else if (keyword == "fogparms")
+	{
+		_material.fog = true;
+		parser.skip_line();
+	}
+	else if (keyword == "nomipmaps")
+		_material.nomipmaps = true;
+	else
+		return false;
+	return true;
+}
+
+MaterialTable::MaterialTable(const std::string& scripts_path)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+
+	std::ifstream list_file(scripts_path + "shaderlist.txt", std::ios::binary);
+	std::string list{ std::istreambuf_iterator<char>(list_file), std::istreambuf_iterator<char>() };
+	script_parser list_parser{ list.data(), list.data() + list.size() };
+	for (std::string name = list_parser.next(); !name.empty(); name = list_parser.next())
+	{
+		std::ifstream script_file(scripts_path + name + ".shader", std::ios::binary);
+		if (!script_file)
+		{
+			stats.missing_scripts++;
+			continue;
+		}
+
+		std::string script{ std::istreambuf_iterator<char>(script_file), std::istreambuf_iterator<char>() };
+		add_script(script.data(), script.size());
+		stats.scripts++;
+	}
+
+	stats.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+void MaterialTable::add_script(const char* text, size_t length)
+{
+	script_parser parser{ text, text + length };
+	for (std::string name = parser.next(); !name.empty(); name = parser.next())
+	{
+		if (parser.next() != "{")
+			break;
+
+		material _material;
+		_material.name = name;
+		_material.scripted = true;
+		for (std::string token = parser.next(); !token.empty() && token != "}"; token = parser.next())
+		{
+			if (token == "{")
+			{
+				material_stage stage;
+				parse_stage(parser, stage);
+				if (_material.stages.size() < MAX_MATERIAL_STAGES)
+					_material.stages.push_back(stage);
+				continue;
+			}
+
+			if (!parse_material_keyword(parser, to_lower(token), _material))
+				parser.skip_line();
+		}
+
+		// the first definition of a name wins.
+		std::string key = material_key(name);
+		if (names.count(key))
+		{
+			stats.duplicates++;
+			continue;
+		}
+
+		names[key] = materials.size();
+		compile(_material, materials.size());
+		materials.push_back(_material);
+		stats.materials++;
+	}
+}
+
+int MaterialTable::find(const std::string& name) const
+{
+	auto it = names.find(material_key(name));
+	return it == names.end() ? -1 : it->second;
+}
+
+std::vector<int> MaterialTable::resolve_textures(const BSPLoader& loader)
+{
+	std::vector<int> texture_materials;
+	stats.textures_scripted = 0;
+	for (const texture& _texture : loader.get_textures())
+	{
+		int index = find(_texture.name);
+		if (index >= 0 && materials[index].scripted)
+			stats.textures_scripted++;
+		if (index < 0)
+			index = add_default(_texture.name);
+		texture_materials.push_back(index);
+	}
+	return texture_materials;
+}
+
+int MaterialTable::count_states(const std::vector<int>& indices) const
+{
+	std::vector<unsigned long long> keys;
+	for (int index : indices)
+		keys.push_back(materials[index].sort_key >> 16);
+	std::sort(keys.begin(), keys.end());
+	return std::unique(keys.begin(), keys.end()) - keys.begin();
+}
+
+int MaterialTable::add_default(const std::string& name)
+{
+	// the lightmap, then the texture multiplied over it.
+	material _material;
+	_material.name = name;
+
+	material_stage lightmap;
+	lightmap.maps.assign(1, "$lightmap");
+	lightmap.lightmap = true;
+	lightmap.tcgen = TCGEN_LIGHTMAP;
+	_material.stages.push_back(lightmap);
+
+	material_stage diffuse;
+	diffuse.maps.assign(1, name);
+	diffuse.blend_src = GL_DST_COLOR;
+	diffuse.blend_dst = GL_ZERO;
+	_material.stages.push_back(diffuse);
+
+	int index = materials.size();
+	names[material_key(name)] = index;
+	compile(_material, index);
+	materials.push_back(_material);
+	return index;
+}
+
+static unsigned int blend_index(GLenum factor)
+{
+	for (unsigned int i = 0; i < 11; ++i)
+	{
+		if (blend_factors[i] == factor)
+			return i + 1;
+	}
+	return 0;
+}
+
+void MaterialTable::compile(material& _material, int index)
+{
+	for (material_stage& stage : _material.stages)
+	{
+		bool blends = !(stage.blend_src == GL_ONE && stage.blend_dst == GL_ZERO);
+		// a blended stage doesn't write depth unless it asks to.
+		if (blends && !stage.depth_write_set)
+			stage.depth_write = false;
+
+		stage.state = 0;
+		if (blends)
+			stage.state |= blend_index(stage.blend_src) << STATE_SRC_SHIFT | blend_index(stage.blend_dst) << STATE_DST_SHIFT;
+		if (stage.depth_write)
+			stage.state |= STATE_DEPTH_WRITE;
+		if (stage.depth_equal)
+			stage.state |= STATE_DEPTH_EQUAL;
+		if (stage.lightmap)
+			stage.state |= STATE_LIGHTMAP;
+		if (_material.polygon_offset)
+			stage.state |= STATE_POLYGON_OFFSET;
+		stage.state |= (unsigned int)stage._alpha_func << STATE_ALPHA_SHIFT;
+		stage.state |= (unsigned int)_material.cull << STATE_CULL_SHIFT;
+	}
+
+	unsigned int first_state = _material.stages.empty() ? 0 : _material.stages[0].state;
+	_material.blended = (first_state & STATE_BLEND_MASK) != 0;
+
+	// the same defaults Q3 picks when a script has no sort of its own.
+	if (_material.sort == 0.0f)
+	{
+		if (_material.portal)
+			_material.sort = SORT_PORTAL;
+		else if (_material.sky)
+			_material.sort = SORT_SKY;
+		else if (_material.polygon_offset)
+			_material.sort = SORT_DECAL;
+		else if (_material.blended)
+			_material.sort = first_state & STATE_DEPTH_WRITE ? SORT_SEE_THROUGH : SORT_ADDITIVE;
+		else
+			_material.sort = SORT_OPAQUE;
+	}
+
+	unsigned long long sort = std::min((unsigned long long)(_material.sort * 16.0f), 0xffffULL);
+	_material.sort_key = sort << 48 | (unsigned long long)first_state << 16 | (unsigned long long)(index & 0xffff);
+}
+
+bool stage_blend(unsigned int state, GLenum& src, GLenum& dst)
+{
+	unsigned int src_index = (state >> STATE_SRC_SHIFT) & 0xf;
+	unsigned int dst_index = (state >> STATE_DST_SHIFT) & 0xf;
+	if (src_index == 0 || dst_index == 0)
+		return false;
+
+	src = blend_factors[src_index - 1];
+	dst = blend_factors[dst_index - 1];
+	return true;
+}
@@ -0,0 +1,228 @@
+#pragma once
+
+#include "BSPLoader.h"
+
+#include <unordered_map>
+
+// Q3 keeps no more than this many stages in a shader, extra ones are ignored.
+const int MAX_MATERIAL_STAGES = 8;
+
+// named sort values from the Q3 shader manual, lower draws first.
+const float SORT_PORTAL = 1.0f;
+const float SORT_SKY = 2.0f;
+const float SORT_OPAQUE = 3.0f;
+const float SORT_DECAL = 4.0f;
+const float SORT_SEE_THROUGH = 5.0f;
+const float SORT_BANNER = 6.0f;
+const float SORT_UNDERWATER = 8.0f;
+const float SORT_ADDITIVE = 9.0f;
+const float SORT_NEAREST = 16.0f;
+
+// a stage's fixed function state packed into 32 bits, so stages and materials compare and sort as
+// plain integers. blend factors are stored as their index in blend_factors[] plus one, both 0 for
+// no blending.
+const unsigned int STATE_SRC_SHIFT = 0;
+const unsigned int STATE_DST_SHIFT = 4;
+const unsigned int STATE_BLEND_MASK = 0xff;
+const unsigned int STATE_DEPTH_WRITE = 1 << 8;
+const unsigned int STATE_DEPTH_EQUAL = 1 << 9;
+const unsigned int STATE_ALPHA_SHIFT = 10;	// 2 bits of alpha_func
+const unsigned int STATE_CULL_SHIFT = 12;	// 2 bits of cull_mode
+const unsigned int STATE_POLYGON_OFFSET = 1 << 14;
+const unsigned int STATE_LIGHTMAP = 1 << 15;
+
+extern const GLenum blend_factors[11];
+
+enum wave_func
+{
+	WAVE_SIN,
+	WAVE_TRIANGLE,
+	WAVE_SQUARE,
+	WAVE_SAWTOOTH,
+	WAVE_INVERSE_SAWTOOTH,
+	WAVE_NOISE
+};
+
+struct wave
+{
+	wave_func func;
+	float base;
+	float amplitude;
+	float phase;
+	float frequency;
+};
+
+enum tcmod_type
+{
+	TCMOD_SCROLL,		// params: s, t speed
+	TCMOD_ROTATE,		// params: degrees per second
+	TCMOD_SCALE,		// params: s, t
+	TCMOD_STRETCH,		// the wave scales around the texture's centre
+	TCMOD_TURB,			// the wave's base is ignored, amplitude and frequency ripple the coords
+	TCMOD_TRANSFORM		// params: m00 m01 m10 m11 t0 t1
+};
+
+struct tcmod
+{
+	tcmod_type type;
+	float params[6];
+	wave _wave;
+};
+
+enum deform_type
+{
+	DEFORM_WAVE,		// params: spread. along the normal by the wave, phase offset by position
+	DEFORM_NORMAL,		// params: amplitude, frequency. wobbles the normals only
+	DEFORM_BULGE,		// params: width, height, speed
+	DEFORM_MOVE,		// params: x, y, z moved by the wave
+	DEFORM_AUTOSPRITE,
+	DEFORM_AUTOSPRITE2
+};
+
+struct deform
+{
+	deform_type type;
+	float params[3];
+	wave _wave;
+};
+
+enum colour_gen
+{
+	COLOUR_IDENTITY,
+	COLOUR_IDENTITY_LIGHTING,
+	COLOUR_VERTEX,
+	COLOUR_ONE_MINUS_VERTEX,
+	COLOUR_LIGHTING_DIFFUSE,
+	COLOUR_ENTITY,
+	COLOUR_ONE_MINUS_ENTITY,
+	COLOUR_WAVE,
+	COLOUR_CONST,
+	COLOUR_LIGHTING_SPECULAR,	// alpha only
+	COLOUR_PORTAL				// alpha only
+};
+
+enum tcgen_type
+{
+	TCGEN_BASE,
+	TCGEN_LIGHTMAP,
+	TCGEN_ENVIRONMENT,
+	TCGEN_VECTOR
+};
+
+enum alpha_func
+{
+	ALPHA_NONE,
+	ALPHA_GT0,
+	ALPHA_LT128,
+	ALPHA_GE128
+};
+
+enum cull_mode
+{
+	CULL_FRONT,		// Q3's default, the side facing the camera is drawn
+	CULL_BACK,
+	CULL_NONE
+};
+
+struct material_stage
+{
+	std::vector<std::string> maps;	// more than one for animMap, "$lightmap" or "$whiteimage" for the built in ones
+	float anim_frequency = 0.0f;
+	bool clamp = false;
+	bool lightmap = false;
+
+	GLenum blend_src = GL_ONE;
+	GLenum blend_dst = GL_ZERO;
+	bool depth_write = true;
+	bool depth_write_set = false;
+	bool depth_equal = false;
+	alpha_func _alpha_func = ALPHA_NONE;
+
+	colour_gen rgb_gen = COLOUR_IDENTITY;
+	colour_gen alpha_gen = COLOUR_IDENTITY;
+	wave rgb_wave{};
+	wave alpha_wave{};
+	glm::vec3 rgb_const{ 1.0f };
+	float alpha_const = 1.0f;		// alphaGen const, or alphaGen portal's range
+
+	tcgen_type tcgen = TCGEN_BASE;
+	glm::vec3 tcgen_vectors[2];
+	std::vector<tcmod> tcmods;
+
+	unsigned int state = 0;	// compiled
+};
+
+struct material
+{
+	std::string name;
+	bool scripted = false;	// false for the default made up for a texture without a script
+
+	int surface_flags = 0;	// SURF_ and CONTENTS_ bits from surfaceparm, as q3map would write them
+	int contents = 0;
+	cull_mode cull = CULL_FRONT;
+	float sort = 0.0f;		// 0 until compiled, unless the script sets it
+	bool polygon_offset = false;
+	bool sky = false;
+	bool portal = false;
+	bool fog = false;
+	bool nomipmaps = false;
+
+	std::vector<deform> deforms;
+	std::vector<material_stage> stages;
+
+	// compiled: the sort value, then the first stage's state, then the material itself, so sorting
+	// by key draws in Q3's order with materials that share state next to each other.
+	unsigned long long sort_key = 0;
+	bool blended = false;	// the first stage blends, the material doesn't hide what's behind it
+};
+
+struct material_stats
+{
+	int scripts;
+	int missing_scripts;	// listed in shaderlist.txt but not found
+	int materials;
+	int duplicates;			// later definitions of a name, ignored like Q3 does
+	int textures_scripted;	// BSP textures that have a script
+	double milliseconds;
+};
+
+// the shader scripts (scripts\*.shader) parsed once into a table of materials, keyed by name with
+// a hash so a lookup doesn't depend on how many there are. every material is compiled after it's
+// parsed: each stage's blend, depth, alpha test and cull state is packed into one integer, and
+// the material gets a 64 bit sort key so drawing in key order groups the same state together.
+// textures without a script get the default Q3 would give them, the texture modulated by the
+// lightmap.
+class MaterialTable
+{
+public:
+	// scripts_path is the scripts directory with its trailing separator. only the files named in
+	// its shaderlist.txt are read, like Q3 does.
+	MaterialTable(const std::string& scripts_path);
+
+	// parses the text of one .shader file into the table.
+	void add_script(const char* text, size_t length);
+
+	// -1 if there's no material of that name. names are matched without case or extension.
+	int find(const std::string& name) const;
+	const material& get(int index) const { return materials[index]; }
+	int get_count() const { return materials.size(); }
+
+	// one material per BSP texture, defaults added for textures without a script.
+	std::vector<int> resolve_textures(const BSPLoader& loader);
+	// how many different sort values and first stage states the given materials have, the state
+	// changes a frame drawing all of them in key order needs at most.
+	int count_states(const std::vector<int>& indices) const;
+
+	const material_stats& get_stats() const { return stats; }
+private:
+	void compile(material& _material, int index);
+	int add_default(const std::string& name);
+
+	std::vector<material> materials;
+	std::unordered_map<std::string, int> names;
+
+	material_stats stats{};
+};
+
+// the blend state of a compiled stage, false if it doesn't blend.
+bool stage_blend(unsigned int state, GLenum& src, GLenum& dst);
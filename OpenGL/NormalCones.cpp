@@ -0,0 +1,229 @@
+#include "NormalCones.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+// the cone's axis is the normalized sum of its triangle normals, the half angle the widest of them.
+static bool fits_cone(const std::vector<glm::vec3>& normals, const glm::vec3& sum, float min_dot)
+{
+	if (glm::length(sum) < 1e-6f)
+		return false;
+
+	glm::vec3 axis = glm::normalize(sum);
+	for (const glm::vec3& normal : normals)
+	{
+		if (glm::dot(axis, normal) < min_dot)
+			return false;
+	}
+	return true;
+}
+
+NormalCones::NormalCones(const BSPLoader& loader, const render_mesh& mesh, const MaterialTable& materials,
+	const std::vector<int>& texture_materials)
+{
+	const std::vector<face>& faces = loader.get_faces();
+	const std::vector<leaf>& leafs = loader.get_leafs();
+	const std::vector<leafface>& leaffaces = loader.get_leaffaces();
+
+	// unit normals of each face's triangles, degenerate ones left out. front faces wind clockwise.
+	std::vector<std::vector<glm::vec3>> normals(mesh.ranges.size());
+	std::vector<std::vector<glm::vec3>> points(mesh.ranges.size());
+	std::vector<glm::vec3> face_sums(mesh.ranges.size(), glm::vec3(0.0f));
+	face_triangles.resize(mesh.ranges.size(), 0);
+	for (int i = 0; i < mesh.ranges.size(); ++i)
+	{
+		const face_range& range = mesh.ranges[i];
+		face_triangles[i] = range.n_indices / 3;
+		for (unsigned int j = 0; j < range.n_indices; ++j)
+		{
+			const vertex& v = mesh.vertices[mesh.indices[range.first_index + j] + range.base_vertex];
+			points[i].push_back(glm::vec3(v.position[0], v.position[1], v.position[2]));
+		}
+		for (int j = 0; j + 2 < points[i].size(); j += 3)
+		{
+			glm::vec3 normal = glm::cross(points[i][j + 2] - points[i][j], points[i][j + 1] - points[i][j]);
+			float length = glm::length(normal);
+			if (length < 1e-6f)
+				continue;
+
+			normals[i].push_back(normal / length);
+			face_sums[i] += normal / length;
+		}
+	}
+
+	// the leaves in order, then a pass for the faces no leaf holds (brush models).
+	face_groups.resize(mesh.ranges.size(), -1);
+	std::vector<bool> assigned(mesh.ranges.size(), false);
+	std::vector<int> buckets[7];
+	for (int i = 0; i <= leafs.size(); ++i)
+	{
+		std::vector<int> leaf_faces;
+		if (i < leafs.size())
+		{
+			for (int j = 0; j < leafs[i].n_leaffaces; ++j)
+				leaf_faces.push_back(mesh.face_owners[leaffaces[leafs[i].leaffaces + j].face]);
+		}
+		else
+		{
+			for (int j = 0; j < mesh.ranges.size(); ++j)
+				leaf_faces.push_back(j);
+		}
+
+		// by the axis each face mostly points along, faces without a usable normal on their own.
+		for (int face_index : leaf_faces)
+		{
+			if (assigned[face_index] || mesh.ranges[face_index].n_indices == 0)
+				continue;
+
+			// cull none and cull back materials show the side the cone says faces away.
+			assigned[face_index] = true;
+			if (materials.get(texture_materials[faces[face_index].texture]).cull != CULL_FRONT)
+				continue;
+			const glm::vec3& sum = face_sums[face_index];
+			int axis = 0;
+			for (int k = 1; k < 3; ++k)
+			{
+				if (std::abs(sum[k]) > std::abs(sum[axis]))
+					axis = k;
+			}
+			int bucket = glm::length(sum) < 1e-6f ? 6 : axis * 2 + (sum[axis] < 0.0f ? 1 : 0);
+			buckets[bucket].push_back(face_index);
+		}
+
+		float min_dot = std::cos(glm::radians(MAX_CONE_ANGLE));
+		for (std::vector<int>& bucket : buckets)
+		{
+			std::vector<int> group_faces;
+			std::vector<glm::vec3> group_normals;
+			glm::vec3 group_sum(0.0f);
+			int group_triangles = 0;
+			for (int face_index : bucket)
+			{
+				std::vector<glm::vec3> grown = group_normals;
+				grown.insert(grown.end(), normals[face_index].begin(), normals[face_index].end());
+				glm::vec3 grown_sum = group_sum + face_sums[face_index];
+
+				if (!group_faces.empty() && (group_triangles + face_triangles[face_index] > MAX_CONE_TRIANGLES ||
+					!fits_cone(grown, grown_sum, min_dot)))
+				{
+					add_group(group_faces, normals, points);
+					group_faces.clear();
+					grown = normals[face_index];
+					grown_sum = face_sums[face_index];
+					group_triangles = 0;
+				}
+
+				group_faces.push_back(face_index);
+				group_normals.swap(grown);
+				group_sum = grown_sum;
+				group_triangles += face_triangles[face_index];
+			}
+			if (!group_faces.empty())
+				add_group(group_faces, normals, points);
+			bucket.clear();
+		}
+	}
+
+	group_frame.resize(groups.size(), -1);
+	group_culled.resize(groups.size(), false);
+}
+
+void NormalCones::add_group(const std::vector<int>& faces, const std::vector<std::vector<glm::vec3>>& normals,
+	const std::vector<std::vector<glm::vec3>>& points)
+{
+	cone_group group;
+	group.triangles = 0;
+
+	glm::vec3 sum(0.0f);
+	glm::vec3 mins(1e30f), maxs(-1e30f);
+	for (int face_index : faces)
+	{
+		face_groups[face_index] = groups.size();
+		group.triangles += face_triangles[face_index];
+		for (const glm::vec3& normal : normals[face_index])
+			sum += normal;
+		for (const glm::vec3& point : points[face_index])
+		{
+			mins = glm::min(mins, point);
+			maxs = glm::max(maxs, point);
+		}
+	}
+
+	group.center = (mins + maxs) * 0.5f;
+	group.radius = 0.0f;
+	for (int face_index : faces)
+	{
+		for (const glm::vec3& point : points[face_index])
+			group.radius = std::max(group.radius, glm::length(point - group.center));
+	}
+
+	// a cone as wide as a half space or wider can always be seen into.
+	group.axis = glm::vec3(0.0f, 0.0f, 1.0f);
+	group.cutoff = 1.0f;
+	if (glm::length(sum) >= 1e-6f)
+	{
+		group.axis = glm::normalize(sum);
+		float min_dot = 1.0f;
+		for (int face_index : faces)
+		{
+			for (const glm::vec3& normal : normals[face_index])
+				min_dot = std::min(min_dot, glm::dot(group.axis, normal));
+		}
+		if (min_dot > 0.0f)
+			group.cutoff = std::sqrt(1.0f - min_dot * min_dot);
+	}
+	groups.push_back(group);
+}
+
+void NormalCones::cull(const glm::vec3& position, const std::vector<int>& faces, int version)
+{
+	if (version == culled_version && position == culled_position)
+		return;
+
+	culled_version = version;
+	culled_position = position;
+
+	auto start = std::chrono::high_resolution_clock::now();
+	frame++;
+	stats.groups = 0;
+	stats.groups_culled = 0;
+	stats.faces_culled = 0;
+	stats.triangles_culled = 0;
+	stats.triangles = 0;
+
+	visible_faces.clear();
+	for (int face_index : faces)
+	{
+		stats.triangles += face_triangles[face_index];
+		int group_index = face_groups[face_index];
+		if (group_index < 0)
+		{
+			visible_faces.push_back(face_index);
+			continue;
+		}
+
+		// the camera is behind every triangle if the direction to anywhere in the sphere is
+		// within 90 degrees less the cone's half angle of the axis.
+		if (group_frame[group_index] != frame)
+		{
+			const cone_group& group = groups[group_index];
+			glm::vec3 offset = group.center - position;
+			group_frame[group_index] = frame;
+			group_culled[group_index] = glm::dot(offset, group.axis) >= group.cutoff * glm::length(offset) + group.radius;
+			stats.groups++;
+			if (group_culled[group_index])
+				stats.groups_culled++;
+		}
+
+		if (group_culled[group_index])
+		{
+			stats.faces_culled++;
+			stats.triangles_culled += face_triangles[face_index];
+		}
+		else
+			visible_faces.push_back(face_index);
+	}
+
+	stats.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "Materials.h"
+#include "RenderMesh.h"
+
+// groups stop growing at this many triangles or once their normals spread wider than this.
+const int MAX_CONE_TRIANGLES = 256;
+const float MAX_CONE_ANGLE = 60.0f;
+
+struct cone_stats
+{
+	int groups;				// groups the faces in the set belong to
+	int groups_culled;
+	int faces_culled;
+	int triangles_culled;	// triangles the GPU doesn't have to set up and backface cull itself
+	int triangles;			// in the set before culling
+	double milliseconds;
+};
+
+// load time groups of faces that share a leaf and face roughly the same way, each with a bounding
+// sphere and a cone holding all of its triangle normals. a group the camera sees only the backs of,
+// wherever it looks, can be dropped with one test: the camera has to be behind every plane the
+// cone allows, all over the sphere. flat faces have the same normal everywhere, so the walls, floors
+// and ceilings of an enclosed arena that point away from the camera go without touching the GPU.
+// faces are never split, so a curved mesh face is one group with a wide cone and is rarely culled.
+// faces whose material is drawn two sided or with the front culled are in no group and never culled.
+class NormalCones
+{
+public:
+	NormalCones(const BSPLoader& loader, const render_mesh& mesh, const MaterialTable& materials,
+		const std::vector<int>& texture_materials);
+
+	// faces whose groups all face away from position (in BSP space) are dropped. does nothing if
+	// neither position nor version changed since the last call.
+	void cull(const glm::vec3& position, const std::vector<int>& faces, int version);
+	void invalidate() { culled_version = -1; }
+
+	// the given faces less the culled ones, same order.
+	const std::vector<int>& get_visible_faces() const { return visible_faces; }
+	const cone_stats& get_stats() const { return stats; }
+	int get_group_count() const { return groups.size(); }
+private:
+	struct cone_group
+	{
+		glm::vec3 center;
+		float radius;
+		glm::vec3 axis;
+		float cutoff;			// sin of the cone's half angle, 1 if it can't be culled
+		int triangles;
+	};
+
+	void add_group(const std::vector<int>& faces, const std::vector<std::vector<glm::vec3>>& normals,
+		const std::vector<std::vector<glm::vec3>>& points);
+
+	std::vector<cone_group> groups;
+	std::vector<int> face_groups;		// -1 for faces with nothing to draw or whose backs can be seen
+	std::vector<int> face_triangles;
+
+	// per frame verdicts, stamped so groups shared by many faces are only tested once.
+	std::vector<int> group_frame;
+	std::vector<bool> group_culled;
+	int frame = 0;
+
+	std::vector<int> visible_faces;
+	glm::vec3 culled_position;
+	int culled_version = -1;
+	cone_stats stats{};
+};
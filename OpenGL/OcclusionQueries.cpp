@@ -0,0 +1,416 @@
+#include "OcclusionQueries.h"
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
+
+// query boxes are pushed out a little so they don't z-fight with the walls they sit on, and
+// a camera this close to a box can't have it tested at all, the near plane would clip it.
+const float BOX_MARGIN = 2.0f;
+const float INSIDE_MARGIN = 4.0f;
+
+OcclusionQueries::OcclusionQueries(const BSPLoader& loader, const render_mesh& mesh, const packed_indices& packed, GLuint box_program,
+	const std::vector<bool>& skipped_textures) :
+	loader{ loader }, packed{ packed }, box_program{ box_program }
+{
+	const std::vector<node>& nodes = loader.get_nodes();
+	const std::vector<leaf>& leafs = loader.get_leafs();
+	const std::vector<leafface>& leaffaces = loader.get_leaffaces();
+
+	query_target = GLEW_VERSION_3_3 || GLEW_ARB_occlusion_query2 ? GL_ANY_SAMPLES_PASSED : GL_SAMPLES_PASSED;
+
+	node_count = nodes.size();
+	items.resize(nodes.size() + leafs.size());
+	for (tree_item& item : items)
+	{
+		item.parent = -1;
+		item.children[0] = item.children[1] = -1;
+		item.visible = true;
+		item.next_check = 0;
+		item.query = 0;
+		item.pvs_frame = -1;
+	}
+
+	for (int i = 0; i < nodes.size(); ++i)
+	{
+		const node& _node = nodes[i];
+		items[i].mins = glm::vec3(_node.mins[0], _node.mins[1], _node.mins[2]);
+		items[i].maxs = glm::vec3(_node.maxs[0], _node.maxs[1], _node.maxs[2]);
+		for (int k = 0; k < 2; ++k)
+		{
+			items[i].children[k] = item_of(_node.children[k]);
+			items[items[i].children[k]].parent = i;
+		}
+	}
+
+	std::vector<int> face_leafstamp(mesh.ranges.size(), -1);
+	leaf_faces.resize(leafs.size());
+	for (int i = 0; i < leafs.size(); ++i)
+	{
+		const leaf& _leaf = leafs[i];
+		items[node_count + i].mins = glm::vec3(_leaf.mins[0], _leaf.mins[1], _leaf.mins[2]);
+		items[node_count + i].maxs = glm::vec3(_leaf.maxs[0], _leaf.maxs[1], _leaf.maxs[2]);
+
+		for (int j = 0; j < _leaf.n_leaffaces; ++j)
+		{
+			int face_index = mesh.face_owners[leaffaces[_leaf.leaffaces + j].face];
+			if (face_leafstamp[face_index] == i || mesh.ranges[face_index].n_indices == 0)
+				continue;
+
+			// same rules as the per face path, transparent surfaces aren't drawn yet.
+			int texture = loader.get_faces()[face_index].texture;
+			const shader& _shader = loader.get_shader(texture);
+			if (!_shader.render || _shader.transparent)
+				continue;
+			if (!skipped_textures.empty() && skipped_textures[texture])
+				continue;
+
+			face_leafstamp[face_index] = i;
+			leaf_faces[i].push_back(face_index);
+		}
+	}
+	face_drawframe.resize(mesh.ranges.size(), -1);
+	face_batch.resize(mesh.ranges.size(), -1);
+
+	// a unit cube, stretched over each box by the vertex shader.
+	const float corners[] = {
+		0, 0, 0,  1, 0, 0,  0, 1, 0,  1, 1, 0,
+		0, 0, 1,  1, 0, 1,  0, 1, 1,  1, 1, 1
+	};
+	const ubyte box_indices[] = {
+		0, 2, 1,  1, 2, 3,  4, 5, 6,  5, 7, 6,
+		0, 1, 4,  1, 5, 4,  2, 6, 3,  3, 6, 7,
+		0, 4, 2,  2, 4, 6,  1, 3, 5,  3, 7, 5
+	};
+
+	// don't leave the caller's vertex array bound to the cube.
+	GLint previous_vao, previous_buffer;
+	glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &previous_vao);
+	glGetIntegerv(GL_ARRAY_BUFFER_BINDING, &previous_buffer);
+
+	glGenVertexArrays(1, &box_vao);
+	glBindVertexArray(box_vao);
+
+	glGenBuffers(1, &box_vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, box_vbo);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+
+	glGenBuffers(1, &box_ebo);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, box_ebo);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(box_indices), box_indices, GL_STATIC_DRAW);
+
+	GLint location = glGetAttribLocation(box_program, "corner");
+	glVertexAttribPointer(location, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), 0);
+	glEnableVertexAttribArray(location);
+
+	glBindVertexArray(previous_vao);
+	glBindBuffer(GL_ARRAY_BUFFER, previous_buffer);
+}
+
+OcclusionQueries::~OcclusionQueries()
+{
+	for (const pending_query& query : pending)
+		free_queries.push_back(query.query);
+	if (!free_queries.empty())
+		glDeleteQueries(free_queries.size(), &free_queries[0]);
+
+	glDeleteBuffers(1, &box_vbo);
+	glDeleteBuffers(1, &box_ebo);
+	glDeleteVertexArrays(1, &box_vao);
+}
+
+bool OcclusionQueries::is_supported()
+{
+	return GLEW_VERSION_3_0;
+}
+
+void OcclusionQueries::mark_pvs(int cluster)
+{
+	const std::vector<leaf>& leafs = loader.get_leafs();
+	pvs_frame++;
+
+	for (int i = 0; i < leafs.size(); ++i)
+	{
+		if (leafs[i].cluster < 0 || !loader.cluster_visible(cluster, leafs[i].cluster))
+			continue;
+
+		// parents already stamped have had the rest of the way up done too.
+		for (int item = node_count + i; item >= 0 && items[item].pvs_frame != pvs_frame; item = items[item].parent)
+			items[item].pvs_frame = pvs_frame;
+	}
+}
+
+void OcclusionQueries::pull_up(int item)
+{
+	for (int parent = items[item].parent; parent >= 0; parent = items[parent].parent)
+	{
+		const tree_item& _parent = items[parent];
+		if (items[_parent.children[0]].visible || items[_parent.children[1]].visible)
+			break;
+		items[parent].visible = false;
+	}
+}
+
+void OcclusionQueries::read_results()
+{
+	int latency_sum = 0;
+	size_t kept = 0;
+	for (const pending_query& query : pending)
+	{
+		// never wait, a result that isn't in yet is looked at again next frame.
+		GLint available = 0;
+		glGetQueryObjectiv(query.query, GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available)
+		{
+			pending[kept++] = query;
+			continue;
+		}
+
+		GLuint samples = 0;
+		glGetQueryObjectuiv(query.query, GL_QUERY_RESULT, &samples);
+		free_queries.push_back(query.query);
+		items[query.item].query = 0;
+
+		stats.results++;
+		latency_sum += frame - query.frame;
+		stats.max_latency = std::max(stats.max_latency, frame - query.frame);
+
+		tree_item& item = items[query.item];
+		if (samples == 0)
+		{
+			if (query.check)
+			{
+				item.visible = false;
+				pull_up(query.item);
+			}
+			continue;
+		}
+
+		// visible leaves are spread over the check interval by their number.
+		item.visible = true;
+		item.next_check = frame + VISIBLE_CHECK_INTERVAL + query.item % (VISIBLE_CHECK_INTERVAL + 1);
+
+		// a hidden node that came into view gets its children queried one by one from now on.
+		if (!query.check && item.children[0] >= 0)
+		{
+			items[item.children[0]].visible = false;
+			items[item.children[1]].visible = false;
+		}
+	}
+	pending.resize(kept);
+
+	stats.pending = pending.size();
+	stats.latency = stats.results ? (float)latency_sum / stats.results : 0.0f;
+}
+
+void OcclusionQueries::begin_boxes()
+{
+	glUseProgram(box_program);
+	glUniformMatrix4fv(glGetUniformLocation(box_program, "clip"), 1, GL_FALSE, &clip[0][0]);
+	glBindVertexArray(box_vao);
+	glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+	glDepthMask(GL_FALSE);
+	glDisable(GL_CULL_FACE);
+}
+
+void OcclusionQueries::end_boxes()
+{
+	glUseProgram(saved_program);
+	glBindVertexArray(saved_vao);
+	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+	glDepthMask(GL_TRUE);
+	if (cull_face)
+		glEnable(GL_CULL_FACE);
+}
+
+GLuint OcclusionQueries::query_box(int item, bool check)
+{
+	GLuint query;
+	if (free_queries.empty())
+		glGenQueries(1, &query);
+	else
+	{
+		query = free_queries.back();
+		free_queries.pop_back();
+	}
+
+	glm::vec3 mins = items[item].mins - glm::vec3(BOX_MARGIN);
+	glm::vec3 maxs = items[item].maxs + glm::vec3(BOX_MARGIN);
+	glUniform3fv(glGetUniformLocation(box_program, "boxMins"), 1, &mins.x);
+	glUniform3fv(glGetUniformLocation(box_program, "boxMaxs"), 1, &maxs.x);
+
+	glBeginQuery(query_target, query);
+	glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_BYTE, 0);
+	glEndQuery(query_target);
+
+	items[item].query = query;
+	pending.push_back({ query, item, frame, check });
+	if (check)
+		stats.check_queries++;
+	else
+		stats.box_queries++;
+	return query;
+}
+
+void OcclusionQueries::add_leaf(int item, bool conditional)
+{
+	for (int face_index : leaf_faces[item - node_count])
+	{
+		// conditional draws may not happen, so only unconditional ones count as drawn.
+		if (face_drawframe[face_index] == frame || face_batch[face_index] == batch)
+			continue;
+
+		face_batch[face_index] = batch;
+		if (!conditional)
+			face_drawframe[face_index] = frame;
+		faces.push_back(face_index);
+	}
+}
+
+void OcclusionQueries::flush_faces()
+{
+	if (!faces.empty())
+	{
+		for (const multi_draw& draw : build_multi_draws(packed, faces))
+		{
+			glMultiDrawElementsBaseVertex(GL_TRIANGLES, &draw.counts[0], draw.type, &draw.offsets[0],
+				draw.counts.size(), &draw.base_vertices[0]);
+		}
+		faces.clear();
+	}
+	batch++;
+}
+
+bool OcclusionQueries::in_view(int item) const
+{
+	return items[item].pvs_frame == pvs_frame && box_in_frustum(view_frustum, items[item].mins, items[item].maxs);
+}
+
+void OcclusionQueries::render(const glm::vec3& position, const glm::mat4& clip)
+{
+	auto start_time = std::chrono::high_resolution_clock::now();
+
+	frame++;
+	stats = query_stats{};
+	read_results();
+
+	if (items.empty())
+		return;
+
+	const std::vector<node>& nodes = loader.get_nodes();
+	const std::vector<plane>& planes = loader.get_planes();
+	const std::vector<leaf>& leafs = loader.get_leafs();
+
+	this->clip = clip;
+	view_frustum = extract_frustum(clip);
+	int cluster = leafs.empty() ? -1 : leafs[loader.find_leaf(position)].cluster;
+	if (cluster != camera_cluster)
+	{
+		camera_cluster = cluster;
+		mark_pvs(cluster);
+	}
+
+	glGetIntegerv(GL_CURRENT_PROGRAM, &saved_program);
+	glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &saved_vao);
+	cull_face = glIsEnabled(GL_CULL_FACE);
+
+	checks.clear();
+	std::vector<int>& stack = traversal;
+	stack.assign(1, node_count > 0 ? 0 : node_count);
+	while (!stack.empty())
+	{
+		int index = stack.back();
+		stack.pop_back();
+		if (!in_view(index))
+			continue;
+
+		tree_item& item = items[index];
+		bool inside = true;
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			if (position[axis] < item.mins[axis] - INSIDE_MARGIN || position[axis] > item.maxs[axis] + INSIDE_MARGIN)
+				inside = false;
+		}
+
+		if (!item.visible && !inside)
+		{
+			// the box has to be tested against everything in front of it. one still out from an
+			// earlier frame is rendered on again instead, an item never has two queries waiting.
+			flush_faces();
+			GLuint query = item.query;
+			if (!query)
+			{
+				begin_boxes();
+				query = query_box(index, false);
+				end_boxes();
+			}
+
+			std::vector<int>& subtree = subtree_stack;
+			subtree.assign(1, index);
+			while (!subtree.empty())
+			{
+				int sub_index = subtree.back();
+				subtree.pop_back();
+				if (!in_view(sub_index))
+					continue;
+
+				if (items[sub_index].children[0] < 0)
+				{
+					add_leaf(sub_index, true);
+					stats.leafs_conditional++;
+				}
+				else
+				{
+					subtree.push_back(items[sub_index].children[1]);
+					subtree.push_back(items[sub_index].children[0]);
+				}
+			}
+
+			// the GPU waits on the query itself, the CPU never does.
+			glBeginConditionalRender(query, GL_QUERY_WAIT);
+			flush_faces();
+			glEndConditionalRender();
+			stats.hidden_nodes++;
+			continue;
+		}
+		item.visible = true;
+
+		if (item.children[0] < 0)
+		{
+			add_leaf(index, false);
+			stats.leafs_drawn++;
+			if (frame >= item.next_check && !inside && !item.query)
+			{
+				checks.push_back(index);
+				item.next_check = INT_MAX;
+			}
+			continue;
+		}
+
+		// the child on the camera's side of the plane goes first.
+		const plane& _plane = planes[nodes[index].plane];
+		float distance = _plane.normal[0] * position.x + _plane.normal[1] * position.y + _plane.normal[2] * position.z - _plane.dist;
+		int front = distance >= 0 ? 0 : 1;
+		stack.push_back(item.children[1 - front]);
+		stack.push_back(item.children[front]);
+	}
+	flush_faces();
+
+	// visible leaves are checked against the finished depth buffer.
+	if (!checks.empty())
+	{
+		begin_boxes();
+		for (int index : checks)
+			query_box(index, true);
+		end_boxes();
+	}
+
+	for (int i = 0; i < leafs.size(); ++i)
+	{
+		if (in_view(node_count + i))
+			stats.pvs_leafs++;
+	}
+
+	auto end_time = std::chrono::high_resolution_clock::now();
+	stats.milliseconds = std::chrono::duration<double, std::milli>(end_time - start_time).count();
+}
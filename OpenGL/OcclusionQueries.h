@@ -0,0 +1,121 @@
+#pragma once
+
+#include "IndexPacking.h"
+#include "Visibility.h"
+
+// a leaf found visible skips its query for this many frames, plus up to as many again going by the
+// leaf's index, so the checks of leaves that became visible together don't all land on one frame.
+const int VISIBLE_CHECK_INTERVAL = 8;
+
+struct query_stats
+{
+	int box_queries;		// boxes of nodes and leaves hidden last time, drawn under conditional rendering
+	int check_queries;		// boxes of visible leaves due a check, after everything is drawn
+	int results;			// query results that came back this frame
+	int pending;			// queries still waiting on the GPU
+	float latency;			// frames between issuing and reading back, averaged over this frame's results
+	int max_latency;
+	int pvs_leafs;			// leaves a plain PVS + frustum cull would draw
+	int leafs_drawn;
+	int leafs_conditional;	// drawn only if their hidden ancestor's box query passes
+	int hidden_nodes;		// roots of the hidden subtrees reached this frame
+	double milliseconds;
+};
+
+// coherent hierarchical culling (CHC++) over the BSP tree with hardware occlusion queries.
+// the tree is walked front to back inside the PVS and frustum, keeping last frame's verdict for
+// every node and leaf. visible leaves are drawn straight away and only re-checked every few
+// frames, with a box query once the frame's depth is complete. the hidden subtrees get a box
+// query and their faces drawn under conditional rendering on it, so the GPU throws them away
+// without the CPU waiting for anything. results are read back a frame or more later, when
+// they're ready: a hidden box that turns out visible hands its children their own queries, and a
+// leaf found hidden takes its parents with it once all their children are hidden.
+class OcclusionQueries
+{
+public:
+	// box_program draws the query boxes, it has a vec3 corner attribute and clip, boxMins and
+	// boxMaxs uniforms. faces of the skipped textures, one flag per BSP texture or none at all,
+	// are left to another pass.
+	OcclusionQueries(const BSPLoader& loader, const render_mesh& mesh, const packed_indices& packed, GLuint box_program,
+		const std::vector<bool>& skipped_textures);
+	~OcclusionQueries();
+
+	// conditional rendering needs GL 3.0.
+	static bool is_supported();
+
+	// position is in BSP space and clip the proj * view * model matrix. draws with whatever
+	// program, vertex array and textures are bound.
+	void render(const glm::vec3& position, const glm::mat4& clip);
+
+	const query_stats& get_stats() const { return stats; }
+private:
+	struct tree_item
+	{
+		glm::vec3 mins;
+		glm::vec3 maxs;
+		int parent;				// -1 for the root
+		int children[2];		// items, -1 for leaves
+		bool visible;
+		int next_check;			// frame a visible leaf gets queried again
+		GLuint query;			// issued and not read back yet, 0 if there's none
+		int pvs_frame;			// the PVS stamp, set on leaves in it and their parents
+	};
+
+	struct pending_query
+	{
+		GLuint query;
+		int item;
+		int frame;
+		bool check;				// a visible leaf's check rather than a hidden box
+	};
+
+	int item_of(int child) const { return child >= 0 ? child : node_count - child - 1; }
+	bool in_view(int item) const;
+	void mark_pvs(int cluster);
+	void read_results();
+	void pull_up(int item);
+
+	void begin_boxes();
+	void end_boxes();
+	GLuint query_box(int item, bool check);
+	void add_leaf(int item, bool conditional);
+	void flush_faces();
+
+	const BSPLoader& loader;
+	const packed_indices& packed;
+	GLuint box_program;
+	GLenum query_target;
+
+	int node_count;
+	std::vector<tree_item> items;			// the nodes, then the leaves
+	std::vector<std::vector<int>> leaf_faces;	// face owners, once each
+
+	GLuint box_vao;
+	GLuint box_vbo;
+	GLuint box_ebo;
+
+	std::vector<GLuint> free_queries;
+	std::vector<pending_query> pending;
+	std::vector<int> checks;
+
+	// faces drawn unconditionally this frame can be skipped anywhere after, the batch stamp only
+	// stops a face going into one draw twice.
+	std::vector<int> face_drawframe;
+	std::vector<int> face_batch;
+	std::vector<int> faces;
+	int batch = 0;
+
+	std::vector<int> traversal;
+	std::vector<int> subtree_stack;
+	glm::mat4 clip;
+	frustum view_frustum;
+
+	int frame = 0;
+	int pvs_frame = 0;
+	int camera_cluster = -2;
+	GLint saved_program;
+	GLint saved_vao;
+	bool cull_face;
+
+	query_stats stats{};
+};
@@ -0,0 +1,280 @@
+#include "PatchCollide.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+	const float NORMAL_EPSILON = 0.0001f;
+	const float DIST_EPSILON = 0.02f;
+	const float ON_EPSILON = 0.1f;
+	const float PLANE_TRI_EPSILON = 0.1f;
+
+	glm::vec3 to_vec3(const float* v)
+	{
+		return glm::vec3(v[0], v[1], v[2]);
+	}
+
+	glm::vec3 bezier(const glm::vec3& p0, const glm::vec3& p1, const glm::vec3& p2, float t)
+	{
+		float it = 1.0f - t;
+		return p0 * (it * it) + p1 * (2.0f * t * it) + p2 * (t * t);
+	}
+
+	// how far the middle of a quadratic curve bows away from its chord.
+	float curve_deviation(const glm::vec3& p0, const glm::vec3& p1, const glm::vec3& p2)
+	{
+		glm::vec3 mid = bezier(p0, p1, p2, 0.5f);
+		return glm::length(mid - (p0 + p2) * 0.5f);
+	}
+
+	// true if the planes match either way round, so a flipped surface plane counts too.
+	bool plane_equal(const plane& a, const glm::vec3& normal, float dist)
+	{
+		for (int flip = 0; flip < 2; ++flip)
+		{
+			float sign = flip ? -1.0f : 1.0f;
+			if (std::fabs(a.normal[0] - normal.x * sign) < NORMAL_EPSILON &&
+				std::fabs(a.normal[1] - normal.y * sign) < NORMAL_EPSILON &&
+				std::fabs(a.normal[2] - normal.z * sign) < NORMAL_EPSILON &&
+				std::fabs(a.dist - dist * sign) < DIST_EPSILON)
+				return true;
+		}
+		return false;
+	}
+}
+
+PatchCollide::PatchCollide(const BSPLoader& loader)
+{
+	const std::vector<face>& faces = loader.get_faces();
+	const std::vector<texture>& textures = loader.get_textures();
+	const std::vector<vertex>& vertices = loader.get_vertex_data();
+
+	face_patches.assign(faces.size(), -1);
+
+	for (int i = 0; i < faces.size(); ++i)
+	{
+		const face& _face = faces[i];
+		if (_face.type != 2 || _face.size[0] < 3 || _face.size[1] < 3)
+			continue;
+
+		const texture& _texture = textures[_face.texture];
+		if (_texture.flags & SURF_NONSOLID)
+			continue;
+
+		patch_collide patch;
+		patch.first_facet = facets.size();
+		patch.contents = _texture.contents;
+		patch.face = i;
+		patches.push_back(patch);
+
+		build_patch(_face, vertices);
+
+		patch_collide& built = patches.back();
+		built.n_facets = facets.size() - built.first_facet;
+		if (built.n_facets == 0)
+		{
+			patches.pop_back();
+			continue;
+		}
+
+		// bounds of the facets rather than the control points, the curve never reaches those.
+		built.mins = glm::vec3(1e30f);
+		built.maxs = glm::vec3(-1e30f);
+		for (int j = built.first_facet; j < built.first_facet + built.n_facets; ++j)
+		{
+			built.mins = glm::min(built.mins, facet_mins[j]);
+			built.maxs = glm::max(built.maxs, facet_maxs[j]);
+		}
+
+		face_patches[i] = patches.size() - 1;
+	}
+
+	facet_mins.clear();
+	facet_maxs.clear();
+}
+
+void PatchCollide::build_patch(const face& _face, const std::vector<vertex>& vertices)
+{
+	int width = _face.size[0];
+	int height = _face.size[1];
+
+	// the control grid is a set of 3x3 biquadratic patches sharing their edge rows.
+	for (int py = 0; py + 2 < height; py += 2)
+	{
+		for (int px = 0; px + 2 < width; px += 2)
+		{
+			glm::vec3 control[3][3];
+			glm::vec3 up{ 0.0f };
+			for (int y = 0; y < 3; ++y)
+			{
+				for (int x = 0; x < 3; ++x)
+				{
+					const vertex& v = vertices[_face.vertex + (py + y) * width + px + x];
+					control[y][x] = to_vec3(v.position);
+					up += to_vec3(v.normal);
+				}
+			}
+
+			// subdivide until the flattest approximation is within PATCH_SUBDIVIDE_DISTANCE.
+			float deviation = 0.0f;
+			for (int k = 0; k < 3; ++k)
+			{
+				deviation = std::max(deviation, curve_deviation(control[k][0], control[k][1], control[k][2]));
+				deviation = std::max(deviation, curve_deviation(control[0][k], control[1][k], control[2][k]));
+			}
+			int steps = (int)std::ceil(std::sqrt(deviation / PATCH_SUBDIVIDE_DISTANCE));
+			steps = std::max(1, std::min(PATCH_MAX_SUBDIVISIONS, steps));
+
+			std::vector<glm::vec3> grid((steps + 1) * (steps + 1));
+			for (int y = 0; y <= steps; ++y)
+			{
+				float v = (float)y / steps;
+				glm::vec3 column[3];
+				for (int x = 0; x < 3; ++x)
+					column[x] = bezier(control[0][x], control[1][x], control[2][x], v);
+
+				for (int x = 0; x <= steps; ++x)
+					grid[y * (steps + 1) + x] = bezier(column[0], column[1], column[2], (float)x / steps);
+			}
+
+			for (int y = 0; y < steps; ++y)
+			{
+				for (int x = 0; x < steps; ++x)
+				{
+					const glm::vec3 quad[4] = {
+						grid[y * (steps + 1) + x],
+						grid[y * (steps + 1) + x + 1],
+						grid[(y + 1) * (steps + 1) + x + 1],
+						grid[(y + 1) * (steps + 1) + x]
+					};
+
+					// keep the cell as one facet if it's flat, otherwise split it in two.
+					glm::vec3 normal = glm::cross(quad[2] - quad[0], quad[1] - quad[0]);
+					float area = glm::length(normal);
+					if (area > 0.0001f && std::fabs(glm::dot(quad[3] - quad[0], normal / area)) < PLANE_TRI_EPSILON)
+					{
+						add_facet(quad, 4, up);
+					}
+					else
+					{
+						const glm::vec3 first[3] = { quad[0], quad[1], quad[2] };
+						const glm::vec3 second[3] = { quad[0], quad[2], quad[3] };
+						add_facet(first, 3, up);
+						add_facet(second, 3, up);
+					}
+				}
+			}
+		}
+	}
+}
+
+void PatchCollide::add_facet(const glm::vec3* points, int n_points, const glm::vec3& up)
+{
+	glm::vec3 normal = glm::cross(points[2] - points[0], points[1] - points[0]);
+	float length = glm::length(normal);
+
+	// collapsed cells show up wherever the control grid pinches to a point.
+	if (length < 0.0001f)
+		return;
+
+	normal /= length;
+	if (glm::dot(normal, up) < 0)
+		normal = -normal;
+
+	patch_facet facet;
+	facet.first_plane = planes.size();
+	planes.push_back(plane{ { normal.x, normal.y, normal.z }, glm::dot(normal, points[0]) });
+
+	glm::vec3 centre{ 0.0f };
+	glm::vec3 mins = points[0], maxs = points[0];
+	for (int i = 0; i < n_points; ++i)
+	{
+		centre += points[i];
+		mins = glm::min(mins, points[i]);
+		maxs = glm::max(maxs, points[i]);
+	}
+	centre /= (float)n_points;
+
+	auto add_plane = [&](const glm::vec3& n, float dist)
+	{
+		for (int i = facet.first_plane; i < planes.size(); ++i)
+		{
+			if (plane_equal(planes[i], n, dist))
+				return;
+		}
+		planes.push_back(plane{ { n.x, n.y, n.z }, dist });
+	};
+
+	// border planes stand up along each edge, facing away from the middle of the facet.
+	for (int i = 0; i < n_points; ++i)
+	{
+		const glm::vec3& a = points[i];
+		const glm::vec3& b = points[(i + 1) % n_points];
+		glm::vec3 border = glm::cross(b - a, normal);
+		float border_length = glm::length(border);
+		if (border_length < 0.0001f)
+			continue;
+
+		border /= border_length;
+		float dist = glm::dot(border, a);
+		if (glm::dot(border, centre) - dist > 0)
+		{
+			border = -border;
+			dist = -dist;
+		}
+		add_plane(border, dist);
+	}
+
+	// axial bevels, so boxes can't poke through the corners between neighbouring facets.
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		for (int dir = -1; dir <= 1; dir += 2)
+		{
+			glm::vec3 n{ 0.0f };
+			n[axis] = (float)dir;
+			add_plane(n, dir == 1 ? maxs[axis] : -mins[axis]);
+		}
+	}
+
+	// edge bevels, the edge crossed with each axis, where the whole facet is behind them.
+	for (int i = 0; i < n_points; ++i)
+	{
+		const glm::vec3& a = points[i];
+		glm::vec3 edge = points[(i + 1) % n_points] - a;
+		if (glm::length(edge) < 0.5f)
+			continue;
+		edge = glm::normalize(edge);
+
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			for (int dir = -1; dir <= 1; dir += 2)
+			{
+				glm::vec3 n{ 0.0f };
+				n[axis] = (float)dir;
+				n = glm::cross(edge, n);
+				if (glm::length(n) < 0.5f)
+					continue;
+				n = glm::normalize(n);
+
+				float dist = glm::dot(n, a);
+				bool behind = true;
+				for (int j = 0; j < n_points; ++j)
+				{
+					if (glm::dot(n, points[j]) - dist > ON_EPSILON)
+					{
+						behind = false;
+						break;
+					}
+				}
+				if (behind)
+					add_plane(n, dist);
+			}
+		}
+	}
+
+	facet.n_planes = planes.size() - facet.first_plane;
+	facets.push_back(facet);
+	facet_mins.push_back(mins);
+	facet_maxs.push_back(maxs);
+}
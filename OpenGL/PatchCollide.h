@@ -0,0 +1,52 @@
+#pragma once
+
+#include "BSPLoader.h"
+
+// collision geometry for the curved surfaces (face type 2), after Q3's cm_patch.
+// each patch control grid is tessellated into flat facets, and every facet is a surface
+// plane plus border planes around its edges and the axial/edge bevels box traces need.
+
+// max distance the tessellated surface is allowed to stray from the true curve.
+const float PATCH_SUBDIVIDE_DISTANCE = 16.0f;
+const int PATCH_MAX_SUBDIVISIONS = 16;
+
+struct patch_facet
+{
+	int first_plane;	// surface plane, followed by the border and bevel planes
+	int n_planes;		// all of them facing out of the facet
+};
+
+struct patch_collide
+{
+	glm::vec3 mins;
+	glm::vec3 maxs;
+	int first_facet;
+	int n_facets;
+	int contents;
+	int face;
+};
+
+class PatchCollide
+{
+public:
+	explicit PatchCollide(const BSPLoader& loader);
+
+	// index into get_patches() for a face, or -1 if it isn't a collidable patch.
+	int get_face_patch(int face) const { return face_patches[face]; }
+
+	const std::vector<patch_collide>& get_patches() const { return patches; }
+	const std::vector<patch_facet>& get_facets() const { return facets; }
+	const std::vector<plane>& get_planes() const { return planes; }
+private:
+	void build_patch(const face& _face, const std::vector<vertex>& vertices);
+	void add_facet(const glm::vec3* points, int n_points, const glm::vec3& up);
+
+	std::vector<int> face_patches;
+	std::vector<patch_collide> patches;
+	std::vector<patch_facet> facets;
+	std::vector<plane> planes;
+
+	// per facet bounds, only kept while the patches are being built.
+	std::vector<glm::vec3> facet_mins;
+	std::vector<glm::vec3> facet_maxs;
+};
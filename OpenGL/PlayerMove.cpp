@@ -0,0 +1,395 @@
+#include "PlayerMove.h"
+
+#include <cmath>
+
+namespace
+{
+	// tuning straight out of Q3's bg_pmove.c
+	const float PLAYER_SPEED = 320.0f;
+	const float NOCLIP_SPEED = 400.0f;
+	const float STOP_SPEED = 100.0f;
+	const float ACCELERATE = 10.0f;
+	const float AIR_ACCELERATE = 1.0f;
+	const float FRICTION = 6.0f;
+	const float GRAVITY = 800.0f;
+	const float JUMP_VELOCITY = 270.0f;
+	const float STEPSIZE = 18.0f;
+	const float MIN_WALK_NORMAL = 0.7f;
+	const float OVERCLIP = 1.001f;
+	const int MAX_CLIP_PLANES = 5;
+
+	const glm::vec3 PLAYER_MINS{ -15.0f, -15.0f, -24.0f };
+	const glm::vec3 PLAYER_MAXS{ 15.0f, 15.0f, 32.0f };
+	const float VIEW_HEIGHT = 26.0f;
+
+	const float TICK = (float)MOVE_TICK;
+
+	// slide the velocity along a plane, overbounce pushes it slightly away so we don't stick.
+	glm::vec3 clip_velocity(const glm::vec3& in, const glm::vec3& normal, float overbounce)
+	{
+		float backoff = glm::dot(in, normal);
+		if (backoff < 0)
+			backoff *= overbounce;
+		else
+			backoff /= overbounce;
+
+		return in - normal * backoff;
+	}
+
+	glm::vec3 plane_normal(const plane& _plane)
+	{
+		return glm::vec3(_plane.normal[0], _plane.normal[1], _plane.normal[2]);
+	}
+}
+
+void PlayerMove::update(double frame_time, const player_input& input)
+{
+	accumulator += frame_time;
+
+	int ticks = 0;
+	while (accumulator >= MOVE_TICK)
+	{
+		accumulator -= MOVE_TICK;
+		previous_origin = origin;
+		tick(input);
+
+		if (++ticks == MAX_TICKS_PER_FRAME)
+		{
+			accumulator = 0.0;
+			break;
+		}
+	}
+}
+
+void PlayerMove::teleport(const glm::vec3& _origin)
+{
+	origin = _origin;
+	previous_origin = _origin;
+	velocity = glm::vec3(0.0f);
+	categorize_position();
+}
+
+bool PlayerMove::set_noclip(bool enabled)
+{
+	if (!enabled && trace(origin, origin).allsolid)
+		return false;
+
+	noclip = enabled;
+	velocity = glm::vec3(0.0f);
+	if (!noclip)
+		categorize_position();
+	return true;
+}
+
+glm::vec3 PlayerMove::get_view_origin() const
+{
+	float alpha = (float)(accumulator / MOVE_TICK);
+	glm::vec3 position = glm::mix(previous_origin, origin, alpha);
+
+	// noclip flies the eye itself around, there's no body under it.
+	if (!noclip)
+		position.z += VIEW_HEIGHT;
+
+	return position;
+}
+
+void PlayerMove::tick(const player_input& input)
+{
+	if (noclip)
+		noclip_move(input);
+	else
+		walk_move(input);
+
+	jump_held = input.jump;
+}
+
+void PlayerMove::noclip_move(const player_input& input)
+{
+	glm::vec3 forward = input.view_forward;
+	glm::vec3 right = glm::normalize(glm::cross(forward, glm::vec3(0.0f, 0.0f, 1.0f)));
+
+	velocity = (forward * input.forward + right * input.right) * NOCLIP_SPEED;
+	origin += velocity * TICK;
+}
+
+void PlayerMove::walk_move(const player_input& input)
+{
+	categorize_position();
+
+	if (input.jump && !jump_held && on_ground)
+	{
+		velocity.z = JUMP_VELOCITY;
+		on_ground = false;
+	}
+
+	if (on_ground)
+		apply_friction();
+
+	// movement is flat regardless of where we look.
+	glm::vec3 forward{ input.view_forward.x, input.view_forward.y, 0.0f };
+	if (glm::length(forward) < 0.0001f)
+		forward = glm::vec3(1.0f, 0.0f, 0.0f);
+	forward = glm::normalize(forward);
+	glm::vec3 right = glm::cross(forward, glm::vec3(0.0f, 0.0f, 1.0f));
+
+	glm::vec3 wishvel = forward * input.forward + right * input.right;
+	float wishspeed = glm::length(wishvel);
+	glm::vec3 wishdir{ 0.0f };
+	if (wishspeed > 0.0001f)
+		wishdir = wishvel / wishspeed;
+	wishspeed = glm::min(wishspeed, 1.0f) * PLAYER_SPEED;
+
+	if (on_ground)
+	{
+		// walk along slopes rather than into them.
+		wishdir = clip_velocity(wishdir, ground_normal, OVERCLIP);
+		if (glm::length(wishdir) > 0.0001f)
+			wishdir = glm::normalize(wishdir);
+
+		accelerate(wishdir, wishspeed, ACCELERATE);
+
+		float speed = glm::length(velocity);
+		velocity = clip_velocity(velocity, ground_normal, OVERCLIP);
+		if (glm::length(velocity) > 0.0001f)
+			velocity = glm::normalize(velocity) * speed;
+
+		if (velocity.x == 0.0f && velocity.y == 0.0f)
+			return;
+
+		step_slide_move(false);
+	}
+	else
+	{
+		accelerate(wishdir, wishspeed, AIR_ACCELERATE);
+		step_slide_move(true);
+	}
+
+	categorize_position();
+}
+
+void PlayerMove::categorize_position()
+{
+	glm::vec3 point = origin;
+	point.z -= 0.25f;
+	trace_result tr = trace(origin, point);
+
+	on_ground = false;
+	if (tr.fraction == 1.0f)
+		return;
+
+	glm::vec3 normal = plane_normal(tr.hit_plane);
+
+	// moving away from the ground, e.g. on the first tick of a jump.
+	if (velocity.z > 0 && glm::dot(velocity, normal) > 10)
+		return;
+
+	// too steep to stand on, we'll slide down it instead.
+	if (normal.z < MIN_WALK_NORMAL)
+		return;
+
+	on_ground = true;
+	ground_normal = normal;
+}
+
+void PlayerMove::apply_friction()
+{
+	glm::vec3 flat{ velocity.x, velocity.y, 0.0f };
+	float speed = glm::length(flat);
+	if (speed < 1.0f)
+	{
+		velocity.x = 0.0f;
+		velocity.y = 0.0f;
+		return;
+	}
+
+	float control = speed < STOP_SPEED ? STOP_SPEED : speed;
+	float drop = control * FRICTION * TICK;
+	float newspeed = glm::max(speed - drop, 0.0f) / speed;
+
+	velocity *= newspeed;
+}
+
+void PlayerMove::accelerate(const glm::vec3& wishdir, float wishspeed, float accel)
+{
+	float currentspeed = glm::dot(velocity, wishdir);
+	float addspeed = wishspeed - currentspeed;
+	if (addspeed <= 0)
+		return;
+
+	float accelspeed = glm::min(accel * TICK * wishspeed, addspeed);
+	velocity += wishdir * accelspeed;
+}
+
+bool PlayerMove::slide_move(bool gravity)
+{
+	glm::vec3 planes[MAX_CLIP_PLANES];
+	int numplanes = 0;
+
+	glm::vec3 primal_velocity = velocity;
+	glm::vec3 end_velocity = velocity;
+
+	if (gravity)
+	{
+		// half the gravity now and half after the move keeps the arc right at any tick rate.
+		end_velocity.z -= GRAVITY * TICK;
+		velocity.z = (velocity.z + end_velocity.z) * 0.5f;
+		primal_velocity.z = end_velocity.z;
+		if (on_ground)
+			velocity = clip_velocity(velocity, ground_normal, OVERCLIP);
+	}
+
+	float time_left = TICK;
+
+	// never turn against the ground plane or the original direction of travel.
+	if (on_ground)
+		planes[numplanes++] = ground_normal;
+	if (glm::length(velocity) > 0.0001f)
+		planes[numplanes++] = glm::normalize(velocity);
+
+	int bumpcount;
+	const int numbumps = 4;
+	for (bumpcount = 0; bumpcount < numbumps; ++bumpcount)
+	{
+		glm::vec3 end = origin + velocity * time_left;
+		trace_result tr = trace(origin, end);
+
+		if (tr.allsolid)
+		{
+			// stuck in a brush, don't build up any falling speed.
+			velocity.z = 0;
+			return true;
+		}
+
+		if (tr.fraction > 0)
+			origin = tr.endpos;
+
+		if (tr.fraction == 1.0f)
+			break;
+
+		time_left -= time_left * tr.fraction;
+
+		if (numplanes >= MAX_CLIP_PLANES)
+		{
+			velocity = glm::vec3(0.0f);
+			return true;
+		}
+
+		glm::vec3 normal = plane_normal(tr.hit_plane);
+
+		// hitting the same plane again, nudge away from it to avoid an epsilon sized stall.
+		int i;
+		for (i = 0; i < numplanes; ++i)
+		{
+			if (glm::dot(normal, planes[i]) > 0.99f)
+			{
+				velocity += normal;
+				break;
+			}
+		}
+		if (i < numplanes)
+			continue;
+
+		planes[numplanes++] = normal;
+
+		// find a velocity that doesn't push into any of the planes we've touched.
+		for (i = 0; i < numplanes; ++i)
+		{
+			if (glm::dot(velocity, planes[i]) >= 0.1f)
+				continue;
+
+			glm::vec3 clipped = clip_velocity(velocity, planes[i], OVERCLIP);
+			glm::vec3 end_clipped = clip_velocity(end_velocity, planes[i], OVERCLIP);
+
+			bool stop = false;
+			for (int j = 0; j < numplanes && !stop; ++j)
+			{
+				if (j == i)
+					continue;
+				if (glm::dot(clipped, planes[j]) >= 0.1f)
+					continue;
+
+				clipped = clip_velocity(clipped, planes[j], OVERCLIP);
+				end_clipped = clip_velocity(end_clipped, planes[j], OVERCLIP);
+
+				if (glm::dot(clipped, planes[i]) >= 0)
+					continue;
+
+				// stuck in a crease between two planes, slide along the line they meet on.
+				glm::vec3 dir = glm::normalize(glm::cross(planes[i], planes[j]));
+				clipped = dir * glm::dot(dir, velocity);
+				end_clipped = dir * glm::dot(dir, end_velocity);
+
+				// a third plane in the way as well means we're wedged in a corner.
+				for (int k = 0; k < numplanes; ++k)
+				{
+					if (k == i || k == j)
+						continue;
+					if (glm::dot(clipped, planes[k]) >= 0.1f)
+						continue;
+
+					stop = true;
+					break;
+				}
+			}
+
+			if (stop)
+			{
+				velocity = glm::vec3(0.0f);
+				return true;
+			}
+
+			velocity = clipped;
+			end_velocity = end_clipped;
+			break;
+		}
+	}
+
+	if (gravity)
+		velocity = end_velocity;
+
+	return bumpcount != 0;
+}
+
+void PlayerMove::step_slide_move(bool gravity)
+{
+	glm::vec3 start_origin = origin;
+	glm::vec3 start_velocity = velocity;
+
+	// got where we wanted to go first time.
+	if (!slide_move(gravity))
+		return;
+
+	glm::vec3 down = start_origin;
+	down.z -= STEPSIZE;
+	trace_result tr = trace(start_origin, down);
+
+	// never step up while still moving upwards, unless there is ground right under us.
+	if (velocity.z > 0 && (tr.fraction == 1.0f || tr.hit_plane.normal[2] < MIN_WALK_NORMAL))
+		return;
+
+	glm::vec3 up = start_origin;
+	up.z += STEPSIZE;
+	tr = trace(start_origin, up);
+	if (tr.allsolid)
+		return;
+
+	// try the move again from the top of the step.
+	float step = tr.endpos.z - start_origin.z;
+	origin = tr.endpos;
+	velocity = start_velocity;
+	slide_move(gravity);
+
+	// and then push back down the height we went up.
+	down = origin;
+	down.z -= step;
+	tr = trace(origin, down);
+	if (!tr.allsolid)
+		origin = tr.endpos;
+	if (tr.fraction < 1.0f)
+		velocity = clip_velocity(velocity, plane_normal(tr.hit_plane), OVERCLIP);
+}
+
+trace_result PlayerMove::trace(const glm::vec3& start, const glm::vec3& end) const
+{
+	return collision.trace(start, end, PLAYER_MINS, PLAYER_MAXS, MASK_PLAYERSOLID);
+}
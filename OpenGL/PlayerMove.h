@@ -0,0 +1,65 @@
+#pragma once
+
+#include "BSPCollision.h"
+
+// simulation runs at a fixed rate no matter how fast we render, same as Q3's pmove_fixed.
+const double MOVE_TICK = 1.0 / 125.0;
+// don't spiral trying to catch up after a long stall (loading, breakpoints).
+const int MAX_TICKS_PER_FRAME = 25;
+
+struct player_input
+{
+	glm::vec3 view_forward;	// BSP space look direction
+	float forward;			// -1 to 1
+	float right;			// -1 to 1
+	bool jump;
+};
+
+// walking movement for the camera, a cut down Q3 bg_pmove: gravity, friction,
+// stepping up stairs and sliding along whatever brush planes the player runs into.
+class PlayerMove
+{
+public:
+	explicit PlayerMove(const BSPCollision& collision) : collision{ collision } {}
+
+	// runs however many fixed ticks fit into frame_time and keeps the remainder for interpolation.
+	void update(double frame_time, const player_input& input);
+
+	// puts the player somewhere new without interpolating from the old position.
+	void teleport(const glm::vec3& origin);
+
+	// turning noclip off fails if the player is currently stuck inside a brush.
+	bool set_noclip(bool enabled);
+	bool get_noclip() const { return noclip; }
+
+	bool is_on_ground() const { return on_ground; }
+	glm::vec3 get_origin() const { return origin; }
+	glm::vec3 get_velocity() const { return velocity; }
+
+	// eye position blended between the last two ticks, for the camera.
+	glm::vec3 get_view_origin() const;
+private:
+	void tick(const player_input& input);
+	void noclip_move(const player_input& input);
+	void walk_move(const player_input& input);
+
+	void categorize_position();
+	void apply_friction();
+	void accelerate(const glm::vec3& wishdir, float wishspeed, float accel);
+	bool slide_move(bool gravity);
+	void step_slide_move(bool gravity);
+
+	trace_result trace(const glm::vec3& start, const glm::vec3& end) const;
+
+	const BSPCollision& collision;
+
+	glm::vec3 origin{ 0.0f };
+	glm::vec3 previous_origin{ 0.0f };
+	glm::vec3 velocity{ 0.0f };
+	glm::vec3 ground_normal{ 0.0f, 0.0f, 1.0f };
+	bool on_ground = false;
+	bool jump_held = false;
+	bool noclip = true;
+
+	double accumulator = 0.0;
+};
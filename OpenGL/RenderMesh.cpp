@@ -0,0 +1,86 @@
+#include "RenderMesh.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+
+render_mesh build_render_mesh(const BSPLoader& loader)
+{
+	render_mesh mesh;
+	mesh.vertices = loader.get_vertex_data();
+	mesh.indices = loader.get_indices();
+
+	const std::vector<face>& faces = loader.get_faces();
+	mesh.ranges.resize(faces.size());
+	mesh.face_owners.resize(faces.size());
+	std::iota(mesh.face_owners.begin(), mesh.face_owners.end(), 0);
+
+	// get_indices() packs the drawable faces back to back, so walk them in the same order.
+	unsigned int next = 0;
+	for (int i = 0; i < faces.size(); ++i)
+	{
+		face_range& range = mesh.ranges[i];
+		range.first_index = next;
+		range.n_indices = 0;
+		range.base_vertex = 0;
+
+		if (faces[i].type == 1 || faces[i].type == 3)
+		{
+			range.n_indices = faces[i].n_meshverts;
+			next += range.n_indices;
+		}
+	}
+
+	return mesh;
+}
+
+static int find_root(std::vector<int>& parent, int v)
+{
+	while (parent[v] != v)
+	{
+		parent[v] = parent[parent[v]];
+		v = parent[v];
+	}
+	return v;
+}
+
+void rebase_texcoords(render_mesh& mesh)
+{
+	// vertices joined by triangles have to move together, or the texture tears along the edge.
+	std::vector<int> parent(mesh.vertices.size());
+	std::iota(parent.begin(), parent.end(), 0);
+	for (const face_range& range : mesh.ranges)
+	{
+		for (unsigned int j = 1; j < range.n_indices; ++j)
+		{
+			int a = find_root(parent, mesh.indices[range.first_index + j - 1] + range.base_vertex);
+			int b = find_root(parent, mesh.indices[range.first_index + j] + range.base_vertex);
+			parent[a] = b;
+		}
+	}
+
+	const float none = std::numeric_limits<float>::max();
+	std::vector<glm::vec2> lowest(mesh.vertices.size(), glm::vec2(none));
+	for (int v = 0; v < mesh.vertices.size(); ++v)
+	{
+		glm::vec2& low = lowest[find_root(parent, v)];
+		low.x = std::min(low.x, mesh.vertices[v].texcoord[0][0]);
+		low.y = std::min(low.y, mesh.vertices[v].texcoord[0][1]);
+	}
+
+	for (int v = 0; v < mesh.vertices.size(); ++v)
+	{
+		const glm::vec2& low = lowest[find_root(parent, v)];
+		mesh.vertices[v].texcoord[0][0] -= std::floor(low.x);
+		mesh.vertices[v].texcoord[0][1] -= std::floor(low.y);
+	}
+}
+
+std::vector<int> ranges_in_buffer_order(const render_mesh& mesh)
+{
+	std::vector<int> order(mesh.ranges.size());
+	std::iota(order.begin(), order.end(), 0);
+	std::sort(order.begin(), order.end(), [&](int a, int b) { return mesh.ranges[a].first_index < mesh.ranges[b].first_index; });
+	return order;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "BSPLoader.h"
+
+// where one face's triangles live in the index buffer.
+struct face_range
+{
+	unsigned int first_index;
+	unsigned int n_indices;		// 0 for faces that aren't drawn (patches, billboards)
+	int base_vertex;			// added to each index when drawing
+};
+
+// the vertex and index data that actually gets uploaded to the GPU, plus each face's
+// range within it. the load time passes that reorder or shrink the geometry work on this
+// rather than on the loader's lumps, and keep the ranges up to date as they go.
+struct render_mesh
+{
+	std::vector<vertex> vertices;
+	std::vector<unsigned int> indices;
+	std::vector<face_range> ranges;		// one per file face
+	std::vector<int> face_owners;		// the face whose range draws each face, itself unless merged
+};
+
+// polygon and mesh faces (types 1 and 3) in file order, same as BSPLoader::get_indices().
+render_mesh build_render_mesh(const BSPLoader& loader);
+
+// texcoords on big faces run into the tens or hundreds, where a half float can't place them
+// within a texel. textures repeat, so moving each connected piece of the mesh by whole repeats
+// towards zero looks the same and keeps the compact vertex format precise. run it after welding,
+// so faces that share vertices move as one.
+void rebase_texcoords(render_mesh& mesh);
+
+// indices of the mesh's ranges sorted by where they start in the index buffer.
+std::vector<int> ranges_in_buffer_order(const render_mesh& mesh);
@@ -0,0 +1,54 @@
+#include "SampleCounter.h"
+
+// a query is reused this many frames after it was issued, it's long done by then.
+const int SAMPLE_QUERY_COUNT = 4;
+
+SampleCounter::SampleCounter() :
+	queries(SAMPLE_QUERY_COUNT), issued(SAMPLE_QUERY_COUNT, false)
+{
+	glGenQueries(SAMPLE_QUERY_COUNT, &queries[0]);
+}
+
+SampleCounter::~SampleCounter()
+{
+	glDeleteQueries(SAMPLE_QUERY_COUNT, &queries[0]);
+}
+
+void SampleCounter::begin()
+{
+	// pick up whatever finished since last time, oldest first so the newest result wins.
+	for (int i = 0; i < SAMPLE_QUERY_COUNT; ++i)
+	{
+		int slot = (next + i) % SAMPLE_QUERY_COUNT;
+		if (!issued[slot])
+			continue;
+
+		GLuint available = GL_FALSE;
+		glGetQueryObjectuiv(queries[slot], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available)
+			continue;
+
+		GLuint result = 0;
+		glGetQueryObjectuiv(queries[slot], GL_QUERY_RESULT, &result);
+		samples = result;
+		issued[slot] = false;
+	}
+
+	// the ring is full, the oldest query has to be finished to be reused.
+	if (issued[next])
+	{
+		GLuint result = 0;
+		glGetQueryObjectuiv(queries[next], GL_QUERY_RESULT, &result);
+		samples = result;
+		issued[next] = false;
+	}
+
+	glBeginQuery(GL_SAMPLES_PASSED, queries[next]);
+}
+
+void SampleCounter::end()
+{
+	glEndQuery(GL_SAMPLES_PASSED);
+	issued[next] = true;
+	next = (next + 1) % SAMPLE_QUERY_COUNT;
+}
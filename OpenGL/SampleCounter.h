@@ -0,0 +1,26 @@
+#pragma once
+
+#include <GL\glew.h>
+
+#include <vector>
+
+// counts the samples that pass the depth test between begin() and end() with GL_SAMPLES_PASSED
+// queries. results are read back a few frames late from a small ring of queries rather than
+// waiting on the GPU, so the count lags the picture slightly.
+class SampleCounter
+{
+public:
+	SampleCounter();
+	~SampleCounter();
+
+	void begin();
+	void end();
+
+	// the latest count that came back, -1 until one has.
+	long long get_samples() const { return samples; }
+private:
+	std::vector<GLuint> queries;
+	std::vector<bool> issued;
+	int next = 0;
+	long long samples = -1;
+};
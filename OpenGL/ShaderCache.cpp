@@ -0,0 +1,362 @@
+#include "ShaderCache.h"
+
+#include <chrono>
+#include <fstream>
+
+const char* shader_feature_names[SHADER_FEATURE_COUNT] = {
+	"LIGHTMAP", "VERTEX_COLOUR", "ALPHA_GT0", "ALPHA_LT128", "ALPHA_GE128", "OVERBRIGHT"
+};
+
+// bound to these locations in every program.
+static const char* attribute_names[] = { "position", "colour", "texcoord", "lmcoord", "normal" };
+
+// marks the cache file, bumped whenever its layout changes.
+const unsigned int CACHE_MAGIC = 0x31435351;
+
+// 64 bit FNV-1a, continuing from hash.
+static unsigned long long hash_string(const std::string& text, unsigned long long hash = 14695981039346656037ull)
+{
+	for (unsigned char c : text)
+	{
+		hash ^= c;
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+// a shader's or program's info log.
+static std::string info_log(GLuint object, bool program)
+{
+	GLint length = 0;
+	if (program)
+		glGetProgramiv(object, GL_INFO_LOG_LENGTH, &length);
+	else
+		glGetShaderiv(object, GL_INFO_LOG_LENGTH, &length);
+	if (length <= 0)
+		return "";
+
+	std::vector<GLchar> log(length + 1);
+	if (program)
+		glGetProgramInfoLog(object, length, &length, &log[0]);
+	else
+		glGetShaderInfoLog(object, length, &length, &log[0]);
+	return std::string(&log[0], length);
+}
+
+std::string generate_variant(const char* source, unsigned int features)
+{
+	std::string text = source;
+
+	std::string defines;
+	for (int i = 0; i < SHADER_FEATURE_COUNT; ++i)
+	{
+		if (features & (1 << i))
+			defines += std::string("#define ") + shader_feature_names[i] + "\n";
+	}
+
+	// nothing but comments may come before #version.
+	size_t version = text.find("#version");
+	size_t line_end = version == std::string::npos ? std::string::npos : text.find('\n', version);
+	if (line_end == std::string::npos)
+		return defines + text;
+	return text.insert(line_end + 1, defines);
+}
+
+ShaderCache::ShaderCache(const std::string& path) : path{ path }
+{
+	stats.last_failed = -1;
+	parallel = is_parallel_supported();
+	binaries_supported = is_binary_supported() && !path.empty();
+	if (GLEW_KHR_parallel_shader_compile)
+		glMaxShaderCompilerThreadsKHR(0xffffffff);
+	else if (GLEW_ARB_parallel_shader_compile)
+		glMaxShaderCompilerThreadsARB(0xffffffff);
+
+	// a binary only loads on the driver that wrote it.
+	std::string driver;
+	for (GLenum name : { GL_VENDOR, GL_RENDERER, GL_VERSION })
+	{
+		const GLubyte* value = glGetString(name);
+		if (value)
+			driver += (const char*)value;
+		driver += '\n';
+	}
+	driver_hash = hash_string(driver);
+
+	if (!binaries_supported)
+		return;
+
+	// entries: source hash, driver hash, format, length, then the binary.
+	std::ifstream file(path, std::ios::binary);
+	unsigned int magic = 0;
+	file.read((char*)&magic, sizeof(magic));
+	if (!file || magic != CACHE_MAGIC)
+		return;
+
+	unsigned long long source_hash, entry_driver;
+	unsigned int format, length;
+	while (file.read((char*)&source_hash, sizeof(source_hash)) && file.read((char*)&entry_driver, sizeof(entry_driver)) &&
+		file.read((char*)&format, sizeof(format)) && file.read((char*)&length, sizeof(length)))
+	{
+		program_binary binary{ format, std::vector<ubyte>(length) };
+		if (length > 0 && !file.read((char*)&binary.data[0], length))
+			break;
+		// ones from another driver are dropped the next time the file is written.
+		if (entry_driver == driver_hash)
+			binaries[source_hash] = std::move(binary);
+		else
+			binaries_changed = true;
+	}
+	stats.binaries = binaries.size();
+}
+
+ShaderCache::~ShaderCache()
+{
+	save();
+	for (const cached_program& _program : programs)
+	{
+		if (_program.program)
+			glDeleteProgram(_program.program);
+	}
+}
+
+bool ShaderCache::is_parallel_supported()
+{
+	return GLEW_KHR_parallel_shader_compile || GLEW_ARB_parallel_shader_compile;
+}
+
+bool ShaderCache::is_binary_supported()
+{
+	if (!GLEW_VERSION_4_1 && !GLEW_ARB_get_program_binary)
+		return false;
+
+	// drivers are allowed to support the extension with no formats at all.
+	GLint formats = 0;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+	return formats > 0;
+}
+
+int ShaderCache::request(const std::string& vertex_source, const std::string& fragment_source)
+{
+	return add(hash_string(fragment_source, hash_string(vertex_source + '\0')), vertex_source, fragment_source, false);
+}
+
+int ShaderCache::request_compute(const std::string& compute_source)
+{
+	// the marker keeps it apart from a vertex shader with the same text and no fragment shader.
+	return add(hash_string(compute_source, hash_string(std::string("compute") + '\0')), compute_source, "", true);
+}
+
+int ShaderCache::add(unsigned long long hash, const std::string& vertex_source, const std::string& fragment_source, bool compute)
+{
+	auto found = handles.find(hash);
+	if (found != handles.end())
+		return found->second;
+
+	auto start_time = std::chrono::high_resolution_clock::now();
+
+	int handle = programs.size();
+	handles[hash] = handle;
+	programs.push_back({ vertex_source, fragment_source, hash, 0, compute, false, false });
+	stats.programs++;
+
+	cached_program& _program = programs.back();
+	if (load_binary(_program))
+	{
+		_program.finished = true;
+		_program.vertex_source.clear();
+		_program.fragment_source.clear();
+	}
+	else if (parallel)
+		start(_program);
+
+	stats.milliseconds += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start_time).count();
+	return handle;
+}
+
+GLuint ShaderCache::get(int handle, bool wait)
+{
+	cached_program& _program = programs[handle];
+	if (_program.finished)
+		return _program.program;
+
+	// the driver's threads are still on it, it'll be asked again next frame.
+	if (!wait && _program.started)
+	{
+		GLint complete = GL_FALSE;
+		glGetProgramiv(_program.program, GL_COMPLETION_STATUS_KHR, &complete);
+		if (!complete)
+			return 0;
+	}
+
+	auto start_time = std::chrono::high_resolution_clock::now();
+	if (!_program.started)
+		start(_program);
+	finish(_program);
+	stats.milliseconds += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start_time).count();
+
+	return _program.program;
+}
+
+bool ShaderCache::load_binary(cached_program& _program)
+{
+	auto found = binaries.find(_program.hash);
+	if (found == binaries.end())
+		return false;
+
+	const program_binary& binary = found->second;
+	_program.program = glCreateProgram();
+	glProgramBinary(_program.program, binary.format, binary.data.empty() ? nullptr : &binary.data[0], binary.data.size());
+
+	GLint is_linked = GL_FALSE;
+	glGetProgramiv(_program.program, GL_LINK_STATUS, &is_linked);
+	if (is_linked == GL_FALSE)
+	{
+		// an updated driver can refuse what an older one wrote even with the same strings.
+		glDeleteProgram(_program.program);
+		_program.program = 0;
+		binaries.erase(found);
+		binaries_changed = true;
+		return false;
+	}
+
+	stats.loaded++;
+	return true;
+}
+
+void ShaderCache::start(cached_program& _program)
+{
+	_program.program = glCreateProgram();
+	if (binaries_supported)
+		glProgramParameteri(_program.program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	_program.started = true;
+	if (parallel)
+		stats.pending++;
+
+	if (_program.compute)
+	{
+		const char* compute_source = _program.vertex_source.c_str();
+		GLuint compute_shader = glCreateShader(GL_COMPUTE_SHADER);
+		glShaderSource(compute_shader, 1, &compute_source, NULL);
+		glCompileShader(compute_shader);
+
+		glAttachShader(_program.program, compute_shader);
+		glLinkProgram(_program.program);
+		glDeleteShader(compute_shader);
+		return;
+	}
+
+	const char* vertex_source = _program.vertex_source.c_str();
+	GLuint vertex_shader = glCreateShader(GL_VERTEX_SHADER);
+	glShaderSource(vertex_shader, 1, &vertex_source, NULL);
+	glCompileShader(vertex_shader);
+
+	const char* fragment_source = _program.fragment_source.c_str();
+	GLuint fragment_shader = glCreateShader(GL_FRAGMENT_SHADER);
+	glShaderSource(fragment_shader, 1, &fragment_source, NULL);
+	glCompileShader(fragment_shader);
+
+	glAttachShader(_program.program, vertex_shader);
+	glAttachShader(_program.program, fragment_shader);
+	for (GLuint i = 0; i < 5; ++i)
+		glBindAttribLocation(_program.program, i, attribute_names[i]);
+	glBindFragDataLocation(_program.program, 0, "outColor");
+	glLinkProgram(_program.program);
+
+	// flagged for deletion, they go with the program.
+	glDeleteShader(vertex_shader);
+	glDeleteShader(fragment_shader);
+}
+
+void ShaderCache::finish(cached_program& _program)
+{
+	// with parallel compiling this is where the wait is, if there is one.
+	GLint is_linked = GL_FALSE;
+	glGetProgramiv(_program.program, GL_LINK_STATUS, &is_linked);
+
+	_program.finished = true;
+	if (parallel)
+		stats.pending--;
+
+	if (is_linked == GL_FALSE)
+	{
+		// the shaders are still attached, so the compile logs of the ones that failed are there
+		// to go with the link log. get() hands back 0.
+		GLuint shaders[2];
+		GLsizei shader_count = 0;
+		glGetAttachedShaders(_program.program, 2, &shader_count, shaders);
+		for (int i = 0; i < shader_count; ++i)
+		{
+			GLint is_compiled = GL_FALSE;
+			glGetShaderiv(shaders[i], GL_COMPILE_STATUS, &is_compiled);
+			if (is_compiled == GL_FALSE)
+				_program.log += info_log(shaders[i], false);
+		}
+		_program.log += info_log(_program.program, true);
+
+		glDeleteProgram(_program.program);
+		_program.program = 0;
+		stats.failed++;
+		stats.last_failed = &_program - &programs[0];
+		return;
+	}
+
+	_program.vertex_source.clear();
+	_program.fragment_source.clear();
+	stats.compiled++;
+
+	if (binaries_supported)
+	{
+		GLint length = 0;
+		glGetProgramiv(_program.program, GL_PROGRAM_BINARY_LENGTH, &length);
+		if (length > 0)
+		{
+			program_binary binary{ 0, std::vector<ubyte>(length) };
+			glGetProgramBinary(_program.program, length, &length, &binary.format, &binary.data[0]);
+			binary.data.resize(length);
+			binaries[_program.hash] = std::move(binary);
+			binaries_changed = true;
+			stats.binaries = binaries.size();
+		}
+	}
+}
+
+void ShaderCache::save()
+{
+	if (!binaries_supported)
+		return;
+
+	// only what this run asked for is kept, so binaries of sources that have since been edited
+	// don't pile up. they're dropped here too, so saving again finds nothing to write.
+	for (auto entry = binaries.begin(); entry != binaries.end();)
+	{
+		if (handles.count(entry->first) == 0)
+		{
+			entry = binaries.erase(entry);
+			binaries_changed = true;
+		}
+		else
+			++entry;
+	}
+	stats.binaries = binaries.size();
+	if (!binaries_changed)
+		return;
+
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	if (!file)
+		return;
+
+	file.write((const char*)&CACHE_MAGIC, sizeof(CACHE_MAGIC));
+	for (const auto& entry : binaries)
+	{
+		unsigned int format = entry.second.format;
+		unsigned int length = entry.second.data.size();
+		file.write((const char*)&entry.first, sizeof(entry.first));
+		file.write((const char*)&driver_hash, sizeof(driver_hash));
+		file.write((const char*)&format, sizeof(format));
+		file.write((const char*)&length, sizeof(length));
+		if (length > 0)
+			file.write((const char*)&entry.second.data[0], length);
+	}
+	binaries_changed = false;
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include "BSPLoader.h"
+
+#include <unordered_map>
+
+// feature bits a program variant is generated with. each set bit becomes a #define of the name in
+// shader_feature_names right after the template's #version line, so one template written with
+// #ifdefs covers every combination without branching at run time.
+enum shader_feature
+{
+	SHADER_LIGHTMAP = 1 << 0,		// modulated by the lightmap atlas, with the overbright the lightmaps need
+	SHADER_VERTEX_COLOUR = 1 << 1,	// modulated by the vertex colour, Q3's vertex lighting on its own
+	SHADER_ALPHA_GT0 = 1 << 2,		// the alpha tests of a stage's alphaFunc
+	SHADER_ALPHA_LT128 = 1 << 3,
+	SHADER_ALPHA_GE128 = 1 << 4,
+	SHADER_OVERBRIGHT = 1 << 5		// the result times the lightmap overbright, for stages drawing the lightmap itself
+};
+
+const int SHADER_FEATURE_COUNT = 6;
+extern const char* shader_feature_names[SHADER_FEATURE_COUNT];
+
+// the template's source with the features defined.
+std::string generate_variant(const char* source, unsigned int features);
+
+struct shader_cache_stats
+{
+	int programs;			// different programs asked for
+	int compiled;			// built from source
+	int loaded;				// linked from a cached binary instead
+	int failed;
+	int pending;			// being compiled in the background
+	int last_failed;		// handle of the last program that failed, -1 if none has
+	int binaries;			// in the cache file, for this driver
+	double milliseconds;	// spent building programs on this thread, waits included
+};
+
+// vertex and fragment programs built on demand and kept by the hash of their source. with
+// KHR_parallel_shader_compile a new program is compiled and linked by the driver's threads while
+// the caller gets on with other things, and asked for again once it's needed. without it the
+// compile waits for the program's first use, so programs that are never drawn cost nothing.
+// linked programs are saved with glGetProgramBinary to one cache file, keyed by the source hash and
+// a hash of the driver's vendor, renderer and version strings; next time they link straight from
+// that with no compile at all. a binary the driver turns down is compiled again and replaced.
+// every program gets the vertex attributes bound to the same locations, so one vertex array can
+// feed any of them. compute programs go through the same cache. a program that fails keeps the
+// compile and link logs of its shaders.
+class ShaderCache
+{
+public:
+	// path is the cache file, empty to keep nothing on disk.
+	ShaderCache(const std::string& path);
+	~ShaderCache();
+
+	static bool is_parallel_supported();
+	static bool is_binary_supported();
+
+	// the handle of the program built from these sources, starting on it if it's new.
+	int request(const std::string& vertex_source, const std::string& fragment_source);
+	// the same for a compute program, GL 4.3.
+	int request_compute(const std::string& compute_source);
+	// the linked program, 0 if it failed to build. without wait, 0 as well while it isn't ready yet.
+	GLuint get(int handle, bool wait = true);
+	// what the compiler and linker had to say about a program that failed, empty otherwise.
+	const std::string& get_log(int handle) const { return programs[handle].log; }
+
+	// writes the cache file with the binaries of the programs requested so far, if that's
+	// different from what was read.
+	void save();
+
+	const shader_cache_stats& get_stats() const { return stats; }
+private:
+	struct cached_program
+	{
+		std::string vertex_source;		// dropped once it's compiled, the compute source for compute programs
+		std::string fragment_source;
+		unsigned long long hash;
+		GLuint program;
+		bool compute;
+		bool started;
+		bool finished;
+		std::string log;
+	};
+
+	struct program_binary
+	{
+		GLenum format;
+		std::vector<ubyte> data;
+	};
+
+	int add(unsigned long long hash, const std::string& vertex_source, const std::string& fragment_source, bool compute);
+	bool load_binary(cached_program& _program);
+	void start(cached_program& _program);
+	void finish(cached_program& _program);
+
+	std::string path;
+	unsigned long long driver_hash;
+	bool parallel;
+	bool binaries_supported;
+
+	std::vector<cached_program> programs;
+	std::unordered_map<unsigned long long, int> handles;			// by source hash
+	std::unordered_map<unsigned long long, program_binary> binaries;	// by source hash
+	bool binaries_changed = false;
+
+	shader_cache_stats stats{};
+};
@@ -0,0 +1,368 @@
+#include "SoftwareOcclusion.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <emmintrin.h>
+
+const int TILES_X = OCCLUSION_WIDTH / OCCLUSION_TILE_WIDTH;
+const int TILES_Y = OCCLUSION_HEIGHT / OCCLUSION_TILE_HEIGHT;
+
+// a box only counts as hidden if the occluders are this much nearer, covers rounding in the
+// interpolated depth so faces lying on an occluder don't hide themselves.
+const float DEPTH_BIAS = 1.001f;
+
+SoftwareOcclusion::SoftwareOcclusion(const BSPLoader& loader, const render_mesh& mesh, WorkerPool& pool) :
+	loader{ loader }, pool{ pool }, face_owners{ mesh.face_owners }
+{
+	const std::vector<face>& faces = loader.get_faces();
+	face_triangles.resize(faces.size(), 0);
+	face_mins.resize(faces.size(), glm::vec3(0.0f));
+	face_maxs.resize(faces.size(), glm::vec3(0.0f));
+	occluder_first.resize(faces.size(), -1);
+	occluder_area.resize(faces.size(), 0.0f);
+	face_visframe.resize(faces.size(), -1);
+	bins.resize(TILES_X * TILES_Y);
+	depth.resize(OCCLUSION_WIDTH * OCCLUSION_HEIGHT, 0.0f);
+
+	for (int i = 0; i < faces.size(); ++i)
+	{
+		const face_range& range = mesh.ranges[i];
+		if (range.n_indices == 0)
+			continue;
+
+		face_triangles[i] = range.n_indices / 3;
+		std::vector<glm::vec3> points;
+		for (unsigned int j = 0; j < range.n_indices; ++j)
+		{
+			const vertex& v = mesh.vertices[mesh.indices[range.first_index + j] + range.base_vertex];
+			points.push_back(glm::vec3(v.position[0], v.position[1], v.position[2]));
+		}
+
+		face_mins[i] = face_maxs[i] = points[0];
+		for (const glm::vec3& point : points)
+		{
+			face_mins[i] = glm::min(face_mins[i], point);
+			face_maxs[i] = glm::max(face_maxs[i], point);
+		}
+
+		// only flat, solid looking faces occlude. curved meshes are small and see through ones obviously can't.
+		const shader& _shader = loader.get_shader(faces[i].texture);
+		if (faces[i].type != 1 || !_shader.render || _shader.transparent)
+			continue;
+
+		float area = 0.0f;
+		for (int j = 0; j + 2 < points.size(); j += 3)
+			area += glm::length(glm::cross(points[j + 1] - points[j], points[j + 2] - points[j])) * 0.5f;
+		if (area < MIN_OCCLUDER_AREA)
+			continue;
+
+		occluder_first[i] = occluder_vertices.size();
+		occluder_area[i] = area;
+		occluder_vertices.insert(occluder_vertices.end(), points.begin(), points.end());
+	}
+}
+
+void SoftwareOcclusion::select_occluders(const Visibility& visibility, const glm::vec3& position)
+{
+	// projected size goes with area over distance squared.
+	std::vector<std::pair<float, int>> candidates;
+	for (int face_index : visibility.get_visible_faces())
+	{
+		if (occluder_first[face_index] < 0)
+			continue;
+
+		glm::vec3 offset = (face_mins[face_index] + face_maxs[face_index]) * 0.5f - position;
+		candidates.push_back({ occluder_area[face_index] / std::max(glm::dot(offset, offset), 1.0f), face_index });
+	}
+	std::sort(candidates.begin(), candidates.end(), [](const std::pair<float, int>& a, const std::pair<float, int>& b)
+	{
+		return a.first > b.first;
+	});
+
+	occluders.clear();
+	int budget = MAX_OCCLUDER_TRIANGLES;
+	for (const std::pair<float, int>& candidate : candidates)
+	{
+		if (face_triangles[candidate.second] > budget)
+			continue;
+		budget -= face_triangles[candidate.second];
+		occluders.push_back(candidate.second);
+	}
+}
+
+void SoftwareOcclusion::setup_triangle(const glm::vec4 clipped[3])
+{
+	float x[3], y[3], z[3];
+	for (int i = 0; i < 3; ++i)
+	{
+		z[i] = 1.0f / clipped[i].w;
+		x[i] = (clipped[i].x * z[i] * 0.5f + 0.5f) * OCCLUSION_WIDTH;
+		y[i] = (clipped[i].y * z[i] * 0.5f + 0.5f) * OCCLUSION_HEIGHT;
+	}
+
+	// front faces are clockwise on screen, flip them so the edge functions are positive inside.
+	float area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+	if (area > -1e-6f)
+		return;
+	std::swap(x[1], x[2]);
+	std::swap(y[1], y[2]);
+	std::swap(z[1], z[2]);
+	area = -area;
+
+	screen_triangle triangle;
+	triangle.min_x = std::max(0, (int)std::floor(std::min({ x[0], x[1], x[2] })));
+	triangle.min_y = std::max(0, (int)std::floor(std::min({ y[0], y[1], y[2] })));
+	triangle.max_x = std::min(OCCLUSION_WIDTH, (int)std::ceil(std::max({ x[0], x[1], x[2] })));
+	triangle.max_y = std::min(OCCLUSION_HEIGHT, (int)std::ceil(std::max({ y[0], y[1], y[2] })));
+	if (triangle.min_x >= triangle.max_x || triangle.min_y >= triangle.max_y)
+		return;
+
+	// edge i runs from vertex i to the next, and weighs the vertex opposite it when interpolating.
+	for (int i = 0; i < 3; ++i)
+	{
+		int next = (i + 1) % 3;
+		triangle.edges[i][0] = y[i] - y[next];
+		triangle.edges[i][1] = x[next] - x[i];
+		triangle.edges[i][2] = -(triangle.edges[i][0] * x[i] + triangle.edges[i][1] * y[i]);
+	}
+	for (int k = 0; k < 3; ++k)
+		triangle.depth[k] = (triangle.edges[1][k] * z[0] + triangle.edges[2][k] * z[1] + triangle.edges[0][k] * z[2]) / area;
+
+	int index = triangles.size();
+	triangles.push_back(triangle);
+	for (int ty = triangle.min_y / OCCLUSION_TILE_HEIGHT; ty <= (triangle.max_y - 1) / OCCLUSION_TILE_HEIGHT; ++ty)
+	{
+		for (int tx = triangle.min_x / OCCLUSION_TILE_WIDTH; tx <= (triangle.max_x - 1) / OCCLUSION_TILE_WIDTH; ++tx)
+			bins[ty * TILES_X + tx].push_back(index);
+	}
+}
+
+void SoftwareOcclusion::rasterize_tile(int tile)
+{
+	int tile_x = (tile % TILES_X) * OCCLUSION_TILE_WIDTH;
+	int tile_y = (tile / TILES_X) * OCCLUSION_TILE_HEIGHT;
+
+	for (int y = tile_y; y < tile_y + OCCLUSION_TILE_HEIGHT; ++y)
+		std::fill_n(&depth[y * OCCLUSION_WIDTH + tile_x], OCCLUSION_TILE_WIDTH, 0.0f);
+
+	const __m128 lane_offsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+	const __m128 zero = _mm_setzero_ps();
+	for (int index : bins[tile])
+	{
+		const screen_triangle& triangle = triangles[index];
+		int x0 = std::max(triangle.min_x, tile_x) & ~3;
+		int x1 = std::min(triangle.max_x, tile_x + OCCLUSION_TILE_WIDTH);
+		int y0 = std::max(triangle.min_y, tile_y);
+		int y1 = std::min(triangle.max_y, tile_y + OCCLUSION_TILE_HEIGHT);
+
+		__m128 edge_a[3], depth_a = _mm_set1_ps(triangle.depth[0]);
+		for (int i = 0; i < 3; ++i)
+			edge_a[i] = _mm_set1_ps(triangle.edges[i][0]);
+
+		for (int y = y0; y < y1; ++y)
+		{
+			// the b * y + c part is the same along the row.
+			float py = y + 0.5f;
+			__m128 edge_row[3];
+			for (int i = 0; i < 3; ++i)
+				edge_row[i] = _mm_set1_ps(triangle.edges[i][1] * py + triangle.edges[i][2]);
+			__m128 depth_row = _mm_set1_ps(triangle.depth[1] * py + triangle.depth[2]);
+
+			float* row = &depth[y * OCCLUSION_WIDTH];
+			for (int x = x0; x < x1; x += 4)
+			{
+				__m128 px = _mm_add_ps(_mm_set1_ps((float)x), lane_offsets);
+				__m128 inside = _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(edge_a[0], px), edge_row[0]), zero);
+				inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(edge_a[1], px), edge_row[1]), zero));
+				inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(edge_a[2], px), edge_row[2]), zero));
+				if (_mm_movemask_ps(inside) == 0)
+					continue;
+
+				__m128 old_depth = _mm_loadu_ps(row + x);
+				__m128 new_depth = _mm_max_ps(old_depth, _mm_add_ps(_mm_mul_ps(depth_a, px), depth_row));
+				_mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, new_depth), _mm_andnot_ps(inside, old_depth)));
+			}
+		}
+	}
+}
+
+bool SoftwareOcclusion::box_visible(const glm::vec3& mins, const glm::vec3& maxs) const
+{
+	float min_x = OCCLUSION_WIDTH, min_y = OCCLUSION_HEIGHT, max_x = 0.0f, max_y = 0.0f;
+	float nearest = 0.0f;
+	for (int corner = 0; corner < 8; ++corner)
+	{
+		glm::vec4 point = clip * glm::vec4(corner & 1 ? maxs.x : mins.x, corner & 2 ? maxs.y : mins.y, corner & 4 ? maxs.z : mins.z, 1.0f);
+
+		// reaching through the near plane, there's nothing sensible to project.
+		if (point.z + point.w <= 0.0f)
+			return true;
+
+		float inv_w = 1.0f / point.w;
+		float x = (point.x * inv_w * 0.5f + 0.5f) * OCCLUSION_WIDTH;
+		float y = (point.y * inv_w * 0.5f + 0.5f) * OCCLUSION_HEIGHT;
+		min_x = std::min(min_x, x);
+		min_y = std::min(min_y, y);
+		max_x = std::max(max_x, x);
+		max_y = std::max(max_y, y);
+		nearest = std::max(nearest, inv_w);
+	}
+
+	int x0 = std::max(0, (int)std::floor(min_x));
+	int y0 = std::max(0, (int)std::floor(min_y));
+	int x1 = std::min(OCCLUSION_WIDTH, (int)std::ceil(max_x));
+	int y1 = std::min(OCCLUSION_HEIGHT, (int)std::ceil(max_y));
+	if (x0 >= x1 || y0 >= y1)
+		return true;
+
+	// any covered pixel with no occluder in front of the nearest corner lets the box through.
+	const __m128 lanes = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+	__m128 threshold = _mm_set1_ps(nearest * DEPTH_BIAS);
+	__m128 first = _mm_set1_ps((float)x0), last = _mm_set1_ps((float)x1);
+	for (int y = y0; y < y1; ++y)
+	{
+		const float* row = &depth[y * OCCLUSION_WIDTH];
+		for (int x = x0 & ~3; x < x1; x += 4)
+		{
+			__m128 px = _mm_add_ps(_mm_set1_ps((float)x), lanes);
+			__m128 in_box = _mm_and_ps(_mm_cmpge_ps(px, first), _mm_cmplt_ps(px, last));
+			__m128 open = _mm_cmple_ps(_mm_loadu_ps(row + x), threshold);
+			if (_mm_movemask_ps(_mm_and_ps(in_box, open)))
+				return true;
+		}
+	}
+	return false;
+}
+
+void SoftwareOcclusion::cull(const Visibility& visibility, const glm::vec3& position, const glm::mat4& clip)
+{
+	if (visibility.get_version() == source_version)
+		return;
+	source_version = visibility.get_version();
+	this->clip = clip;
+
+	auto start_time = std::chrono::high_resolution_clock::now();
+
+	select_occluders(visibility, position);
+	triangles.clear();
+	for (std::vector<int>& bin : bins)
+		bin.clear();
+
+	for (int face_index : occluders)
+	{
+		const glm::vec3* points = &occluder_vertices[occluder_first[face_index]];
+		for (int i = 0; i < face_triangles[face_index] * 3; i += 3)
+		{
+			glm::vec4 corners[3];
+			for (int k = 0; k < 3; ++k)
+				corners[k] = clip * glm::vec4(points[i + k], 1.0f);
+
+			// clip against the near plane (z + w >= 0), leaving at most a quad to fan out.
+			glm::vec4 polygon[4];
+			int n_points = 0;
+			for (int k = 0; k < 3; ++k)
+			{
+				const glm::vec4& a = corners[k];
+				const glm::vec4& b = corners[(k + 1) % 3];
+				float da = a.z + a.w, db = b.z + b.w;
+				if (da >= 0.0f)
+					polygon[n_points++] = a;
+				if ((da >= 0.0f) != (db >= 0.0f))
+					polygon[n_points++] = a + (b - a) * (da / (da - db));
+			}
+
+			for (int k = 1; k + 1 < n_points; ++k)
+			{
+				glm::vec4 fan[3] = { polygon[0], polygon[k], polygon[k + 1] };
+				setup_triangle(fan);
+			}
+		}
+	}
+
+	pool.parallel_for(TILES_X * TILES_Y, 1, [this](int begin, int end)
+	{
+		for (int tile = begin; tile < end; ++tile)
+			rasterize_tile(tile);
+	});
+
+	auto raster_time = std::chrono::high_resolution_clock::now();
+
+	// leaf boxes first, then the faces of the leaves that got through.
+	const std::vector<leaf>& leafs = loader.get_leafs();
+	const std::vector<leafface>& leaffaces = loader.get_leaffaces();
+	const std::vector<int>& visible_leafs = visibility.get_visible_leafs();
+	leaf_results.resize(visible_leafs.size());
+	pool.parallel_for(visible_leafs.size(), 64, [&](int begin, int end)
+	{
+		for (int i = begin; i < end; ++i)
+		{
+			const leaf& _leaf = leafs[visible_leafs[i]];
+			leaf_results[i] = box_visible(glm::vec3(_leaf.mins[0], _leaf.mins[1], _leaf.mins[2]),
+				glm::vec3(_leaf.maxs[0], _leaf.maxs[1], _leaf.maxs[2]));
+		}
+	});
+
+	visframe++;
+	tested_faces.clear();
+	stats.leafs_occluded = 0;
+	for (int i = 0; i < visible_leafs.size(); ++i)
+	{
+		if (!leaf_results[i])
+		{
+			stats.leafs_occluded++;
+			continue;
+		}
+
+		const leaf& _leaf = leafs[visible_leafs[i]];
+		for (int j = 0; j < _leaf.n_leaffaces; ++j)
+		{
+			int face_index = face_owners[leaffaces[_leaf.leaffaces + j].face];
+			if (face_visframe[face_index] == visframe)
+				continue;
+
+			face_visframe[face_index] = visframe;
+			tested_faces.push_back(face_index);
+		}
+	}
+
+	face_results.resize(tested_faces.size());
+	pool.parallel_for(tested_faces.size(), 64, [&](int begin, int end)
+	{
+		for (int i = begin; i < end; ++i)
+		{
+			int face_index = tested_faces[i];
+			face_results[i] = face_triangles[face_index] == 0 || box_visible(face_mins[face_index], face_maxs[face_index]);
+		}
+	});
+
+	// occluded faces lose their mark, so the visibility's list can be filtered in its own order.
+	for (int i = 0; i < tested_faces.size(); ++i)
+	{
+		if (!face_results[i])
+			face_visframe[tested_faces[i]] = -1;
+	}
+
+	visible_faces.clear();
+	stats.faces_occluded = 0;
+	stats.triangles_occluded = 0;
+	for (int face_index : visibility.get_visible_faces())
+	{
+		if (face_visframe[face_index] == visframe)
+			visible_faces.push_back(face_index);
+		else
+		{
+			stats.faces_occluded++;
+			stats.triangles_occluded += face_triangles[face_index];
+		}
+	}
+
+	auto end_time = std::chrono::high_resolution_clock::now();
+
+	stats.occluder_faces = occluders.size();
+	stats.occluder_triangles = triangles.size();
+	stats.leafs_tested = visible_leafs.size();
+	stats.faces_tested = tested_faces.size();
+	stats.raster_milliseconds = std::chrono::duration<double, std::milli>(raster_time - start_time).count();
+	stats.test_milliseconds = std::chrono::duration<double, std::milli>(end_time - raster_time).count();
+}
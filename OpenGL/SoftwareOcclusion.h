@@ -0,0 +1,92 @@
+#pragma once
+
+#include "Visibility.h"
+#include "WorkerPool.h"
+
+// the CPU depth buffer, a third of the 800x600 window each way. both sizes are multiples of the
+// tile size, and tiles are a multiple of 4 pixels wide so SSE rows never straddle two tiles.
+const int OCCLUSION_WIDTH = 256;
+const int OCCLUSION_HEIGHT = 192;
+const int OCCLUSION_TILE_WIDTH = 64;
+const int OCCLUSION_TILE_HEIGHT = 32;
+
+// faces smaller than this many square units aren't worth rasterizing as occluders.
+const float MIN_OCCLUDER_AREA = 128.0f * 128.0f;
+// the most occluder triangles drawn in a frame, big faces close to the camera go first.
+const int MAX_OCCLUDER_TRIANGLES = 1024;
+
+struct occlusion_stats
+{
+	int occluder_faces;
+	int occluder_triangles;		// after backface culling and near plane clipping
+	int leafs_tested;
+	int leafs_occluded;
+	int faces_tested;			// faces of the leaves that weren't occluded
+	int faces_occluded;			// by their leaf's box or their own
+	int triangles_occluded;		// triangles of the occluded faces, the GPU never sees them
+	double raster_milliseconds;
+	double test_milliseconds;
+};
+
+// software occlusion culling on top of Visibility. the biggest opaque faces in view are
+// rasterized into a small depth buffer on the worker pool, one tile per job with 4 pixels at a
+// time in SSE, then the visible leaves' boxes are tested against it and the faces of those that
+// survive have their own boxes tested. the test is conservative: a box is only thrown out if every
+// pixel it covers has an occluder in front of its nearest corner.
+class SoftwareOcclusion
+{
+public:
+	SoftwareOcclusion(const BSPLoader& loader, const render_mesh& mesh, WorkerPool& pool);
+
+	// clip is the proj * view * model matrix the frame is drawn with, position the camera in BSP
+	// space. does nothing if visibility hasn't changed since the last call.
+	void cull(const Visibility& visibility, const glm::vec3& position, const glm::mat4& clip);
+
+	// the visibility's faces, less the occluded ones. same order.
+	const std::vector<int>& get_visible_faces() const { return visible_faces; }
+	const occlusion_stats& get_stats() const { return stats; }
+	// 1 / w per pixel, 0 where no occluder was drawn. row 0 is the bottom of the screen.
+	const std::vector<float>& get_depth() const { return depth; }
+private:
+	// screen space, wound counter clockwise, with the depth and edge functions set up for drawing.
+	struct screen_triangle
+	{
+		float edges[3][3];		// a * x + b * y + c, positive inside
+		float depth[3];			// 1 / w the same way
+		int min_x, min_y, max_x, max_y;
+	};
+
+	void select_occluders(const Visibility& visibility, const glm::vec3& position);
+	void setup_triangle(const glm::vec4 clipped[3]);
+	void rasterize_tile(int tile);
+	bool box_visible(const glm::vec3& mins, const glm::vec3& maxs) const;
+
+	const BSPLoader& loader;
+	WorkerPool& pool;
+
+	std::vector<int> face_owners;
+	std::vector<int> face_triangles;		// per face, its range's triangle count
+	std::vector<glm::vec3> face_mins;
+	std::vector<glm::vec3> face_maxs;
+
+	// triangle soups of the faces big enough to occlude, -1 first vertex for the rest.
+	std::vector<int> occluder_first;
+	std::vector<float> occluder_area;
+	std::vector<glm::vec3> occluder_vertices;
+
+	glm::mat4 clip;
+	std::vector<float> depth;
+	std::vector<int> occluders;
+	std::vector<screen_triangle> triangles;
+	std::vector<std::vector<int>> bins;		// triangles touching each tile
+
+	std::vector<ubyte> leaf_results;
+	std::vector<int> tested_faces;
+	std::vector<ubyte> face_results;
+	std::vector<int> face_visframe;
+	int visframe = 0;
+
+	std::vector<int> visible_faces;
+	int source_version = -1;
+	occlusion_stats stats{};
+};
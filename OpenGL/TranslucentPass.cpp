@@ -0,0 +1,86 @@
+#include "TranslucentPass.h"
+
+TranslucentPass::TranslucentPass(const BSPLoader& loader, const packed_indices& packed, DrawOrder& order,
+	const MaterialTable& materials, const std::vector<int>& texture_materials) :
+	loader{ loader }, packed{ packed }, order{ order }
+{
+	for (int i = 0; i < loader.get_textures().size(); ++i)
+	{
+		shader _shader = loader.get_shader(i);
+		texture_translucent.push_back(_shader.render && _shader.transparent);
+
+		// only the first stage lands on what's behind, later ones blend with the stages under them.
+		blend_state blend{ GL_ONE, GL_ONE };
+		const material& _material = materials.get(texture_materials[i]);
+		if (_material.blended)
+			stage_blend(_material.stages[0].state, blend.src, blend.dst);
+		texture_blends.push_back(blend);
+	}
+}
+
+void TranslucentPass::build(const glm::vec3& position, const std::vector<int>& faces, int version)
+{
+	if (version == built_version && position == built_position)
+		return;
+
+	built_version = version;
+	built_position = position;
+	stats.rebuilds++;
+
+	opaque_faces.clear();
+	translucent_faces.clear();
+	for (int face_index : faces)
+	{
+		if (texture_translucent[loader.get_face(face_index).texture])
+			translucent_faces.push_back(face_index);
+		else
+			opaque_faces.push_back(face_index);
+	}
+
+	batches.clear();
+	const std::vector<int>& ordered = order.back_to_front(position, translucent_faces);
+	for (int i = 0; i < ordered.size();)
+	{
+		blend_state blend = texture_blends[loader.get_face(ordered[i]).texture];
+		run.clear();
+		for (; i < ordered.size() && texture_blends[loader.get_face(ordered[i]).texture] == blend; ++i)
+			run.push_back(ordered[i]);
+
+		batches.push_back(batch());
+		batches.back().blend = blend;
+		batches.back().draws = build_ordered_draws(packed, run);
+	}
+
+	stats.faces = translucent_faces.size();
+	stats.batches = batches.size();
+	stats.draw_calls = 0;
+	for (const batch& _batch : batches)
+		stats.draw_calls += _batch.draws.size();
+}
+
+void TranslucentPass::draw()
+{
+	if (batches.empty())
+		return;
+
+	GLboolean depth_mask;
+	glGetBooleanv(GL_DEPTH_WRITEMASK, &depth_mask);
+	GLboolean blend_enabled = glIsEnabled(GL_BLEND);
+
+	// tested against the opaque depth, but they mustn't hide each other.
+	glDepthMask(GL_FALSE);
+	glEnable(GL_BLEND);
+	for (const batch& _batch : batches)
+	{
+		glBlendFunc(_batch.blend.src, _batch.blend.dst);
+		for (const multi_draw& draw : _batch.draws)
+		{
+			glMultiDrawElementsBaseVertex(GL_TRIANGLES, &draw.counts[0], draw.type, &draw.offsets[0],
+				draw.counts.size(), &draw.base_vertices[0]);
+		}
+	}
+
+	glDepthMask(depth_mask);
+	if (!blend_enabled)
+		glDisable(GL_BLEND);
+}
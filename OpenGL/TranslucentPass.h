@@ -0,0 +1,76 @@
+#pragma once
+
+#include "DrawOrder.h"
+#include "IndexPacking.h"
+#include "Materials.h"
+
+struct blend_state
+{
+	GLenum src;
+	GLenum dst;
+
+	bool operator==(const blend_state& other) const { return src == other.src && dst == other.dst; }
+	bool operator!=(const blend_state& other) const { return !(*this == other); }
+};
+
+struct translucent_stats
+{
+	int faces;				// translucent faces in the set this frame
+	int batches;			// runs of faces sharing a blend state, one blend change each
+	int draw_calls;
+	int rebuilds;			// times the order was worked out again
+};
+
+// draws the faces whose shader is transparent after the opaque pass, blended, back to front. the
+// order comes from the BSP walk in DrawOrder rather than a distance sort, so it's linear in the
+// tree and only redone when the camera or the face set changes. faces next to each other in that
+// order with the same blend state are drawn together, so the blend function only changes between
+// runs. faces that share a leaf aren't sorted among themselves.
+class TranslucentPass
+{
+public:
+	// texture_materials is the material of each BSP texture, see MaterialTable::resolve_textures().
+	TranslucentPass(const BSPLoader& loader, const packed_indices& packed, DrawOrder& order,
+		const MaterialTable& materials, const std::vector<int>& texture_materials);
+
+	// splits faces into opaque and translucent and orders the translucent ones from position (in
+	// BSP space). does nothing if neither position nor version changed since the last call.
+	void build(const glm::vec3& position, const std::vector<int>& faces, int version);
+	// faces given to the next build() aren't the ones the version was last seen with.
+	void invalidate() { built_version = -1; }
+
+	// the given faces less the translucent ones, same order.
+	const std::vector<int>& get_opaque_faces() const { return opaque_faces; }
+
+	// draws with whatever program, vertex array and textures are bound, leaving depth writes and
+	// blending as they were.
+	void draw();
+
+	const translucent_stats& get_stats() const { return stats; }
+private:
+	struct batch
+	{
+		blend_state blend;
+		std::vector<multi_draw> draws;
+	};
+
+	const BSPLoader& loader;
+	const packed_indices& packed;
+	DrawOrder& order;
+
+	// per texture, from the first stage of its material. one whose first stage doesn't blend, the
+	// implicit defaults included, is taken as additive, which is what most of Q3's glass, flares
+	// and beams use.
+	std::vector<bool> texture_translucent;
+	std::vector<blend_state> texture_blends;
+
+	std::vector<int> opaque_faces;
+	std::vector<int> translucent_faces;
+	std::vector<int> run;
+	std::vector<batch> batches;
+
+	glm::vec3 built_position;
+	int built_version = -1;
+
+	translucent_stats stats{};
+};
@@ -0,0 +1,211 @@
+#include "VertexFormat.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+struct vertex_attribute
+{
+	const char* name;
+	GLint size;
+	GLenum type;
+	GLboolean normalized;
+	int offset;
+};
+
+static unsigned short to_unorm16(float value)
+{
+	return (unsigned short)std::lround(std::min(std::max(value, 0.0f), 1.0f) * 65535.0f);
+}
+
+static short to_snorm16(float value)
+{
+	return (short)std::lround(std::min(std::max(value, -1.0f), 1.0f) * 32767.0f);
+}
+
+// round to nearest, overflow goes to infinity and tiny values flush to zero.
+static unsigned short to_half(float value)
+{
+	unsigned int bits;
+	memcpy(&bits, &value, sizeof(bits));
+
+	unsigned short sign = (bits >> 16) & 0x8000;
+	int exponent = (int)((bits >> 23) & 0xff) - 127 + 15;
+	unsigned int mantissa = bits & 0x7fffff;
+
+	if (exponent >= 31)
+		return sign | 0x7c00;
+	if (exponent <= 0)
+	{
+		// denormal half, shift the implicit 1 in.
+		if (exponent < -10)
+			return sign;
+		mantissa |= 0x800000;
+		int shift = 14 - exponent;
+		return sign | (unsigned short)((mantissa + (1 << (shift - 1))) >> shift);
+	}
+
+	// the carry from rounding can bump the exponent, which is still the right answer.
+	return sign | (unsigned short)(((exponent << 10) | (mantissa >> 13)) + ((mantissa >> 12) & 1));
+}
+
+// unit vector to the octahedral square in [-1, 1]^2.
+static void oct_encode(const float normal[3], float out[2])
+{
+	float length = std::fabs(normal[0]) + std::fabs(normal[1]) + std::fabs(normal[2]);
+	if (length == 0.0f)
+	{
+		out[0] = out[1] = 0.0f;
+		return;
+	}
+
+	float x = normal[0] / length, y = normal[1] / length;
+	if (normal[2] < 0.0f)
+	{
+		float folded_x = (1.0f - std::fabs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+		float folded_y = (1.0f - std::fabs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+		x = folded_x;
+		y = folded_y;
+	}
+	out[0] = x;
+	out[1] = y;
+}
+
+static std::vector<vertex_attribute> get_attributes(vertex_format format, bool normals)
+{
+	if (format == VERTEX_FULL)
+	{
+		return {
+			{ "position", 3, GL_FLOAT, GL_FALSE, 0 },
+			{ "texcoord", 2, GL_FLOAT, GL_FALSE, 3 * sizeof(float) },
+			{ "lmcoord", 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float) },
+			{ "normal", 3, GL_FLOAT, GL_FALSE, 7 * sizeof(float) },
+			{ "colour", 4, GL_UNSIGNED_BYTE, GL_TRUE, 10 * sizeof(float) }
+		};
+	}
+
+	std::vector<vertex_attribute> attributes;
+	int position_size = format == VERTEX_COMPACT ? 4 * sizeof(unsigned short) : 3 * sizeof(float);
+	if (format == VERTEX_COMPACT)
+		attributes.push_back({ "position", 3, GL_UNSIGNED_SHORT, GL_TRUE, 0 });
+	else
+		attributes.push_back({ "position", 3, GL_FLOAT, GL_FALSE, 0 });
+
+	attributes.push_back({ "texcoord", 2, GL_HALF_FLOAT, GL_FALSE, position_size });
+	attributes.push_back({ "lmcoord", 2, GL_UNSIGNED_SHORT, GL_TRUE, position_size + 4 });
+	attributes.push_back({ "colour", 4, GL_UNSIGNED_BYTE, GL_TRUE, position_size + 8 });
+	if (normals)
+		attributes.push_back({ "normal", 2, GL_SHORT, GL_TRUE, position_size + 12 });
+	return attributes;
+}
+
+packed_vertices pack_vertices(const std::vector<vertex>& vertices, vertex_format format, bool normals)
+{
+	packed_vertices packed;
+	packed.format = format;
+	packed.normals = format == VERTEX_FULL || normals;
+	packed.count = vertices.size();
+	packed.position_offset = glm::vec3(0.0f);
+	packed.position_scale = glm::vec3(1.0f);
+
+	if (format == VERTEX_FULL)
+	{
+		packed.stride = sizeof(vertex);
+		packed.data.resize(vertices.size() * sizeof(vertex));
+		if (!vertices.empty())
+			memcpy(&packed.data[0], &vertices[0], packed.data.size());
+		return packed;
+	}
+
+	int position_size = format == VERTEX_COMPACT ? 4 * sizeof(unsigned short) : 3 * sizeof(float);
+	packed.stride = position_size + 12 + (packed.normals ? 4 : 0);
+	packed.data.resize(vertices.size() * packed.stride);
+
+	// 16 bit positions are fractions of the bounds of everything being packed.
+	if (format == VERTEX_COMPACT && !vertices.empty())
+	{
+		glm::vec3 mins(vertices[0].position[0], vertices[0].position[1], vertices[0].position[2]);
+		glm::vec3 maxs = mins;
+		for (const vertex& v : vertices)
+		{
+			glm::vec3 point(v.position[0], v.position[1], v.position[2]);
+			mins = glm::min(mins, point);
+			maxs = glm::max(maxs, point);
+		}
+
+		packed.position_offset = mins;
+		packed.position_scale = glm::max(maxs - mins, glm::vec3(1.0f));
+	}
+
+	for (int i = 0; i < vertices.size(); ++i)
+	{
+		const vertex& v = vertices[i];
+		ubyte* out = &packed.data[i * packed.stride];
+
+		if (format == VERTEX_COMPACT)
+		{
+			unsigned short position[4];
+			for (int axis = 0; axis < 3; ++axis)
+				position[axis] = to_unorm16((v.position[axis] - packed.position_offset[axis]) / packed.position_scale[axis]);
+			position[3] = 0;
+			memcpy(out, position, sizeof(position));
+		}
+		else
+			memcpy(out, v.position, 3 * sizeof(float));
+		out += position_size;
+
+		unsigned short coords[4] = {
+			to_half(v.texcoord[0][0]), to_half(v.texcoord[0][1]),
+			to_unorm16(v.texcoord[1][0]), to_unorm16(v.texcoord[1][1])
+		};
+		memcpy(out, coords, sizeof(coords));
+		out += sizeof(coords);
+
+		memcpy(out, v.colour, 4);
+		out += 4;
+
+		if (packed.normals)
+		{
+			float octahedral[2];
+			oct_encode(v.normal, octahedral);
+			short normal[2] = { to_snorm16(octahedral[0]), to_snorm16(octahedral[1]) };
+			memcpy(out, normal, sizeof(normal));
+		}
+	}
+
+	return packed;
+}
+
+float position_error(const packed_vertices& packed)
+{
+	if (packed.format != VERTEX_COMPACT)
+		return 0.0f;
+
+	// rounded to the nearest of 65535 steps across the bounds.
+	const glm::vec3& scale = packed.position_scale;
+	return std::max(std::max(scale.x, scale.y), scale.z) / 65535.0f * 0.5f;
+}
+
+void apply_vertex_format(const packed_vertices& packed, GLuint program)
+{
+	// switching from a layout with normals to one without must not leave the old pointer enabled.
+	GLint normal_location = glGetAttribLocation(program, "normal");
+	if (normal_location >= 0)
+		glDisableVertexAttribArray(normal_location);
+
+	for (const vertex_attribute& attribute : get_attributes(packed.format, packed.normals))
+	{
+		// attributes the shader doesn't read get optimised out.
+		GLint location = glGetAttribLocation(program, attribute.name);
+		if (location < 0)
+			continue;
+
+		glVertexAttribPointer(location, attribute.size, attribute.type, attribute.normalized,
+			packed.stride, (void*)(long)attribute.offset);
+		glEnableVertexAttribArray(location);
+	}
+
+	glUniform3fv(glGetUniformLocation(program, "positionOffset"), 1, &packed.position_offset.x);
+	glUniform3fv(glGetUniformLocation(program, "positionScale"), 1, &packed.position_scale.x);
+	glUniform1i(glGetUniformLocation(program, "octahedralNormals"), packed.format != VERTEX_FULL);
+}
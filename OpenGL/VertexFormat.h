@@ -0,0 +1,38 @@
+#pragma once
+
+#include "BSPLoader.h"
+
+enum vertex_format
+{
+	VERTEX_FULL,			// the file's vertex struct as is, 44 bytes
+	VERTEX_COMPACT,			// 16 bit positions within the mesh bounds, 20 bytes
+	VERTEX_COMPACT_FLOAT	// compact, but with float positions for when 16 bits isn't enough, 24 bytes
+};
+
+// compact vertices, all attributes 4 byte aligned:
+//   position	3 x unorm16 + pad, or 3 x float
+//   texcoord	2 x half float (surface uv)
+//   lmcoord	2 x unorm16 (lightmap uv, in [0, 1] and needs more precision than half gives across the atlas)
+//   colour		4 x unorm8
+//   normal		2 x snorm16 octahedral, only if asked for since nothing shades with it yet
+struct packed_vertices
+{
+	vertex_format format;
+	bool normals;
+	GLsizei stride;
+	int count;
+	std::vector<ubyte> data;
+
+	// the shader rebuilds positions as offset + stored * scale.
+	glm::vec3 position_offset;
+	glm::vec3 position_scale;
+};
+
+packed_vertices pack_vertices(const std::vector<vertex>& vertices, vertex_format format, bool normals);
+
+// the most a decoded position can be off from the one it was packed from, 0 for float positions.
+float position_error(const packed_vertices& packed);
+
+// points the vertex shader's attributes at the packed layout and sets the decode uniforms.
+// the vertex buffer holding the data and the vertex array have to be bound, and the program in use.
+void apply_vertex_format(const packed_vertices& packed, GLuint program);
@@ -0,0 +1,184 @@
+#include "VertexWeld.h"
+
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+
+// a vertex snapped to the tolerance grid, equal keys get welded.
+struct weld_key
+{
+	long long cells[7];
+	unsigned int colour;
+
+	bool operator==(const weld_key& other) const
+	{
+		return colour == other.colour && memcmp(cells, other.cells, sizeof(cells)) == 0;
+	}
+};
+
+struct weld_key_hash
+{
+	size_t operator()(const weld_key& key) const
+	{
+		// FNV-1a over the cells and colour.
+		unsigned long long hash = 14695981039346656037ull;
+		for (long long cell : key.cells)
+			hash = (hash ^ (unsigned long long)cell) * 1099511628211ull;
+		hash = (hash ^ key.colour) * 1099511628211ull;
+		return (size_t)hash;
+	}
+};
+
+static long long snap(float value, float tolerance)
+{
+	if (tolerance > 0.0f)
+		return (long long)std::floor(value / tolerance + 0.5f);
+
+	// exact, the float's own bits. adding zero turns -0 into 0 so the two still weld.
+	value += 0.0f;
+	unsigned int bits;
+	memcpy(&bits, &value, sizeof(bits));
+	return bits;
+}
+
+// the 7 snapped attributes of a vertex and their tolerances, in key order.
+static void weld_attributes(const vertex& v, const weld_tolerance& tolerance, float values[7], float tolerances[7])
+{
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		values[axis] = v.position[axis];
+		tolerances[axis] = tolerance.position;
+	}
+	values[3] = v.texcoord[0][0];
+	values[4] = v.texcoord[0][1];
+	values[5] = v.texcoord[1][0];
+	values[6] = v.texcoord[1][1];
+	tolerances[3] = tolerances[4] = tolerance.texcoord;
+	tolerances[5] = tolerances[6] = tolerance.lmcoord;
+}
+
+static weld_key make_key(const vertex& v, const weld_tolerance& tolerance)
+{
+	float values[7], tolerances[7];
+	weld_attributes(v, tolerance, values, tolerances);
+
+	weld_key key;
+	for (int i = 0; i < 7; ++i)
+		key.cells[i] = snap(values[i], tolerances[i]);
+	memcpy(&key.colour, v.colour, sizeof(key.colour));
+	return key;
+}
+
+static bool within_tolerance(const vertex& a, const vertex& b, const weld_tolerance& tolerance)
+{
+	float values_a[7], values_b[7], tolerances[7];
+	weld_attributes(a, tolerance, values_a, tolerances);
+	weld_attributes(b, tolerance, values_b, tolerances);
+	for (int i = 0; i < 7; ++i)
+	{
+		if (tolerances[i] > 0.0f ? std::abs(values_a[i] - values_b[i]) > tolerances[i] : values_a[i] != values_b[i])
+			return false;
+	}
+	return memcmp(a.colour, b.colour, sizeof(a.colour)) == 0;
+}
+
+typedef std::unordered_map<weld_key, int, weld_key_hash> weld_map;
+
+// the welded vertex v belongs to, -1 if there's none yet. a value lying within a quarter cell of
+// its cell's edge can be the same as one just over it, so on a miss the cells across the nearby
+// edges are tried too, every combination of them, and what's found there has to be within the
+// tolerance.
+static int find_weld(const weld_map& welded, const weld_key& key, const vertex& v, const std::vector<vertex>& vertices,
+	const weld_tolerance& tolerance)
+{
+	auto found = welded.find(key);
+	if (found != welded.end())
+		return found->second;
+
+	float values[7], tolerances[7];
+	weld_attributes(v, tolerance, values, tolerances);
+
+	int near_axes[7], near_steps[7];
+	int near_count = 0;
+	for (int i = 0; i < 7; ++i)
+	{
+		if (tolerances[i] <= 0.0f)
+			continue;
+
+		float position = values[i] / tolerances[i] + 0.5f;
+		float offset = position - std::floor(position);
+		if (offset < 0.25f || offset > 0.75f)
+		{
+			near_axes[near_count] = i;
+			near_steps[near_count++] = offset < 0.5f ? -1 : 1;
+		}
+	}
+
+	for (int mask = 1; mask < (1 << near_count); ++mask)
+	{
+		weld_key neighbour = key;
+		for (int i = 0; i < near_count; ++i)
+		{
+			if (mask & (1 << i))
+				neighbour.cells[near_axes[i]] += near_steps[i];
+		}
+
+		found = welded.find(neighbour);
+		if (found != welded.end() && within_tolerance(vertices[found->second], v, tolerance))
+			return found->second;
+	}
+	return -1;
+}
+
+weld_report weld_vertices(render_mesh& mesh, const weld_tolerance& tolerance)
+{
+	weld_report report;
+	report.vertices_before = mesh.vertices.size();
+	report.faces_sharing = 0;
+
+	weld_map welded;
+	welded.reserve(mesh.vertices.size());
+	std::vector<int> remap(mesh.vertices.size(), -1);
+	std::vector<vertex> vertices;
+	vertices.reserve(mesh.vertices.size());
+
+	// the range that first used each welded vertex, to spot faces sharing with another.
+	std::vector<int> owner;
+	owner.reserve(mesh.vertices.size());
+	std::vector<char> sharing(mesh.ranges.size(), 0);
+
+	for (int i : ranges_in_buffer_order(mesh))
+	{
+		face_range& range = mesh.ranges[i];
+		for (unsigned int j = 0; j < range.n_indices; ++j)
+		{
+			unsigned int& index = mesh.indices[range.first_index + j];
+			int v = index + range.base_vertex;
+			if (remap[v] < 0)
+			{
+				weld_key key = make_key(mesh.vertices[v], tolerance);
+				int found = find_weld(welded, key, mesh.vertices[v], vertices, tolerance);
+				if (found < 0)
+				{
+					found = vertices.size();
+					welded.emplace(key, found);
+					vertices.push_back(mesh.vertices[v]);
+					owner.push_back(i);
+				}
+				remap[v] = found;
+			}
+
+			index = remap[v];
+			if (owner[index] != i)
+				sharing[i] = sharing[owner[index]] = 1;
+		}
+		range.base_vertex = 0;
+	}
+
+	for (char shares : sharing)
+		report.faces_sharing += shares;
+
+	mesh.vertices.swap(vertices);
+	report.vertices_after = mesh.vertices.size();
+	return report;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "RenderMesh.h"
+
+// how far apart two vertices can be and still count as the same one.
+struct weld_tolerance
+{
+	float position;		// map units
+	float texcoord;		// texture repeats
+	float lmcoord;		// lightmap widths
+};
+
+// q3map writes each face's corners separately, shared edges only need to survive float noise.
+const weld_tolerance DEFAULT_WELD_TOLERANCE = { 1.0f / 64.0f, 1.0f / 4096.0f, 1.0f / 65536.0f };
+
+struct weld_report
+{
+	int vertices_before;
+	int vertices_after;
+	int faces_sharing;		// faces with at least one vertex that another face uses too
+
+	// fraction of the vertex buffer that went away.
+	float reduction() const { return vertices_before ? 1.0f - (float)vertices_after / vertices_before : 0.0f; }
+};
+
+// merges vertices that match in position, texcoords, lightmap coords and colour (each snapped to
+// a grid of its tolerance, colour exactly) and rewrites the indices to point at the survivors.
+// vertices on either side of a grid line are welded too when they're within a quarter of the
+// tolerance in everything; further apart than that, ones in neighbouring cells can stay separate.
+// vertices no range draws are dropped. normals aren't compared, the first vertex's is kept.
+// every range comes out with base_vertex 0.
+weld_report weld_vertices(render_mesh& mesh, const weld_tolerance& tolerance = DEFAULT_WELD_TOLERANCE);
@@ -0,0 +1,111 @@
+#include "Visibility.h"
+
+#include <cstring>
+
+frustum extract_frustum(const glm::mat4& clip)
+{
+	// glm is column major, so row i of the matrix is clip[0][i], clip[1][i], ...
+	glm::vec4 rows[4];
+	for (int i = 0; i < 4; ++i)
+		rows[i] = glm::vec4(clip[0][i], clip[1][i], clip[2][i], clip[3][i]);
+
+	frustum result;
+	result.planes[0] = rows[3] + rows[0];	// left
+	result.planes[1] = rows[3] - rows[0];	// right
+	result.planes[2] = rows[3] + rows[1];	// bottom
+	result.planes[3] = rows[3] - rows[1];	// top
+	result.planes[4] = rows[3] + rows[2];	// near
+	result.planes[5] = rows[3] - rows[2];	// far
+	return result;
+}
+
+bool box_in_frustum(const frustum& view_frustum, const glm::vec3& mins, const glm::vec3& maxs)
+{
+	for (const glm::vec4& plane : view_frustum.planes)
+	{
+		// the corner furthest along the plane normal, if that's outside the whole box is.
+		glm::vec3 corner(plane.x >= 0 ? maxs.x : mins.x,
+			plane.y >= 0 ? maxs.y : mins.y,
+			plane.z >= 0 ? maxs.z : mins.z);
+
+		if (plane.x * corner.x + plane.y * corner.y + plane.z * corner.z + plane.w < 0)
+			return false;
+	}
+
+	return true;
+}
+
+Visibility::Visibility(const BSPLoader& loader, const render_mesh& mesh) : loader{ loader }, face_owners{ mesh.face_owners }
+{
+	face_visframe.resize(loader.get_faces().size(), -1);
+}
+
+void Visibility::gather_pvs_leafs(const std::vector<ubyte>& areamask)
+{
+	const std::vector<leaf>& leafs = loader.get_leafs();
+	pvs_leafs.clear();
+
+	for (int i = 0; i < leafs.size(); ++i)
+	{
+		const leaf& _leaf = leafs[i];
+
+		// cluster -1 leaves are solid or outside the map and never have faces worth drawing.
+		if (_leaf.cluster < 0 || !loader.cluster_visible(camera_cluster, _leaf.cluster))
+			continue;
+
+		if (!areamask.empty() && _leaf.area >= 0 && _leaf.area / 8 < areamask.size() &&
+			!(areamask[_leaf.area / 8] & (1 << (_leaf.area % 8))))
+			continue;
+
+		pvs_leafs.push_back(i);
+	}
+	pvs_rebuilds++;
+}
+
+void Visibility::update(const glm::vec3& position, const frustum& view_frustum, const std::vector<ubyte>& areamask)
+{
+	const std::vector<leaf>& leafs = loader.get_leafs();
+	const std::vector<leafface>& leaffaces = loader.get_leaffaces();
+
+	int cluster = leafs.empty() ? -1 : leafs[loader.find_leaf(position)].cluster;
+	bool same_pvs = cached && cluster == camera_cluster && areamask == cached_areamask;
+	if (same_pvs && memcmp(&view_frustum, &cached_frustum, sizeof(frustum)) == 0)
+		return;
+
+	camera_cluster = cluster;
+	if (!same_pvs)
+	{
+		gather_pvs_leafs(areamask);
+		cached_areamask = areamask;
+	}
+	cached_frustum = view_frustum;
+	cached = true;
+
+	visframe++;
+	visible_faces.clear();
+	visible_leafs.clear();
+
+	for (int i : pvs_leafs)
+	{
+		const leaf& _leaf = leafs[i];
+		if (!box_in_frustum(view_frustum,
+			glm::vec3(_leaf.mins[0], _leaf.mins[1], _leaf.mins[2]),
+			glm::vec3(_leaf.maxs[0], _leaf.maxs[1], _leaf.maxs[2])))
+			continue;
+
+		visible_leafs.push_back(i);
+
+		for (int j = 0; j < _leaf.n_leaffaces; ++j)
+		{
+			int face_index = face_owners[leaffaces[_leaf.leaffaces + j].face];
+			if (face_visframe[face_index] == visframe)
+				continue;
+
+			face_visframe[face_index] = visframe;
+			visible_faces.push_back(face_index);
+		}
+	}
+
+	version++;
+	face_rebuilds++;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "RenderMesh.h"
+
+// the six clip planes of a view, pointing inwards. a point p is inside a plane when
+// dot(plane.xyz, p) + plane.w >= 0.
+struct frustum
+{
+	glm::vec4 planes[6];
+};
+
+// pulls the planes out of a combined proj * view * model matrix, so they end up in the
+// model's space - BSP space for the world.
+frustum extract_frustum(const glm::mat4& clip);
+bool box_in_frustum(const frustum& view_frustum, const glm::vec3& mins, const glm::vec3& maxs);
+
+// works out which faces to draw from the camera's position: leaves outside the camera
+// cluster's PVS, in areas the areamask rules out or outside the frustum are skipped, and the faces
+// of the rest are collected once each. faces merged into another one at load time bring in the
+// face that draws them instead.
+// the PVS leaves are only gathered again when the cluster or areamask changes, and the faces only
+// when that or the frustum does, so a camera standing still costs next to nothing. faces already
+// collected are marked with a frame number (visframe) rather than cleared flags, leaves are only
+// ever visited once per pass and need no mark.
+class Visibility
+{
+public:
+	Visibility(const BSPLoader& loader, const render_mesh& mesh);
+
+	// position is in BSP space. areamask has one bit per area the camera can see into, an empty
+	// mask doesn't rule out any area.
+	void update(const glm::vec3& position, const frustum& view_frustum, const std::vector<ubyte>& areamask = {});
+
+	const std::vector<int>& get_visible_faces() const { return visible_faces; }
+	int get_camera_cluster() const { return camera_cluster; }
+	// the PVS leaves that passed the frustum test, only meaningful until the next update.
+	const std::vector<int>& get_visible_leafs() const { return visible_leafs; }
+	int get_visible_leaf_count() const { return visible_leafs.size(); }
+
+	// goes up whenever the visible faces change, so callers can keep what they built from them.
+	int get_version() const { return version; }
+	int get_pvs_rebuilds() const { return pvs_rebuilds; }
+	int get_face_rebuilds() const { return face_rebuilds; }
+private:
+	void gather_pvs_leafs(const std::vector<ubyte>& areamask);
+
+	const BSPLoader& loader;
+	std::vector<int> face_owners;
+
+	std::vector<int> pvs_leafs;			// leaves the camera cluster can see, before the frustum test
+	std::vector<int> visible_leafs;
+	std::vector<int> visible_faces;
+	std::vector<int> face_visframe;		// faces are shared between leaves, only add them once
+
+	int visframe = 0;
+	int camera_cluster = -1;
+
+	// what the cached lists were built for.
+	bool cached = false;
+	std::vector<ubyte> cached_areamask;
+	frustum cached_frustum;
+
+	int version = 0;
+	int pvs_rebuilds = 0;
+	int face_rebuilds = 0;
+};
@@ -0,0 +1,98 @@
+#include "WorkerPool.h"
+
+WorkerPool::WorkerPool(int threads)
+{
+	// default to one worker per spare hardware thread.
+	if (threads < 0)
+	{
+		int hardware = std::thread::hardware_concurrency();
+		threads = hardware > 1 ? hardware - 1 : 0;
+	}
+
+	for (int i = 0; i < threads; ++i)
+		workers.emplace_back(&WorkerPool::worker_loop, this);
+}
+
+WorkerPool::~WorkerPool()
+{
+	{
+		std::lock_guard<std::mutex> guard{ lock };
+		quit = true;
+	}
+	wake.notify_all();
+
+	for (auto& worker : workers)
+		worker.join();
+}
+
+void WorkerPool::parallel_for(int count, int grain, const std::function<void(int, int)>& job)
+{
+	if (count <= 0)
+		return;
+	if (grain < 1)
+		grain = 1;
+
+	// not worth waking anybody up for a single chunk.
+	if (workers.empty() || count <= grain)
+	{
+		job(0, count);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> guard{ lock };
+		current_job = &job;
+		job_count = count;
+		job_grain = grain;
+		next_chunk = 0;
+		busy_workers = workers.size();
+		++generation;
+	}
+	wake.notify_all();
+
+	run_chunks();
+
+	// wait for the workers to drain the rest of the chunks before the job goes out of scope.
+	std::unique_lock<std::mutex> guard{ lock };
+	done.wait(guard, [this] { return busy_workers == 0; });
+	current_job = nullptr;
+}
+
+void WorkerPool::run_chunks()
+{
+	while (true)
+	{
+		int begin = next_chunk.fetch_add(job_grain);
+		if (begin >= job_count)
+			break;
+
+		int end = begin + job_grain < job_count ? begin + job_grain : job_count;
+		(*current_job)(begin, end);
+	}
+}
+
+void WorkerPool::worker_loop()
+{
+	unsigned int seen = 0;
+
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> guard{ lock };
+			wake.wait(guard, [this, seen] { return quit || generation != seen; });
+
+			if (quit)
+				return;
+
+			seen = generation;
+		}
+
+		run_chunks();
+
+		{
+			std::lock_guard<std::mutex> guard{ lock };
+			--busy_workers;
+		}
+		done.notify_one();
+	}
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// small fixed-size thread pool for splitting a loop over a number of workers.
+// the calling thread takes part in the work, so a pool of 0 threads just runs inline.
+class WorkerPool
+{
+public:
+	explicit WorkerPool(int threads = -1);
+	~WorkerPool();
+
+	WorkerPool(const WorkerPool&) = delete;
+	WorkerPool& operator=(const WorkerPool&) = delete;
+
+	// calls job(begin, end) over [0, count) in chunks of grain items and blocks until all are done.
+	void parallel_for(int count, int grain, const std::function<void(int, int)>& job);
+
+	int get_thread_count() const { return workers.size() + 1; }
+private:
+	void worker_loop();
+	void run_chunks();
+
+	std::vector<std::thread> workers;
+	std::mutex lock;
+	std::condition_variable wake;
+	std::condition_variable done;
+
+	// current job, only valid while a parallel_for is in flight.
+	const std::function<void(int, int)>* current_job = nullptr;
+	int job_count = 0;
+	int job_grain = 1;
+	std::atomic<int> next_chunk{ 0 };
+	int busy_workers = 0;
+	unsigned int generation = 0;
+	bool quit = false;
+};
@@ -0,0 +1,152 @@
+#include "WorldSectors.h"
+
+WorldSectors::WorldSectors(const BSPLoader& loader) :
+	WorldSectors(
+		loader.get_models().empty() ? glm::vec3(-4096.0f) : glm::vec3(loader.get_models()[0].mins[0], loader.get_models()[0].mins[1], loader.get_models()[0].mins[2]),
+		loader.get_models().empty() ? glm::vec3(4096.0f) : glm::vec3(loader.get_models()[0].maxs[0], loader.get_models()[0].maxs[1], loader.get_models()[0].maxs[2]))
+{
+}
+
+WorldSectors::WorldSectors(const glm::vec3& mins, const glm::vec3& maxs)
+{
+	sectors.reserve(SECTOR_NODES);
+	create_sector(0, mins, maxs);
+}
+
+int WorldSectors::create_sector(int depth, const glm::vec3& mins, const glm::vec3& maxs)
+{
+	int index = sectors.size();
+	sectors.push_back(sector{ -1, 0.0f, { -1, -1 }, -1 });
+
+	if (depth == SECTOR_DEPTH)
+		return index;
+
+	// split the longer horizontal side in half, things are rarely stacked up high.
+	glm::vec3 size = maxs - mins;
+	int axis = size.x > size.y ? 0 : 1;
+	float dist = (maxs[axis] + mins[axis]) * 0.5f;
+
+	glm::vec3 front_mins = mins, back_maxs = maxs;
+	front_mins[axis] = dist;
+	back_maxs[axis] = dist;
+
+	int front = create_sector(depth + 1, front_mins, maxs);
+	int back = create_sector(depth + 1, mins, back_maxs);
+
+	sectors[index].axis = axis;
+	sectors[index].dist = dist;
+	sectors[index].children[0] = front;
+	sectors[index].children[1] = back;
+	return index;
+}
+
+int WorldSectors::add_entity(int contents)
+{
+	int handle;
+	if (!free_handles.empty())
+	{
+		handle = free_handles.back();
+		free_handles.pop_back();
+	}
+	else
+	{
+		handle = entities.size();
+		entities.push_back(sector_entity{});
+	}
+
+	sector_entity& ent = entities[handle];
+	ent.mins = glm::vec3(0.0f);
+	ent.maxs = glm::vec3(0.0f);
+	ent.contents = contents;
+	ent.sector = -1;
+	ent.prev = -1;
+	ent.next = -1;
+	return handle;
+}
+
+void WorldSectors::remove_entity(int handle)
+{
+	unlink(handle);
+	free_handles.push_back(handle);
+}
+
+void WorldSectors::link(int handle, const glm::vec3& mins, const glm::vec3& maxs)
+{
+	unlink(handle);
+
+	sector_entity& ent = entities[handle];
+	ent.mins = mins;
+	ent.maxs = maxs;
+
+	// go down while the box fits entirely on one side of the split.
+	int index = 0;
+	while (sectors[index].axis != -1)
+	{
+		const sector& node = sectors[index];
+		if (mins[node.axis] > node.dist)
+			index = node.children[0];
+		else if (maxs[node.axis] < node.dist)
+			index = node.children[1];
+		else
+			break;
+	}
+
+	sector& node = sectors[index];
+	ent.sector = index;
+	ent.prev = -1;
+	ent.next = node.first_entity;
+	if (node.first_entity != -1)
+		entities[node.first_entity].prev = handle;
+	node.first_entity = handle;
+}
+
+void WorldSectors::unlink(int handle)
+{
+	sector_entity& ent = entities[handle];
+	if (ent.sector == -1)
+		return;
+
+	if (ent.prev != -1)
+		entities[ent.prev].next = ent.next;
+	else
+		sectors[ent.sector].first_entity = ent.next;
+
+	if (ent.next != -1)
+		entities[ent.next].prev = ent.prev;
+
+	ent.sector = -1;
+	ent.prev = -1;
+	ent.next = -1;
+}
+
+void WorldSectors::query_box(const glm::vec3& mins, const glm::vec3& maxs, int mask, std::vector<int>& results) const
+{
+	query_sector(0, mins, maxs, mask, results);
+}
+
+void WorldSectors::query_sector(int index, const glm::vec3& mins, const glm::vec3& maxs, int mask, std::vector<int>& results) const
+{
+	const sector& node = sectors[index];
+
+	for (int handle = node.first_entity; handle != -1; handle = entities[handle].next)
+	{
+		const sector_entity& ent = entities[handle];
+		if (!(ent.contents & mask))
+			continue;
+
+		if (ent.mins.x > maxs.x || ent.mins.y > maxs.y || ent.mins.z > maxs.z ||
+			ent.maxs.x < mins.x || ent.maxs.y < mins.y || ent.maxs.z < mins.z)
+			continue;
+
+		results.push_back(handle);
+	}
+
+	if (node.axis == -1)
+		return;
+
+	// the box can straddle the split, in which case both sides get searched.
+	if (maxs[node.axis] > node.dist)
+		query_sector(node.children[0], mins, maxs, mask, results);
+	if (mins[node.axis] < node.dist)
+		query_sector(node.children[1], mins, maxs, mask, results);
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "BSPLoader.h"
+
+// levels of splitting below the root. Q3 uses 4 for its areanodes, two more levels
+// keep the per-sector lists short with a few thousand entities moving around.
+const int SECTOR_DEPTH = 6;
+const int SECTOR_NODES = (2 << SECTOR_DEPTH) - 1;
+
+// coarse static kd tree over the world bounds that dynamic entities (players, items, movers)
+// are linked into, like the areanodes in Q3's sv_world.c. an entity sits in the deepest node
+// that fully contains its box. finding that node walks the tree, O(depth) with the depth capped
+// at SECTOR_DEPTH, so linking doesn't grow with the entity count but isn't a single step either.
+// unlinking is a doubly linked list removal, O(1). a box query visits the sectors the box reaches
+// and every entity listed in them.
+class WorldSectors
+{
+public:
+	explicit WorldSectors(const BSPLoader& loader);
+	WorldSectors(const glm::vec3& mins, const glm::vec3& maxs);
+
+	// returns a handle for link/unlink. the entity isn't in any sector until it is linked.
+	int add_entity(int contents);
+	void remove_entity(int handle);
+
+	// (re)links the entity with a new box, unlinking it from wherever it was first.
+	void link(int handle, const glm::vec3& mins, const glm::vec3& maxs);
+	void unlink(int handle);
+
+	// appends every linked entity whose box touches the given box and whose contents match the mask.
+	void query_box(const glm::vec3& mins, const glm::vec3& maxs, int mask, std::vector<int>& results) const;
+
+	int get_entity_count() const { return entities.size() - free_handles.size(); }
+private:
+	struct sector
+	{
+		int axis;		// -1 for the bottom level
+		float dist;
+		int children[2];
+		int first_entity;	// head of the entity list, -1 if empty
+	};
+
+	struct sector_entity
+	{
+		glm::vec3 mins;
+		glm::vec3 maxs;
+		int contents;
+		int sector;		// -1 when not linked
+		int prev;
+		int next;
+	};
+
+	int create_sector(int depth, const glm::vec3& mins, const glm::vec3& maxs);
+	void query_sector(int index, const glm::vec3& mins, const glm::vec3& maxs, int mask, std::vector<int>& results) const;
+
+	std::vector<sector> sectors;
+	std::vector<sector_entity> entities;
+	std::vector<int> free_handles;
+};